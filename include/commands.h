@@ -0,0 +1,23 @@
+#ifndef HIF_COMMANDS
+#define HIF_COMMANDS
+
+#include <stdio.h>
+
+#include "hif.h"
+#include "storage_adapter.h"
+
+/* Commands report failure through their return value rather than exiting,
+ * so they can run inside long-lived processes such as hifd. */
+typedef int (*command_fn)(storage_interface const * adapter, int argc, char **argv);
+
+void print_version(FILE * out);
+void print_help(FILE * out);
+
+char * str_lower(char * s);
+hif_command str_to_command(const char * s);
+char const * command_name(hif_command command);
+
+int command_requires_storage(hif_command command);
+int run_command(storage_interface const * adapter, hif_command command, int argc, char **argv);
+
+#endif /* HIF_COMMANDS */
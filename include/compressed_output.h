@@ -0,0 +1,29 @@
+#ifndef HIF_COMPRESSED_OUTPUT
+#define HIF_COMPRESSED_OUTPUT
+
+#include <stddef.h>
+
+#include "storage_adapter.h"
+#include "output_buffer.h"
+
+/* A compressor on a thread of its own. An attached output_buffer hands each
+ * full block over and carries on with an empty one, so formatting and
+ * compression overlap; at most HIF_COMPRESS_QUEUE_BLOCKS blocks wait before
+ * the buffer does. Compressed bytes go to fd. */
+#define HIF_COMPRESS_QUEUE_BLOCKS 4
+
+typedef struct compressed_output compressed_output;
+
+export_compression export_compression_from_name(char const * name);
+char const * export_compression_name(export_compression compression);
+/* 0 when hif was built without the library */
+int export_compression_available(export_compression compression);
+
+/* NULL when the compressor cannot start */
+compressed_output * compressed_output_start(int fd, export_compression compression, size_t block_size);
+void compressed_output_attach(compressed_output * output, output_buffer * buffer);
+/* Compresses what is still queued, ends the stream and frees output;
+ * returns 0 if anything failed. Flush the attached buffer first. */
+int compressed_output_finish(compressed_output * output);
+
+#endif /* HIF_COMPRESSED_OUTPUT */
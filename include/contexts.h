@@ -0,0 +1,27 @@
+#ifndef HIF_CONTEXTS
+#define HIF_CONTEXTS
+
+#include <stddef.h>
+
+#include "storage_adapter.h"
+
+#define HIF_DEFAULT_CONTEXT "hif.db"
+
+/* Runs on its own thread with its own adapter, open on one context; partial
+ * is that context's slot and arg is shared by every context. Returns 0 on
+ * failure. */
+typedef int (*context_task)(storage_interface const * adapter, void * partial, void * arg);
+
+/* The file a context name refers to: the name itself when such a file
+ * exists or it already ends in .db, otherwise the name with .db appended */
+char * alloc_context_file_name(char const * name);
+
+/* Every hif context database in the config directory, in name order.
+ * Journals and other sqlite databases are left out. */
+char ** alloc_context_names(size_t * count);
+void free_context_names(char ** names, size_t count);
+
+/* Returns 1 when the task succeeded in every context */
+int run_in_contexts(char * const * names, size_t count, context_task task, void * arg, void * partials, size_t partial_size);
+
+#endif /* HIF_CONTEXTS */
@@ -0,0 +1,70 @@
+#ifndef HIF_EXPORT_FORMATS
+#define HIF_EXPORT_FORMATS
+
+#include <stddef.h>
+#include <sqlite3.h>
+
+#include "storage_adapter.h"
+#include "output_buffer.h"
+
+/* The columnar dump is little-endian and 8-byte aligned throughout, so it
+ * can be mmapped and its columns read in place:
+ *
+ *   char     magic[8]              "HIFCOL01"
+ *   uint32   version, status_count
+ *   status_count times:
+ *     uint32 status_id, name_len
+ *     char   name[name_len]
+ *     uint32 description_len       HIF_COLUMNAR_NULL_LEN when NULL
+ *     char   description[description_len]
+ *   zero padding to a multiple of 8
+ *   row groups, each:
+ *     uint32 row_count, reserved
+ *     int64  id[row_count]
+ *     int64  dtm[row_count]        microseconds since the epoch
+ *     uint16 status_id[row_count]
+ *     zero padding to a multiple of 8
+ *   uint32   0, reserved           end of row groups
+ *   uint64   total_rows
+ */
+#define HIF_COLUMNAR_MAGIC "HIFCOL01"
+#define HIF_COLUMNAR_VERSION 1u
+#define HIF_COLUMNAR_NULL_LEN 0xffffffffu
+#define HIF_COLUMNAR_GROUP_ROWS 16384
+
+typedef struct export_columns {
+  char ** names;
+  char ** keys; /* names as escaped json strings */
+  int count;
+} export_columns;
+
+/* Formats are driven row by row from a single scan, possibly in several
+ * threads, each with its own writer over its own buffer. Every row carries
+ * its leading separator; the first first_row_skip bytes of the very first
+ * row are dropped. */
+typedef struct export_writer {
+  output_buffer * out;
+  export_columns const * columns;
+  void * state;
+} export_writer;
+
+typedef struct export_format_interface {
+  char const * select_sql; /* select ... from ...; filters and order are appended */
+  size_t first_row_skip;
+
+  int (*write_header)(sqlite3 * db, output_buffer * out, export_columns const * columns);
+  void (*write_row)(export_writer * writer, sqlite3_stmt * stmt);
+  void (*finish_rows)(export_writer * writer);
+  void (*write_footer)(output_buffer * out, long rows);
+
+  void * (*alloc_state)();
+  void (*free_state)(void * state);
+} export_format_interface;
+
+export_format export_format_from_name(char const * name);
+export_format_interface const * get_export_format(export_format format);
+
+void export_writer_init(export_writer * writer, export_format_interface const * format, output_buffer * out, export_columns const * columns);
+void export_writer_free(export_writer * writer, export_format_interface const * format);
+
+#endif /* HIF_EXPORT_FORMATS */
@@ -0,0 +1,20 @@
+#ifndef HIF_EXPORTER
+#define HIF_EXPORTER
+
+#include <sqlite3.h>
+
+#include "storage_adapter.h"
+
+/* Writes the feels of the open context db to stdout. Parallel exports and
+ * exports of several contexts open their own read-only connections. */
+int export_feels(sqlite3 * db, char const * path, export_options const * options);
+
+/* Cursors are written as three dot-separated numbers; 0.0.0 is before
+ * everything */
+#define HIF_EXPORT_CURSOR_SIZE 64
+
+/* 0 unless text is a cursor */
+int export_cursor_from_text(char const * text, export_cursor * cursor);
+void export_cursor_text(export_cursor const * cursor, char text[HIF_EXPORT_CURSOR_SIZE]);
+
+#endif /* HIF_EXPORTER */
@@ -12,6 +12,7 @@ typedef enum hif_command {
   HIF_COMMAND_JSON,
 
   HIF_COMMAND_DELETE_FEEL,
+  HIF_COMMAND_DELETE_FEELS,
   HIF_COMMAND_CREATE_FEEL,
   HIF_COMMAND_ADD_FEEL,
 
@@ -21,6 +22,22 @@ typedef enum hif_command {
   HIF_COMMAND_GET_FEEL_DESCRIPTION,
 
   HIF_COMMAND_DELETE_MEMO,
+  HIF_COMMAND_SEARCH,
+  HIF_COMMAND_SEARCH_INDEX,
+
+  HIF_COMMAND_IMPORT,
+  HIF_COMMAND_IMPORT_JSON,
+
+  HIF_COMMAND_STATS,
+  HIF_COMMAND_DURABILITY,
+  HIF_COMMAND_SHARDS,
+  HIF_COMMAND_COMPACT,
+  HIF_COMMAND_METRICS,
+  HIF_COMMAND_BATCH,
+  HIF_COMMAND_SNAPSHOT,
+
+  HIF_COMMAND_HELP,
+  HIF_COMMAND_VERSION,
 
   HIF_COMMAND_EOF /* must be last */
 } hif_command;
@@ -0,0 +1,54 @@
+#ifndef HIF_HIFD_PROTOCOL
+#define HIF_HIFD_PROTOCOL
+
+#include <stdint.h>
+
+#include "hif.h"
+
+#define HIFD_EXECUTABLE "hifd"
+#define HIFD_SOCKET_NAME "hifd.sock"
+
+#define HIFD_PROTOCOL_MAGIC 0x68696664u /* "hifd" */
+#define HIFD_PROTOCOL_VERSION 1u
+#define HIFD_MAX_PAYLOAD (1u << 20)
+
+/* The client's stdout and stderr travel with every request */
+#define HIFD_REQUEST_FDS 2
+
+/* Sent instead of a command status when the daemon declines a request;
+ * the client then runs the command itself. */
+#define HIFD_STATUS_UNHANDLED INT32_MIN
+
+/* A request is this header, then argc NUL-terminated arguments */
+typedef struct hifd_request_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t argc;
+  uint32_t payload_len;
+} hifd_request_header;
+
+typedef struct hifd_request {
+  int argc;
+  char ** argv;
+  char * payload;
+
+  int fds[HIFD_REQUEST_FDS];
+} hifd_request;
+
+char * hifd_alloc_socket_path();
+int hifd_command_is_forwardable(hif_command command);
+/* Writes may share a commit when the context is batched */
+int hifd_command_is_write(hif_command command);
+
+int hifd_send_request(int socket_fd, int argc, char **argv, int const * fds);
+int hifd_recv_request(int socket_fd, hifd_request * request);
+void hifd_free_request(hifd_request * request);
+
+int hifd_send_status(int socket_fd, int32_t status);
+int hifd_recv_status(int socket_fd, int32_t * status);
+
+/* Runs the command on a running hifd; returns 0 when there is no daemon or
+ * it declined, so the caller should fall back to direct mode. */
+int hifd_forward(int argc, char **argv, int * status);
+
+#endif /* HIF_HIFD_PROTOCOL */
@@ -0,0 +1,41 @@
+#ifndef HIF_IMPORTER
+#define HIF_IMPORTER
+
+#include <stdio.h>
+
+#include "storage_adapter.h"
+
+#define HIF_IMPORT_DEFAULT_BATCH_SIZE 10000
+#define HIF_IMPORT_JSON_BUFFER_SIZE (1 << 16)
+#define HIF_IMPORT_JSON_MAX_RECORD (1 << 16)
+
+typedef enum import_format {
+  IMPORT_FORMAT_AUTO,
+  IMPORT_FORMAT_NDJSON,
+  IMPORT_FORMAT_CSV,
+  IMPORT_FORMAT_JSON /* a whole export-json document */
+} import_format;
+
+typedef struct import_stats {
+  long feels;
+  long memos;
+  long statuses;
+  long skipped;
+  long existing; /* restored feels left out because their id was taken */
+} import_stats;
+
+typedef struct importer_interface importer_interface;
+
+typedef struct importer_interface {
+  int (*import)(importer_interface const * importer, FILE * in, import_format format, import_stats * stats);
+
+  void (*free)(importer_interface const * importer);
+} importer_interface;
+
+importer_interface const * importer_alloc(storage_interface const * adapter, int batch_size);
+importer_interface const * importer_init(importer_interface * importer, storage_interface const * adapter, int batch_size);
+void importer_free(importer_interface const * importer);
+
+import_format import_format_from_name(char const * name);
+
+#endif /* HIF_IMPORTER */
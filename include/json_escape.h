@@ -0,0 +1,26 @@
+#ifndef HIF_JSON_ESCAPE
+#define HIF_JSON_ESCAPE
+
+#include <stddef.h>
+
+/* The most any single source byte can grow to, i.e. \u001f */
+#define HIF_JSON_ESCAPE_MAX_GROWTH (sizeof("\\u0000") - 1)
+
+typedef enum json_escape_kernel {
+  JSON_ESCAPE_KERNEL_SCALAR,
+  JSON_ESCAPE_KERNEL_SSE2,
+  JSON_ESCAPE_KERNEL_AVX2,
+
+  JSON_ESCAPE_KERNEL_EOF /* must be last */
+} json_escape_kernel;
+
+size_t json_escaped_length(unsigned char const * source, size_t source_len);
+size_t json_escape(char * dest, unsigned char const * source, size_t source_len);
+char * alloc_json_escape_string(unsigned char const * source);
+
+/* Explicit kernel selection; used by hif-bench to compare implementations */
+int json_escape_kernel_supported(json_escape_kernel kernel);
+char const * json_escape_kernel_name(json_escape_kernel kernel);
+size_t json_escape_using(json_escape_kernel kernel, char * dest, unsigned char const * source, size_t source_len);
+
+#endif /* HIF_JSON_ESCAPE */
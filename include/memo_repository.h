@@ -8,6 +8,8 @@ typedef struct memo_repository_interface memo_repository_interface;
 typedef struct memo_repository_interface {
   int (*insert_memo)(memo_repository_interface const * repository, char const * memo, int * affected_rows);
   int (*delete_memo)(memo_repository_interface const * repository, int id, int * affected_rows);
+  int64_t (*count_memos)(memo_repository_interface const * repository, time_range const * range);
+  int (*search_memos)(memo_repository_interface const * repository, char const * query, time_range const * range, int limit, memo_handler handler, void * context);
 
   void (*free)(memo_repository_interface const * repository);
 } memo_repository_interface;
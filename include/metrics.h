@@ -0,0 +1,66 @@
+#ifndef HIF_METRICS
+#define HIF_METRICS
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Every hif invocation adds its command's latency and row counts to
+ * ~/.config/hif/metrics, a fixed-size file shared through mmap and updated
+ * with atomic adds only, so concurrent runs never lock or lose updates.
+ * All fields are native-endian; the file is host-local by design:
+ *
+ *   char     magic[8]                 "HIFMET01"
+ *   uint32   version, slot_count
+ *   uint32   bucket_count, reserved
+ *   slot_count times:
+ *     uint32 state                    0 free, 1 being claimed, 2 in use
+ *     uint32 reserved
+ *     char   command[24]              NUL terminated
+ *     uint64 errors, sum_us, max_us, rows_read, rows_written
+ *     uint64 buckets[bucket_count]    see metrics_bucket
+ *
+ * Latencies land in log-linear buckets, four per power of two, so
+ * quantiles read back within 25%. */
+#define HIF_METRICS_FILE "metrics"
+#define HIF_METRICS_MAGIC "HIFMET01"
+#define HIF_METRICS_VERSION 1u
+#define HIF_METRICS_SLOTS 64
+#define HIF_METRICS_BUCKETS 144
+#define HIF_METRICS_COMMAND_LEN 24
+
+typedef struct metrics_slot {
+  uint32_t state;
+  uint32_t reserved;
+  char command[HIF_METRICS_COMMAND_LEN];
+  uint64_t errors;
+  uint64_t sum_us;
+  uint64_t max_us;
+  uint64_t rows_read;
+  uint64_t rows_written;
+  uint64_t buckets[HIF_METRICS_BUCKETS];
+} metrics_slot;
+
+typedef struct metrics_file {
+  char magic[8];
+  uint32_t version;
+  uint32_t slot_count;
+  uint32_t bucket_count;
+  uint32_t reserved;
+  metrics_slot slots[HIF_METRICS_SLOTS];
+} metrics_file;
+
+size_t metrics_bucket(uint64_t us);
+/* Smallest latency that falls past bucket */
+uint64_t metrics_bucket_limit(size_t bucket);
+
+/* Rows are tallied through the run and recorded with its latency */
+void metrics_count_rows_read(int64_t rows);
+void metrics_count_rows_written(int64_t rows);
+
+/* Returns 0 when the file cannot be mapped or belongs to another version */
+int metrics_record(char const * command, uint64_t us, int failed);
+
+/* Prometheus textfile collector format */
+int metrics_write_prometheus(FILE * out);
+
+#endif /* HIF_METRICS */
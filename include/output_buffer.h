@@ -0,0 +1,39 @@
+#ifndef HIF_OUTPUT_BUFFER
+#define HIF_OUTPUT_BUFFER
+
+#include <stddef.h>
+#include <string.h>
+
+#define HIF_OUTPUT_BUFFER_SIZE (1 << 20)
+
+/* Takes a full block and returns an empty one in its place, updating
+ * capacity to the new block's; NULL once the consumer has failed */
+typedef char * (*output_handoff)(void * consumer, char * data, size_t len, size_t * capacity);
+
+/* A growable byte buffer. Buffers bound to a file descriptor flush with
+ * write(2) once full; buffers with fd -1 only ever grow. A handoff, when
+ * set, takes the place of write(2). */
+typedef struct output_buffer {
+  char * data;
+  size_t len;
+  size_t capacity;
+
+  int fd;
+  int failed;
+
+  output_handoff handoff;
+  void * consumer;
+} output_buffer;
+
+void output_buffer_init(output_buffer * buffer, int fd, size_t capacity);
+void output_buffer_free(output_buffer * buffer);
+
+int output_buffer_flush(output_buffer * buffer);
+char * output_buffer_reserve(output_buffer * buffer, size_t len);
+void output_buffer_write(output_buffer * buffer, void const * data, size_t len);
+
+static inline void output_buffer_puts(output_buffer * buffer, char const * s) {
+  output_buffer_write(buffer, s, strlen(s));
+}
+
+#endif /* HIF_OUTPUT_BUFFER */
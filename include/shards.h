@@ -0,0 +1,48 @@
+#ifndef HIF_SHARDS
+#define HIF_SHARDS
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sqlite3.h>
+
+#include "storage_adapter.h"
+
+/* A partitioned context keeps each UTC month's feels in its own database
+ * beside it, {context}.shards/YYYY-MM.db. Months are numbered year * 100 +
+ * month.
+ *
+ * A feel written to a shard updates the context's counters, rollups and
+ * hif_shards in the same transaction. Under the strict level's rollback
+ * journal that commit is atomic across both files, but in WAL it is atomic
+ * per file only: a crash can keep the shard's half and lose the context's.
+ * Feels a shard holds past its hif_shards.last_feel_id are recorded again
+ * when it is next attached for writing, and new ids also count the current
+ * shard's own. A delete torn the same way leaves the counters and rollups
+ * too high. */
+#define HIF_SHARD_DIRECTORY_SUFFIX ".shards"
+#define HIF_SHARD_NAME_SIZE sizeof("YYYY-MM")
+
+int shard_month_of(int64_t microseconds);
+/* 0 unless name is YYYY-MM */
+int shard_month_from_name(char const * name);
+void shard_month_name(int month, char name[HIF_SHARD_NAME_SIZE]);
+time_range shard_month_range(int month);
+
+/* Relative to the config directory, as context names are */
+char * alloc_shard_file_name(char const * context_name, int month);
+
+/* ATTACH filename for a shard; mode is sqlite's ro, rw or rwc. The shard
+ * directory is created for rwc. */
+char * alloc_shard_uri(char const * context_name, int month, char const * mode);
+
+/* Each context followed by its shards that hold feels in range with ids
+ * from first_id on, oldest first, ready for export_options.contexts; free
+ * with free_context_names */
+char ** alloc_partition_names(char * const * contexts, size_t count, time_range const * range, int64_t first_id, size_t * partition_count);
+
+/* Sealed shards are switched to a rollback journal and made read-only */
+int seal_shard_file(char const * context_name, int month);
+/* Rewrites a sealed shard without free pages, replacing it atomically */
+int compact_shard_file(char const * context_name, int month);
+
+#endif /* HIF_SHARDS */
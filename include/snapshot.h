@@ -0,0 +1,57 @@
+#ifndef HIF_SNAPSHOT
+#define HIF_SNAPSHOT
+
+#include <stdint.h>
+#include <sqlite3.h>
+
+#include "storage_adapter.h"
+
+/* A context's feels as dense arrays in a sidecar, {context}.snapshot, for
+ * scans that never touch sqlite. Like metrics, the file is native-endian
+ * and host-local by design; it is mmapped and read in place:
+ *
+ *   char     magic[8]              "HIFSNP01"
+ *   uint32   version, reserved
+ *   int64    last_feel_id          newest feel id the snapshot holds
+ *   int64    last_tombstone_id     newest delete it reflects
+ *   uint64   rows
+ *   uint64   size                  bytes in use, this header included
+ *   uint64   statuses_offset       the newest statuses record
+ *   int64    feels                 the context's feel count when written
+ *   records up to size, each:
+ *     uint32 kind, count           HIF_SNAPSHOT_ROWS or HIF_SNAPSHOT_STATUSES
+ *     uint64 payload_size          a multiple of 8
+ *     rows:     int64 dtm[count], uint16 status_id[count], zero padding
+ *     statuses: count times uint32 status_id, name_len, char name[name_len];
+ *               zero padding
+ *
+ * Feels past last_feel_id are appended as new records and the header is
+ * written last, so bytes below a reader's size never change. A delete since
+ * last_tombstone_id, or a count that moved by more than the feels appended,
+ * means a rebuild into a new file renamed over the old.
+ * Feels without a status have status id 0. */
+#define HIF_SNAPSHOT_SUFFIX ".snapshot"
+#define HIF_SNAPSHOT_MAGIC "HIFSNP01"
+#define HIF_SNAPSHOT_VERSION 2u
+#define HIF_SNAPSHOT_GROUP_ROWS 16384
+
+#define HIF_SNAPSHOT_ROWS 1u
+#define HIF_SNAPSHOT_STATUSES 2u
+
+/* Brings the sidecar of context_name up to date with db and maps it. db's
+ * read transaction must already cover cursor, the context's export cursor.
+ * NULL on failure. */
+snapshot * snapshot_update(sqlite3 * db, char const * context_name, export_cursor const * cursor);
+void snapshot_close(snapshot * snap);
+
+int64_t snapshot_rows(snapshot const * snap);
+/* Rows this update added; all of them after a rebuild */
+int64_t snapshot_appended(snapshot const * snap);
+
+/* As the adapter's query_rollup, from a scan of the arrays; 0 once the
+ * handler fails */
+int snapshot_query_rollup(snapshot const * snap, storage_rollup rollup, int64_t first_day, rollup_handler handler, void * context);
+/* feel and range may be NULL; -1 when the snapshot has no such feel */
+int64_t snapshot_count_feels(snapshot const * snap, char const * feel, time_range const * range);
+
+#endif /* HIF_SNAPSHOT */
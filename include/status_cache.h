@@ -0,0 +1,32 @@
+#ifndef HIF_STATUS_CACHE
+#define HIF_STATUS_CACHE
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct status_entry {
+  char * name;
+  char * description; /* NULL when the status has none */
+  int id;
+
+  uint32_t hash;
+} status_entry;
+
+/* Status names interned into an open-addressed table; a context holds a
+ * handful of statuses, so the table is simply rebuilt when it goes stale. */
+typedef struct status_cache {
+  status_entry * entries;
+  size_t len;
+  size_t capacity; /* a power of two, or 0 before the first put */
+
+  int is_loaded;
+} status_cache;
+
+void status_cache_init(status_cache * cache);
+void status_cache_free(status_cache * cache);
+void status_cache_clear(status_cache * cache);
+
+void status_cache_put(status_cache * cache, int id, char const * name, char const * description);
+status_entry const * status_cache_get(status_cache const * cache, char const * name);
+
+#endif /* HIF_STATUS_CACHE */
@@ -1,12 +1,147 @@
 #ifndef HIF_STORAGE_ADAPTER
 #define HIF_STORAGE_ADAPTER
 
+#include <stddef.h>
+#include <stdint.h>
+
+#define HIF_TIME_MIN INT64_MIN
+#define HIF_TIME_MAX INT64_MAX
+
+/* Feels and memos are stamped in microseconds since the epoch. A range
+ * includes since and excludes until. */
+typedef struct time_range {
+  int64_t since;
+  int64_t until;
+} time_range;
+
 typedef int (*kvp_handler)(char const * key, char const * value, int is_numeric);
 
+typedef enum export_format {
+  EXPORT_FORMAT_JSON,
+  EXPORT_FORMAT_NDJSON,
+  EXPORT_FORMAT_CSV,
+  EXPORT_FORMAT_COLUMNAR,
+
+  EXPORT_FORMAT_EOF /* must be last */
+} export_format;
+
+typedef enum export_compression {
+  EXPORT_COMPRESSION_NONE,
+  EXPORT_COMPRESSION_GZIP,
+  EXPORT_COMPRESSION_ZSTD,
+
+  EXPORT_COMPRESSION_EOF /* must be last */
+} export_compression;
+
+/* A high-water mark over a context's changes: the newest feel id handed
+ * out, memo id and tombstone id. Deletes, and restores of ids below the
+ * newest, leave tombstones, so everything added, restored or deleted since
+ * a cursor lies above it. */
+typedef struct export_cursor {
+  int64_t feel_id;
+  int64_t memo_id;
+  int64_t tombstone_id;
+} export_cursor;
+
+typedef struct export_options {
+  kvp_handler kvp; /* NULL for the default json writer */
+  int jobs; /* read connections scanning in parallel; 1 or less is serial */
+  time_range const * range; /* NULL for every feel */
+  export_format format;
+  /* Context files exported together, each on its own thread, in place of
+   * the open context alone; NULL for just the open context. The adapter
+   * adds each context's shards. */
+  char * const * contexts;
+  size_t context_count;
+  /* Only the feels and memos added and the rows deleted after since, as
+   * json; NULL for a full export. The adapter fills in until, the cursor
+   * the export reaches and ends with. contexts then holds db's context
+   * first and its shards after. */
+  export_cursor const * since;
+  export_cursor const * until;
+  export_compression compression; /* applied on a thread of its own */
+} export_options;
+
+/* How hard a commit works to survive a crash. STRICT is sqlite's rollback
+ * journal with a full fsync per commit, FAST is WAL with synchronous=NORMAL
+ * and BATCHED is WAL with full syncs, where hifd groups concurrent writes
+ * into one commit. DEFAULT means whatever the context has been set to. */
+typedef enum storage_durability {
+  STORAGE_DURABILITY_DEFAULT,
+  STORAGE_DURABILITY_STRICT,
+  STORAGE_DURABILITY_FAST,
+  STORAGE_DURABILITY_BATCHED,
+
+  STORAGE_DURABILITY_EOF /* must be last */
+} storage_durability;
+
+storage_durability storage_durability_from_name(char const * name);
+char const * storage_durability_name(storage_durability durability);
+
+/* Where new feels go. MONTHLY keeps each UTC month's feels in a shard
+ * database of its own beside the context; memos, emotions, counters and
+ * rollups stay in the context itself. */
+typedef enum storage_partitioning {
+  STORAGE_PARTITIONING_NONE,
+  STORAGE_PARTITIONING_MONTHLY,
+
+  STORAGE_PARTITIONING_EOF /* must be last */
+} storage_partitioning;
+
+storage_partitioning storage_partitioning_from_name(char const * name);
+char const * storage_partitioning_name(storage_partitioning partitioning);
+
+typedef enum storage_shard_task {
+  STORAGE_SHARD_SEAL, /* make a past month's shard read-only */
+  STORAGE_SHARD_COMPACT, /* rewrite a sealed shard without free pages */
+
+  STORAGE_SHARD_EOF /* must be last */
+} storage_shard_task;
+
+/* Called once per shard, oldest first; month is year * 100 + month */
+typedef int (*shard_handler)(void * context, int month, int64_t feels, int sealed);
+
+/* Feels a bulk delete removes; every condition must hold */
+typedef struct feel_filter {
+  char const * feel; /* NULL for every status */
+  time_range const * range; /* NULL for all time */
+  int64_t first_id; /* inclusive */
+  int64_t last_id;
+} feel_filter;
+
+/* Pre-aggregated feel counts; days are whole UTC days since the epoch */
+typedef enum storage_rollup {
+  STORAGE_ROLLUP_STATUS, /* bucket 0, per status */
+  STORAGE_ROLLUP_HOUR, /* bucket is the UTC hour of day, per status */
+  STORAGE_ROLLUP_DAY, /* bucket is the day, per status, in day order */
+  STORAGE_ROLLUP_ACTIVE_DAY, /* bucket is the day, feel NULL, days with feels only */
+
+  STORAGE_ROLLUP_EOF /* must be last */
+} storage_rollup;
+
+/* Called once per rollup row; return 0 to stop early */
+typedef int (*rollup_handler)(void * context, int64_t bucket, char const * feel, int64_t feels);
+
+/* Called once per matching memo, best match first; return 0 to stop early */
+typedef int (*memo_handler)(void * context, int64_t id, char const * datetime, char const * memo);
+
+typedef enum storage_search_task {
+  STORAGE_SEARCH_REBUILD, /* reindex every memo */
+  STORAGE_SEARCH_OPTIMIZE, /* merge the index into one segment */
+
+  STORAGE_SEARCH_EOF /* must be last */
+} storage_search_task;
+
+/* A context's feels mapped as dense arrays; see snapshot.h */
+typedef struct snapshot snapshot;
+
 typedef struct storage_interface storage_interface;
 typedef struct storage_interface {
   int (*create_storage)(storage_interface const * adapter, char const * path);
   int (*open_storage)(storage_interface  const * adapter, char const * context_name);
+  /* For reads alone: nothing is migrated or written, and a context that
+   * needs migrating fails with SQLITE_SCHEMA */
+  int (*open_storage_read_only)(storage_interface const * adapter, char const * context_name);
   int (*close)(storage_interface const *adapter);
   
   int (*create_feel)(storage_interface const * adapter, char const * feel, char const * description);
@@ -14,12 +149,56 @@ typedef struct storage_interface {
 
   int (*insert_feel)(storage_interface const * adapter, char const * feel, char **description);
   int (*delete_feel)(storage_interface const * adapter, int id, int * affected_rows);
-  int (*count_feels)(storage_interface const * adapter);
+  /* feel and range may be NULL to count every status and time */
+  int64_t (*count_feels)(storage_interface const * adapter, char const * feel, time_range const * range);
   
   int (*insert_memo)(storage_interface const * adapter, char const * memo, int * affected_rows);
+  int64_t (*count_memos)(storage_interface const * adapter, time_range const * range);
+  /* query is in FTS5 syntax; a limit of 0 or less returns every match */
+  int (*search_memos)(storage_interface const * adapter, char const * query, time_range const * range, int limit, memo_handler handler, void * context);
+  int (*maintain_search)(storage_interface const * adapter, storage_search_task task);
 
-  int (*export)(storage_interface const * adapter, kvp_handler kvp);
+  int (*begin_transaction)(storage_interface const * adapter);
+  int (*commit_transaction)(storage_interface const * adapter);
+  int (*rollback_transaction)(storage_interface const * adapter);
+
+  int (*get_feel_id)(storage_interface const * adapter, char const * feel, int * id);
+  /* Imported feels are staged and reach hif_feels, a batch per statement, on flush_imports */
+  int (*import_feel)(storage_interface const * adapter, int feel_id, char const * dtm, char const * memo);
+  /* As import_feel, but keeps the feel's original id */
+  int (*restore_feel)(storage_interface const * adapter, int64_t id, int feel_id, char const * dtm);
+  /* Adds to existing, which may be NULL, the restored feels left out because
+   * their id was taken */
+  int (*flush_imports)(storage_interface const * adapter, long * existing);
+
+  int (*export)(storage_interface const * adapter, export_options const * options);
+  /* Updates the context's snapshot sidecar and maps it; NULL on failure.
+   * Close it with snapshot_close. */
+  snapshot * (*open_snapshot)(storage_interface const * adapter);
   int (*delete_by_id)(storage_interface const * adapter, char const * table_name,  int id, int * affected_rows);
+
+  /* Day rollups start at first_day; the others ignore it */
+  int (*query_rollup)(storage_interface const * adapter, storage_rollup rollup, int64_t first_day, rollup_handler handler, void * context);
+
+  int (*resolve_time)(storage_interface const * adapter, char const * expression, int64_t * microseconds);
+
+  int (*set_durability)(storage_interface const * adapter, storage_durability durability, int persist);
+  storage_durability (*get_durability)(storage_interface const * adapter);
+
+  int (*set_partitioning)(storage_interface const * adapter, storage_partitioning partitioning);
+  storage_partitioning (*get_partitioning)(storage_interface const * adapter);
+  int (*query_shards)(storage_interface const * adapter, shard_handler handler, void * context);
+  int (*maintain_shard)(storage_interface const * adapter, int month, storage_shard_task task);
+
+  /* Each call deletes at most limit matching feels, or frees at most pages
+   * pages, in a statement of its own, so other writers get in between calls;
+   * returns how many, 0 once there are none left, or -1 on failure */
+  int (*delete_feels)(storage_interface const * adapter, feel_filter const * filter, int limit);
+  int (*reclaim_space)(storage_interface const * adapter, int pages);
+  /* One blocking VACUUM, which also switches older contexts to incremental
+   * auto_vacuum */
+  int (*vacuum)(storage_interface const * adapter);
+
   void (*free)(storage_interface const * adapter);
 } storage_interface;
 
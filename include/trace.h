@@ -0,0 +1,32 @@
+#ifndef HIF_TRACE
+#define HIF_TRACE
+
+#include <stdint.h>
+#include <sqlite3.h>
+
+/* Set while a trace is open. Every hook checks it first, so a disabled trace
+ * costs one predictable branch. */
+extern int trace_enabled;
+
+/* destination is NULL or "stderr" for stderr, otherwise a file appended to.
+ * Returns 0 when the file cannot be opened. */
+int trace_open(char const * destination);
+void trace_close();
+
+/* Microseconds on the monotonic clock */
+int64_t trace_now();
+
+/* Each writes one JSON line */
+void trace_phase(char const * phase, int64_t started);
+void trace_statement_begin(sqlite3_stmt * stmt);
+void trace_statement_end(sqlite3_stmt * stmt);
+void trace_db(sqlite3 * db);
+void trace_memory();
+/* Bytes in and out of a compressor, its busy time and how often the
+ * export waited on it */
+void trace_compression(char const * codec, int64_t started, int64_t compress_us, uint64_t bytes_in, uint64_t bytes_out, long waits);
+
+#define TRACE_START(started) int64_t started = trace_enabled ? trace_now() : 0
+#define TRACE_PHASE(phase, started) do { if(trace_enabled) trace_phase(phase, started); } while(0)
+
+#endif /* HIF_TRACE */
@@ -0,0 +1,675 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sqlite3.h>
+
+#include "environment.h"
+#include "json_escape.h"
+#include "storage_adapter.h"
+
+#define BENCH_ESCAPE_BYTES (16 << 20)
+#define BENCH_ESCAPE_ROUNDS 8
+#define BENCH_DIFF_CASES 200000
+
+#define BENCH_DURABILITY_INSERTS 1000
+/* Stands in for the concurrent hif clients hifd folds into one commit */
+#define BENCH_DURABILITY_GROUP_SIZE 16
+
+#define BENCH_LOAD_CONTEXT "bench-load.db"
+#define BENCH_LOAD_BATCH 10000
+#define BENCH_LOAD_SECONDS_APART 600
+/* One feel in this many carries a memo */
+#define BENCH_LOAD_MEMO_EVERY 4
+#define BENCH_STARTUP_SAMPLES 50
+#define BENCH_EXPORT_JOBS 4
+
+#define BENCH_STRESS_CONTEXT "bench-stress.db"
+
+static char const * const BENCH_FEELS[] = { "sad", "meh", "tired", "anxious", "woo", "shrug" };
+
+/* The synthetic context; sizes and text shape are set from the command line */
+typedef struct bench_load {
+  long feels;
+  int memo_length;
+  double escape_density;
+  int samples;
+  int writers; /* processes the stress benchmark forks */
+  int writes; /* feels each of them adds */
+} bench_load;
+
+static double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Printable text with roughly density of its bytes needing an escape */
+static void fill_text(unsigned char * text, size_t len, double density) {
+  static unsigned char const SPECIAL[] = { '"', '\\', '\n', '\t', '\r', '\b', '\f', 0x01, 0x1f };
+
+  for(size_t i = 0; i < len; i++) {
+    if((double)rand() / RAND_MAX < density) {
+      text[i] = SPECIAL[(size_t)rand() % sizeof(SPECIAL)];
+    } else {
+      text[i] = (unsigned char)(' ' + rand() % ('~' - ' ' + 1));
+      if(text[i] == '"' || text[i] == '\\') text[i] = ' ';
+      if(rand() % 64 == 0) text[i] = 0xc3; /* high bytes must pass through */
+    }
+  }
+}
+
+/* Every kernel must agree with the scalar reference byte for byte */
+static int bench_escape_differential() {
+  unsigned char source[512];
+  char expected[sizeof(source) * HIF_JSON_ESCAPE_MAX_GROWTH];
+  char actual[sizeof(source) * HIF_JSON_ESCAPE_MAX_GROWTH];
+
+  long failures = 0;
+  for(long n = 0; n < BENCH_DIFF_CASES; n++) {
+    size_t len = (size_t)rand() % sizeof(source);
+    double density = (double)(rand() % 5) / 8.0;
+    fill_text(source, len, density);
+
+    size_t expected_len = json_escape_using(JSON_ESCAPE_KERNEL_SCALAR, expected, source, len);
+    if(json_escaped_length(source, len) != expected_len) failures++;
+
+    for(json_escape_kernel kernel = JSON_ESCAPE_KERNEL_SSE2; kernel < JSON_ESCAPE_KERNEL_EOF; kernel++) {
+      if(!json_escape_kernel_supported(kernel)) continue;
+
+      size_t actual_len = json_escape_using(kernel, actual, source, len);
+      if(actual_len != expected_len || memcmp(actual, expected, expected_len) != 0) failures++;
+    }
+  }
+
+  fprintf(stdout, "{\"benchmark\": \"json_escape_differential\", \"cases\": %i, \"failures\": %li}\n", BENCH_DIFF_CASES, failures);
+
+  return failures == 0;
+}
+
+static void bench_escape_throughput() {
+  static double const DENSITIES[] = { 0.0, 0.01, 0.1, 0.5 };
+
+  unsigned char * source = malloc(BENCH_ESCAPE_BYTES);
+  char * dest = malloc((size_t)BENCH_ESCAPE_BYTES * HIF_JSON_ESCAPE_MAX_GROWTH);
+  if(!source || !dest) abort();
+
+  for(size_t d = 0; d < sizeof(DENSITIES) / sizeof(*DENSITIES); d++) {
+    fill_text(source, BENCH_ESCAPE_BYTES, DENSITIES[d]);
+
+    for(json_escape_kernel kernel = JSON_ESCAPE_KERNEL_SCALAR; kernel < JSON_ESCAPE_KERNEL_EOF; kernel++) {
+      if(!json_escape_kernel_supported(kernel)) continue;
+
+      json_escape_using(kernel, dest, source, BENCH_ESCAPE_BYTES); /* fault in dest */
+
+      double start = now_seconds();
+      size_t written = 0;
+      for(int round = 0; round < BENCH_ESCAPE_ROUNDS; round++) {
+        written += json_escape_using(kernel, dest, source, BENCH_ESCAPE_BYTES);
+      }
+      double elapsed = now_seconds() - start;
+      double megabytes = (double)BENCH_ESCAPE_BYTES * BENCH_ESCAPE_ROUNDS / (1 << 20);
+
+      fprintf(stdout, "{\"benchmark\": \"json_escape\", \"kernel\": \"%s\", \"density\": %.2f, "
+        "\"bytes_in\": %li, \"bytes_out\": %zu, \"seconds\": %.6f, \"mib_per_second\": %.1f}\n",
+        json_escape_kernel_name(kernel), DENSITIES[d], (long)BENCH_ESCAPE_BYTES * BENCH_ESCAPE_ROUNDS,
+        written, elapsed, megabytes / elapsed);
+    }
+  }
+
+  free(dest), dest = NULL;
+  free(source), source = NULL;
+}
+
+/* Contexts live under a throwaway HOME so benchmarks never touch real feels.
+ * The config path is resolved once per process, so there is one per run. */
+static char * make_bench_home() {
+  char * home = strdup("/tmp/hif-bench.XXXXXX");
+  if(!home || !mkdtemp(home)) abort();
+
+  char * config = alloc_concat_path(home, ".config");
+  mkdir(config, 0700);
+  free(config), config = NULL;
+
+  setenv("HOME", home, 1);
+  ensure_config_path();
+
+  return home;
+}
+
+static void remove_bench_home(char * home) {
+  char const * config_path = get_config_path();
+
+  DIR * dir = opendir(config_path);
+  struct dirent * entry = NULL;
+  while(dir && (entry = readdir(dir))) {
+    if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+
+    char * path = alloc_concat_path(config_path, entry->d_name);
+    unlink(path);
+    free(path), path = NULL;
+  }
+  if(dir) closedir(dir);
+  rmdir(config_path);
+
+  char * config = alloc_concat_path(home, ".config");
+  rmdir(config);
+  free(config), config = NULL;
+  rmdir(home);
+
+  free(home), home = NULL;
+}
+
+/* One feel per commit, except batched, which commits a group at a time the
+ * way hifd does for concurrent clients. */
+static int bench_durability() {
+  int ok = 1;
+
+  for(storage_durability durability = STORAGE_DURABILITY_STRICT; ok && durability < STORAGE_DURABILITY_EOF; durability++) {
+    int group_size = durability == STORAGE_DURABILITY_BATCHED ? BENCH_DURABILITY_GROUP_SIZE : 1;
+
+    char * context = NULL;
+    asprintf(&context, "bench-%s.db", storage_durability_name(durability));
+
+    storage_interface const * adapter = storage_adapter_alloc();
+    ok = adapter->create_storage(adapter, context) == SQLITE_OK
+      && adapter->open_storage(adapter, context) == SQLITE_OK
+      && adapter->set_durability(adapter, durability, 1);
+
+    double start = now_seconds();
+    for(int n = 0; ok && n < BENCH_DURABILITY_INSERTS; n++) {
+      if(group_size > 1 && n % group_size == 0) ok = adapter->begin_transaction(adapter);
+
+      char * description = NULL;
+      ok = ok && adapter->insert_feel(adapter, "meh", &description);
+      free(description), description = NULL;
+
+      if(ok && group_size > 1 && (n % group_size == group_size - 1 || n == BENCH_DURABILITY_INSERTS - 1)) {
+        ok = adapter->commit_transaction(adapter);
+      }
+    }
+    double elapsed = now_seconds() - start;
+
+    if(ok) {
+      fprintf(stdout, "{\"benchmark\": \"durability\", \"level\": \"%s\", \"inserts\": %i, \"writes_per_commit\": %i, "
+        "\"seconds\": %.6f, \"inserts_per_second\": %.1f}\n",
+        storage_durability_name(durability), BENCH_DURABILITY_INSERTS, group_size, elapsed, BENCH_DURABILITY_INSERTS / elapsed);
+    } else {
+      fprintf(stderr, "durability benchmark failed at level %s\n", storage_durability_name(durability));
+    }
+
+    adapter->free(adapter);
+    free(context), context = NULL;
+  }
+
+  return ok;
+}
+
+static int compare_doubles(void const * a, void const * b) {
+  double x = *(double const *)a, y = *(double const *)b;
+  return (x > y) - (x < y);
+}
+
+/* Sorts samples in place and prints count, throughput and p50/p99 in
+ * microseconds as one JSON line, after any fields of the caller's own. */
+static void report_latency(char const * benchmark, char const * fields, double * samples, int count) {
+  if(count <= 0) return;
+
+  double total = 0;
+  for(int i = 0; i < count; i++) total += samples[i];
+  qsort(samples, (size_t)count, sizeof * samples, &compare_doubles);
+
+  fprintf(stdout, "{\"benchmark\": \"%s\", %s%s\"samples\": %i, \"ops_per_second\": %.1f, "
+    "\"p50_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f}\n",
+    benchmark, fields ? fields : "", fields ? ", " : "", count, count / total,
+    samples[count / 2] * 1e6, samples[(count * 99) / 100 < count ? (count * 99) / 100 : count - 1] * 1e6,
+    samples[count - 1] * 1e6);
+}
+
+/* Valid UTF-8 memo text; density of its characters need a JSON escape */
+static void fill_memo(char * memo, size_t len, double density) {
+  static char const SPECIAL[] = { '"', '\\', '\n', '\t' };
+
+  size_t i = 0;
+  while(i < len) {
+    int r = rand();
+    if((double)r / RAND_MAX < density) {
+      memo[i++] = SPECIAL[(size_t)rand() % sizeof(SPECIAL)];
+    } else if(r % 32 == 0 && i + 2 <= len) {
+      memo[i++] = (char)0xc3, memo[i++] = (char)0xa9;
+    } else {
+      memo[i++] = r % 6 == 0 ? ' ' : (char)('a' + rand() % 26);
+    }
+  }
+  memo[len] = '\0';
+}
+
+static storage_interface const * open_load_context() {
+  storage_interface const * adapter = storage_adapter_alloc();
+  if(adapter->open_storage(adapter, BENCH_LOAD_CONTEXT) != SQLITE_OK) {
+    adapter->free(adapter);
+    return NULL;
+  }
+  return adapter;
+}
+
+/* Bulk loads the synthetic context through the import path, oldest feel
+ * first, BENCH_LOAD_SECONDS_APART apart and ending now. */
+static int bench_load_context(bench_load const * load) {
+  storage_interface const * adapter = storage_adapter_alloc();
+  int ok = adapter->create_storage(adapter, BENCH_LOAD_CONTEXT) == SQLITE_OK
+    && adapter->open_storage(adapter, BENCH_LOAD_CONTEXT) == SQLITE_OK;
+
+  int feel_ids[sizeof(BENCH_FEELS) / sizeof(*BENCH_FEELS)];
+  for(size_t i = 0; ok && i < sizeof(BENCH_FEELS) / sizeof(*BENCH_FEELS); i++) {
+    ok = adapter->get_feel_id(adapter, BENCH_FEELS[i], &feel_ids[i]);
+  }
+
+  char * memo = malloc((size_t)load->memo_length * 2 + 1);
+  if(!memo) abort();
+
+  long long first = (long long)time(NULL) - (long long)load->feels * BENCH_LOAD_SECONDS_APART;
+  long memos = 0;
+  size_t memo_bytes = 0;
+
+  double start = now_seconds();
+  ok = ok && adapter->begin_transaction(adapter);
+  for(long n = 0; ok && n < load->feels; n++) {
+    char dtm[32];
+    snprintf(dtm, sizeof dtm, "%lld", first + (long long)n * BENCH_LOAD_SECONDS_APART);
+
+    char const * text = NULL;
+    if(load->memo_length > 0 && n % BENCH_LOAD_MEMO_EVERY == 0) {
+      size_t len = 1 + (size_t)rand() % ((size_t)load->memo_length * 2);
+      fill_memo(memo, len, load->escape_density);
+      text = memo;
+      memos++, memo_bytes += len;
+    }
+
+    ok = adapter->import_feel(adapter, feel_ids[(size_t)rand() % (sizeof(feel_ids) / sizeof(*feel_ids))], dtm, text);
+
+    if(ok && (n + 1) % BENCH_LOAD_BATCH == 0) {
+      ok = adapter->flush_imports(adapter, NULL) && adapter->commit_transaction(adapter) && adapter->begin_transaction(adapter);
+    }
+  }
+  ok = ok && adapter->flush_imports(adapter, NULL) && adapter->commit_transaction(adapter);
+  double elapsed = now_seconds() - start;
+
+  if(ok) {
+    fprintf(stdout, "{\"benchmark\": \"bulk_insert\", \"feels\": %li, \"memos\": %li, \"memo_bytes\": %zu, "
+      "\"escape_density\": %.2f, \"seconds\": %.6f, \"feels_per_second\": %.1f}\n",
+      load->feels, memos, memo_bytes, load->escape_density, elapsed, load->feels / elapsed);
+  } else {
+    fprintf(stderr, "loading the benchmark context failed\n");
+  }
+
+  free(memo), memo = NULL;
+  adapter->free(adapter);
+
+  return ok;
+}
+
+/* Opening a context and answering one count is the work of every short hif
+ * command. Cold drops the context from the page cache first. */
+static int bench_startup(bench_load const * load) {
+  char * path = alloc_concat_path(get_config_path(), BENCH_LOAD_CONTEXT);
+  double * samples = calloc(BENCH_STARTUP_SAMPLES, sizeof * samples);
+  if(!samples) abort();
+
+  int ok = 1;
+  for(int cold = 1; ok && cold >= 0; cold--) {
+    for(int n = 0; ok && n < BENCH_STARTUP_SAMPLES; n++) {
+      if(cold) {
+        int fd = open(path, O_RDONLY);
+        if(fd >= 0) {
+          fdatasync(fd);
+          posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+          close(fd);
+        }
+      }
+
+      double start = now_seconds();
+      storage_interface const * adapter = open_load_context();
+      ok = adapter && adapter->count_feels(adapter, NULL, NULL) >= 0;
+      if(adapter) adapter->free(adapter);
+      samples[n] = now_seconds() - start;
+    }
+
+    char fields[64];
+    snprintf(fields, sizeof fields, "\"cache\": \"%s\", \"feels\": %li", cold ? "cold" : "warm", load->feels);
+    if(ok) report_latency("startup", fields, samples, BENCH_STARTUP_SAMPLES);
+  }
+
+  free(samples), samples = NULL;
+  free(path), path = NULL;
+
+  return ok;
+}
+
+static int bench_count(bench_load const * load) {
+  storage_interface const * adapter = open_load_context();
+  if(!adapter) return 0;
+
+  double * samples = calloc((size_t)load->samples, sizeof * samples);
+  if(!samples) abort();
+
+  /* The last tenth of the journal */
+  int64_t now = (int64_t)time(NULL) * 1000000;
+  time_range recent = { now - (int64_t)(load->feels / 10) * BENCH_LOAD_SECONDS_APART * 1000000, HIF_TIME_MAX };
+
+  static char const * const CASES[] = { "all", "feel", "recent", "recent_feel" };
+  int ok = 1;
+  for(size_t c = 0; ok && c < sizeof(CASES) / sizeof(*CASES); c++) {
+    char const * feel = c % 2 ? "sad" : NULL;
+    time_range const * range = c >= 2 ? &recent : NULL;
+
+    for(int n = 0; ok && n < load->samples; n++) {
+      double start = now_seconds();
+      ok = adapter->count_feels(adapter, feel, range) >= 0;
+      samples[n] = now_seconds() - start;
+    }
+
+    char fields[96];
+    snprintf(fields, sizeof fields, "\"case\": \"%s\", \"feels\": %li", CASES[c], load->feels);
+    if(ok) report_latency("count_feels", fields, samples, load->samples);
+  }
+
+  free(samples), samples = NULL;
+  adapter->free(adapter);
+
+  return ok;
+}
+
+/* Exports go to a file in the bench home so their size can be reported */
+static int bench_export(bench_load const * load) {
+  storage_interface const * adapter = open_load_context();
+  if(!adapter) return 0;
+
+  char * path = alloc_concat_path(get_config_path(), "bench-export.json");
+  int ok = 1;
+
+  for(int jobs = 1; ok && jobs <= BENCH_EXPORT_JOBS; jobs *= BENCH_EXPORT_JOBS) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if(fd < 0) break;
+
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    dup2(fd, STDOUT_FILENO);
+
+    export_options options = { NULL, jobs, NULL, EXPORT_FORMAT_JSON, NULL, 0, NULL, NULL, EXPORT_COMPRESSION_NONE };
+    double start = now_seconds();
+    ok = adapter->export(adapter, &options) == SQLITE_OK;
+    double elapsed = now_seconds() - start;
+
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+
+    struct stat st;
+    off_t bytes = fstat(fd, &st) == 0 ? st.st_size : 0;
+    close(fd);
+
+    if(ok) {
+      fprintf(stdout, "{\"benchmark\": \"export\", \"jobs\": %i, \"feels\": %li, \"bytes\": %lld, \"seconds\": %.6f, "
+        "\"feels_per_second\": %.1f, \"mib_per_second\": %.1f}\n",
+        jobs, load->feels, (long long)bytes, elapsed, load->feels / elapsed, (double)bytes / (1 << 20) / elapsed);
+    }
+  }
+
+  unlink(path);
+  free(path), path = NULL;
+  adapter->free(adapter);
+
+  return ok;
+}
+
+/* A writer adds its feels the way separate hif runs would, opening and
+ * closing the context for each, and sends back each one's latency, or a
+ * negative one for a feel that was lost. */
+static void run_stress_writer(int start_fd, int result_fd, int writes) {
+  char go;
+  while(read(start_fd, &go, 1) > 0) { }
+
+  for(int n = 0; n < writes; n++) {
+    double start = now_seconds();
+
+    char * description = NULL;
+    storage_interface const * adapter = storage_adapter_alloc();
+    int ok = adapter->open_storage(adapter, BENCH_STRESS_CONTEXT) == SQLITE_OK
+      && adapter->insert_feel(adapter, BENCH_FEELS[(size_t)n % (sizeof(BENCH_FEELS) / sizeof(*BENCH_FEELS))], &description);
+    adapter->free(adapter);
+    free(description), description = NULL;
+
+    double elapsed = ok ? now_seconds() - start : -1;
+    if(write(result_fd, &elapsed, sizeof elapsed) != sizeof elapsed) break;
+  }
+}
+
+/* Forks the writers at once against one context at each durability level
+ * hif can reach without hifd, and checks every feel made it. */
+static int bench_stress(bench_load const * load) {
+  int ok = 1;
+
+  for(storage_durability durability = STORAGE_DURABILITY_STRICT; ok && durability <= STORAGE_DURABILITY_FAST; durability++) {
+    storage_interface const * adapter = storage_adapter_alloc();
+    ok = adapter->create_storage(adapter, BENCH_STRESS_CONTEXT) == SQLITE_OK
+      && adapter->open_storage(adapter, BENCH_STRESS_CONTEXT) == SQLITE_OK
+      && adapter->set_durability(adapter, durability, 1);
+    int64_t before = ok ? adapter->count_feels(adapter, NULL, NULL) : -1;
+    adapter->free(adapter);
+    if(!ok || before < 0) return 0;
+
+    int start_pipe[2];
+    if(pipe(start_pipe) != 0) return 0;
+    int * result_fds = calloc((size_t)load->writers, sizeof * result_fds);
+    pid_t * pids = calloc((size_t)load->writers, sizeof * pids);
+    if(!result_fds || !pids) abort();
+
+    fflush(stdout);
+    fflush(stderr);
+    int forked = 0;
+    for(; forked < load->writers; forked++) {
+      int result_pipe[2];
+      if(pipe(result_pipe) != 0) break;
+
+      pids[forked] = fork();
+      if(pids[forked] == 0) {
+        close(start_pipe[1]);
+        close(result_pipe[0]);
+        run_stress_writer(start_pipe[0], result_pipe[1], load->writes);
+        _exit(0);
+      }
+      close(result_pipe[1]);
+      result_fds[forked] = result_pipe[0];
+      if(pids[forked] < 0) {
+        close(result_pipe[0]);
+        break;
+      }
+    }
+
+    /* Closing the start pipe lets every writer go at once */
+    double start = now_seconds();
+    close(start_pipe[0]);
+    close(start_pipe[1]);
+
+    size_t capacity = (size_t)load->writers * (size_t)load->writes;
+    double * samples = calloc(capacity ? capacity : 1, sizeof * samples);
+    if(!samples) abort();
+    int committed = 0, failed = 0;
+    for(int i = 0; i < forked; i++) {
+      double sample;
+      while(read(result_fds[i], &sample, sizeof sample) == sizeof sample) {
+        if(sample < 0) failed++;
+        else samples[committed++] = sample;
+      }
+      close(result_fds[i]);
+    }
+    for(int i = 0; i < forked; i++) waitpid(pids[i], NULL, 0);
+    double elapsed = now_seconds() - start;
+
+    adapter = storage_adapter_alloc();
+    int64_t after = adapter->open_storage(adapter, BENCH_STRESS_CONTEXT) == SQLITE_OK ? adapter->count_feels(adapter, NULL, NULL) : -1;
+    adapter->free(adapter);
+
+    long expected = (long)load->writers * load->writes;
+    long lost = after < 0 ? expected : expected - (after - before);
+    ok = forked == load->writers && lost == 0;
+
+    qsort(samples, (size_t)committed, sizeof * samples, &compare_doubles);
+    fprintf(stdout, "{\"benchmark\": \"stress\", \"durability\": \"%s\", \"writers\": %i, \"writes\": %li, "
+      "\"committed\": %i, \"failed\": %i, \"lost\": %li, \"seconds\": %.6f, \"writes_per_second\": %.1f, "
+      "\"p50_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f}\n",
+      storage_durability_name(durability), load->writers, expected, committed, failed, lost, elapsed, committed / elapsed,
+      committed ? samples[committed / 2] * 1e6 : 0, committed ? samples[(committed * 99) / 100] * 1e6 : 0,
+      committed ? samples[committed - 1] * 1e6 : 0);
+    if(!ok) fprintf(stderr, "stress benchmark lost %li of %li feels at level %s\n", lost, expected, storage_durability_name(durability));
+
+    free(samples), samples = NULL;
+    free(pids), pids = NULL;
+    free(result_fds), result_fds = NULL;
+  }
+
+  return ok;
+}
+
+/* Single inserts at the context's default durability, then deletes of random
+ * existing feels, each in its own transaction. */
+static int bench_insert_delete(bench_load const * load) {
+  storage_interface const * adapter = open_load_context();
+  if(!adapter) return 0;
+
+  double * samples = calloc((size_t)load->samples, sizeof * samples);
+  if(!samples) abort();
+
+  int ok = 1;
+  for(int n = 0; ok && n < load->samples; n++) {
+    char * description = NULL;
+    double start = now_seconds();
+    ok = adapter->insert_feel(adapter, BENCH_FEELS[(size_t)n % (sizeof(BENCH_FEELS) / sizeof(*BENCH_FEELS))], &description);
+    samples[n] = now_seconds() - start;
+    free(description), description = NULL;
+  }
+
+  char fields[64];
+  snprintf(fields, sizeof fields, "\"durability\": \"%s\", \"feels\": %li",
+    storage_durability_name(adapter->get_durability(adapter)), load->feels);
+  if(ok) report_latency("insert_feel", fields, samples, load->samples);
+
+  int deleted = 0;
+  for(int n = 0; ok && n < load->samples && load->feels > 0; n++) {
+    int affected_rows = 0;
+    int id = 1 + (int)(((long)rand() * RAND_MAX + rand()) % load->feels);
+
+    double start = now_seconds();
+    ok = adapter->delete_by_id(adapter, "hif_feels", id, &affected_rows);
+    samples[deleted] = now_seconds() - start;
+    if(affected_rows) deleted++;
+  }
+
+  snprintf(fields, sizeof fields, "\"feels\": %li", load->feels);
+  if(ok) report_latency("delete_by_id", fields, samples, deleted);
+
+  free(samples), samples = NULL;
+  adapter->free(adapter);
+
+  return ok;
+}
+
+static int is_option(char const * arg) {
+  return strncmp(arg, "--", 2) == 0;
+}
+
+static int should_run(int argc, char **argv, char const * name) {
+  int named = 0;
+
+  for(int i = 1; i < argc; i++) {
+    if(is_option(argv[i])) {
+      i++;
+      continue;
+    }
+    if(strcmp(argv[i], name) == 0) return 1;
+    named = 1;
+  }
+
+  return !named;
+}
+
+static void print_usage(FILE * out) {
+  fprintf(out, "usage: hif-bench [--feels n] [--memo-length n] [--escape-density d] [--samples n]\n");
+  fprintf(out, "                 [--writers n] [--writes n] [benchmark ...]\n");
+  fprintf(out, "benchmarks: escape durability stress load startup count export insert\n");
+}
+
+static int parse_options(int argc, char **argv, bench_load * load) {
+  for(int i = 1; i < argc; i++) {
+    if(!is_option(argv[i])) continue;
+    if(i + 1 >= argc) return 0;
+
+    char const * value = argv[++i];
+    if(strcmp(argv[i - 1], "--feels") == 0) load->feels = atol(value);
+    else if(strcmp(argv[i - 1], "--memo-length") == 0) load->memo_length = atoi(value);
+    else if(strcmp(argv[i - 1], "--escape-density") == 0) load->escape_density = atof(value);
+    else if(strcmp(argv[i - 1], "--samples") == 0) load->samples = atoi(value);
+    else if(strcmp(argv[i - 1], "--writers") == 0) load->writers = atoi(value);
+    else if(strcmp(argv[i - 1], "--writes") == 0) load->writes = atoi(value);
+    else return 0;
+  }
+
+  return load->feels >= 0 && load->memo_length >= 0 && load->samples > 0 && load->writers > 0 && load->writes > 0
+    && load->escape_density >= 0 && load->escape_density <= 1;
+}
+
+/* Everything but escape and durability runs against one generated context */
+static int bench_synthetic_load(int argc, char **argv, bench_load const * load) {
+  static char const * const NAMES[] = { "load", "startup", "count", "export", "insert" };
+
+  int wanted = 0;
+  for(size_t i = 0; i < sizeof(NAMES) / sizeof(*NAMES); i++) wanted |= should_run(argc, argv, NAMES[i]);
+  if(!wanted) return 1;
+
+  int ok = bench_load_context(load);
+  if(ok && should_run(argc, argv, "startup")) ok = bench_startup(load);
+  if(ok && should_run(argc, argv, "count")) ok = bench_count(load);
+  if(ok && should_run(argc, argv, "export")) ok = bench_export(load);
+  if(ok && should_run(argc, argv, "insert")) ok = bench_insert_delete(load);
+
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  bench_load load = { 100000, 64, 0.05, 1000, 100, 20 };
+  if(!parse_options(argc, argv, &load)) {
+    print_usage(stderr);
+    return 1;
+  }
+
+  srand(42);
+  sqlite3_initialize();
+
+  int ret = 0;
+  if(should_run(argc, argv, "escape")) {
+    if(!bench_escape_differential()) {
+      fprintf(stderr, "json escape kernels disagree with the scalar reference\n");
+      ret = 1;
+      goto err0;
+    }
+
+    bench_escape_throughput();
+  }
+
+  char * home = make_bench_home();
+  if(should_run(argc, argv, "durability") && !bench_durability()) ret = 1;
+  if(should_run(argc, argv, "stress") && !bench_stress(&load)) ret = 1;
+  if(!bench_synthetic_load(argc, argv, &load)) ret = 1;
+  remove_bench_home(home);
+
+err0:
+  sqlite3_shutdown();
+
+  return ret;
+}
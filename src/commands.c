@@ -0,0 +1,1472 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <sqlite3.h>
+
+#include "hif.h"
+#include "memo_repository.h"
+#include "storage_adapter.h"
+#include "importer.h"
+#include "environment.h"
+#include "contexts.h"
+#include "export_formats.h"
+#include "exporter.h"
+#include "compressed_output.h"
+#include "metrics.h"
+#include "shards.h"
+#include "snapshot.h"
+#include "commands.h"
+
+#define HIF_STATS_DEFAULT_DAYS 7
+#define HIF_STATS_BAR_WIDTH 40
+#define HIF_SECONDS_PER_DAY 86400
+#define HIF_SEARCH_DEFAULT_LIMIT 20
+#define HIF_DELETE_DEFAULT_BATCH_SIZE 1000
+#define HIF_COMPACT_PAGES 256
+
+void print_version(FILE * out) {
+  fprintf(out, HIF_EXECUTABLE " " HIF_VERSION "\n");
+}
+
+void print_help(FILE * out) {
+  print_version(out);  
+  fprintf(out, "usage: hif [--context {name}] [--durability {level}] [--trace] [+emotion | command (args)*]\n\n");
+  if(out == stderr) {
+    fprintf(out, "Sorry bud, you need to tell me how you feel.\n");
+    fprintf(out, "\nOr try a command:\n");
+  }
+  fprintf(out, "\nEmotion Commands\n");
+  fprintf(out, "\tadd {emotion}        - Journal a new {emotion} feel.\n");
+  fprintf(out, "\t                       alias +, i.e. $ hif +sad\n");
+  fprintf(out, "\tdelete-feel {id}     - Delete a feel by id.\n");
+  fprintf(out, "\tdelete-feels         - Delete every feel matching all of:\n");
+  fprintf(out, "\t                       --ids {1-100,200,...}, --feel {emotion}\n");
+  fprintf(out, "\t                       --since {time}, --until {time}\n");
+  fprintf(out, "\t                       --batch-size {feels} per transaction, 1000 by default\n");
+
+  fprintf(out, "\nJournaling Commands\n");
+  fprintf(out, "\tmemo {memo}          - Add a memo.\n");
+  fprintf(out, "\tdelete-memo {memo-id}- Delete a memo by id.\n");
+  fprintf(out, "\tcount-memos          - Return a count of memos.\n");
+  fprintf(out, "\t                       --since {time}, --until {time}, --all-contexts\n");
+  fprintf(out, "\tsearch {words}       - Find memos, best match first.\n");
+  fprintf(out, "\t                       --since {time}, --until {time}\n");
+  fprintf(out, "\t                       --limit {n}, 20 by default, --raw FTS5 query\n");
+  fprintf(out, "\tsearch-index {task}  - Maintain the memo search index:\n");
+  fprintf(out, "\t                       rebuild or optimize\n");
+
+  fprintf(out, "\nMetadata Commands\n");
+  fprintf(out, "\tdescribe-feel {feel} - Describe a feel.\n");
+  fprintf(out, "\tcreate-emotion       - Create a new emotion.\n");
+  fprintf(out, "\tcount-feels {feel}   - Return a count of feels, optionally of one feel.\n");
+  fprintf(out, "\t                       --since {time}, --until {time}, --all-contexts\n");
+  fprintf(out, "\t                       --snapshot to scan the snapshot\n");
+  fprintf(out, "\tcreate-context       - Create a new feels context database.\n");
+  fprintf(out, "\tstats                - Summarize feels by emotion, hour, day and streak.\n");
+  fprintf(out, "\t                       --days {n} recent days to list, 7 by default\n");
+  fprintf(out, "\t                       --all-contexts to sum every context\n");
+  fprintf(out, "\t                       --snapshot to scan the snapshot\n");
+  fprintf(out, "\tdurability {level}   - Show or set the context's durability:\n");
+  fprintf(out, "\t                       strict, fast or batched\n");
+  fprintf(out, "\tshards {task}        - List the context's monthly shards, or:\n");
+  fprintf(out, "\t                       monthly or none to partition new feels or not\n");
+  fprintf(out, "\t                       seal {YYYY-MM} to make a past month read-only\n");
+  fprintf(out, "\t                       compact {YYYY-MM} to rewrite a sealed shard\n");
+  fprintf(out, "\tcompact              - Return free pages to the filesystem, a few at a time.\n");
+  fprintf(out, "\t                       --full to VACUUM once, as older contexts need\n");
+  fprintf(out, "\tmetrics {file}       - Write latency and row metrics of past commands\n");
+  fprintf(out, "\t                       in Prometheus text format, to stdout or {file}\n");
+  fprintf(out, "\tsnapshot             - Bring the context's snapshot, a file of dense\n");
+  fprintf(out, "\t                       arrays for stats and counts to scan, up to date\n");
+
+  fprintf(out, "\nImport/Export Commands\n");
+  fprintf(out, "\texport-json          - Dump feels in json format.\n");
+  fprintf(out, "\t                       --format json|ndjson|csv|columnar\n");
+  fprintf(out, "\t                       --jobs {n} scans in parallel\n");
+  fprintf(out, "\t                       --all-contexts, one after another\n");
+  fprintf(out, "\t                       --since {time}, --until {time}\n");
+  fprintf(out, "\t                       --since-cursor {cursor} for changes only\n");
+  fprintf(out, "\t                       --compress gzip|zstd on a thread of its own\n");
+  fprintf(out, "\timport {file}        - Bulk import feels from NDJSON or CSV.\n");
+  fprintf(out, "\t                       reads stdin when {file} is omitted or -\n");
+  fprintf(out, "\t                       --format ndjson|csv, --batch-size {rows}\n");
+  fprintf(out, "\timport-json {file}   - Restore an export-json dump, keeping ids and times.\n");
+  fprintf(out, "\t                       reads stdin when {file} is omitted or -\n");
+  fprintf(out, "\t                       --batch-size {rows}\n");
+  fprintf(out, "\tbatch {file}         - Run one command per line in a single transaction.\n");
+  fprintf(out, "\t                       reads stdin when {file} is omitted or -\n");
+  fprintf(out, "\t                       --group-size {lines} to commit every so many lines\n");
+  fprintf(out, "\n");
+  fprintf(out, "\thelp                 - Print this message.\n");
+  fprintf(out, "\tversion              - Print hif version information.\n");
+  fprintf(out, "\n");
+  fprintf(out, "Examples:\n");
+  fprintf(out, "\n");
+  fprintf(out, "Creating a new emotion:\n");
+  fprintf(out, "$ hif create-emotion \"love\" \"I love you\"\n");
+
+  fprintf(out, "\n");
+  fprintf(out, "Journaling a happy feel:\n");
+  fprintf(out, "$ hif +love\n");
+}
+
+char * str_lower(char * s) {
+  char * p = s;
+  for (; *p; ++p) { *p = tolower(*p); }
+  return s;
+}
+
+hif_command str_to_command(const char * s) {
+  const size_t MAX_COMMAND_LENGTH = sizeof("describe-feel") - 1;
+
+  size_t len = strnlen(s, MAX_COMMAND_LENGTH);
+  if(*s == '+' || strncmp(s, "add", len) == 0) {
+    return HIF_COMMAND_ADD_FEEL;
+  } else if(strncmp(s, "describe-feel", len) == 0) {
+    return HIF_COMMAND_GET_FEEL_DESCRIPTION;
+  } else if(strncmp(s, "export-json", len) == 0) {
+    return HIF_COMMAND_JSON;
+  } else if(strncmp(s, "delete-feel", len) == 0) {
+    return HIF_COMMAND_DELETE_FEEL;
+  } else if(strncmp(s, "delete-feels", len) == 0) {
+    return HIF_COMMAND_DELETE_FEELS;
+  } else if(strncmp(s, "count-feels", len) == 0) {
+    return HIF_COMMAND_COUNT_FEELS;
+  } else if(strncmp(s, "count-memos", len) == 0) {
+    return HIF_COMMAND_COUNT_MEMOS;
+  } else if(strncmp(s, "create-context", len) == 0) {
+    return HIF_COMMAND_CREATE;
+  } else if(strncmp(s, "create-emotion", len) == 0) {
+    return HIF_COMMAND_CREATE_FEEL;
+  } else if(strncmp(s, "memo", len) == 0) {
+    return HIF_COMMAND_ADD_MEMO;
+  } else if(strncmp(s, "delete-memo", len) == 0) {
+    return HIF_COMMAND_DELETE_MEMO;
+  } else if(strncmp(s, "search", len) == 0) {
+    return HIF_COMMAND_SEARCH;
+  } else if(strncmp(s, "search-index", len) == 0) {
+    return HIF_COMMAND_SEARCH_INDEX;
+  } else if(strncmp(s, "import", len) == 0) {
+    return HIF_COMMAND_IMPORT;
+  } else if(strncmp(s, "import-json", len) == 0) {
+    return HIF_COMMAND_IMPORT_JSON;
+  } else if(strncmp(s, "stats", len) == 0) {
+    return HIF_COMMAND_STATS;
+  } else if(strncmp(s, "durability", len) == 0) {
+    return HIF_COMMAND_DURABILITY;
+  } else if(strncmp(s, "shards", len) == 0) {
+    return HIF_COMMAND_SHARDS;
+  } else if(strncmp(s, "compact", len) == 0) {
+    return HIF_COMMAND_COMPACT;
+  } else if(strncmp(s, "metrics", len) == 0) {
+    return HIF_COMMAND_METRICS;
+  } else if(strncmp(s, "batch", len) == 0) {
+    return HIF_COMMAND_BATCH;
+  } else if(strncmp(s, "snapshot", len) == 0) {
+    return HIF_COMMAND_SNAPSHOT;
+  } else if(strncmp(s, "help", len) == 0) {
+    return HIF_COMMAND_HELP;
+  } else if(strncmp(s, "version", len) == 0) {
+    return HIF_COMMAND_VERSION;
+  } else {
+    return HIF_COMMAND_EOF;
+  }
+}
+
+static int command_create(storage_interface const * adapter, int argc, char **argv) {
+  const char * path = NULL;
+  if(argc >= 3) {
+    path = argv[2];
+  }
+  int rc = adapter->create_storage(adapter, path);
+  if(rc) return -1;
+
+  fprintf(stdout, "Created context %s\n", path);
+  return 0;
+}
+
+/* Consumes --since or --until {time} at argv[*i]. Returns 1 when it did,
+ * 0 when argv[*i] is something else and -1 for a time it cannot read. */
+static int parse_time_option(storage_interface const * adapter, int argc, char **argv, int * i, time_range * range) {
+  int is_since = strcmp(argv[*i], "--since") == 0;
+  if(!is_since && strcmp(argv[*i], "--until") != 0) return 0;
+  if(*i + 1 >= argc) return -1;
+
+  char const * expression = argv[++*i];
+  if(!adapter->resolve_time(adapter, expression, is_since ? &range->since : &range->until)) {
+    fprintf(stderr, "Unable to make sense of the time '%s'.\n", expression);
+    return -1;
+  }
+
+  return 1;
+}
+
+typedef struct count_query {
+  char const * feel; /* NULL for every feel */
+  time_range const * range; /* NULL for all time */
+  int memos; /* count memos rather than feels */
+  int snapshot; /* scan the context's snapshot rather than query it */
+} count_query;
+
+typedef struct count_partial {
+  int64_t count;
+  int knows_feel;
+} count_partial;
+
+static int64_t count_feels_in(storage_interface const * adapter, char const * feel, time_range const * range, int use_snapshot) {
+  if(!use_snapshot) return adapter->count_feels(adapter, feel, range);
+
+  snapshot * snap = adapter->open_snapshot(adapter);
+  if(!snap) return -1;
+
+  int64_t count = snapshot_count_feels(snap, feel, range);
+  snapshot_close(snap);
+
+  return count;
+}
+
+/* A context that has never heard of the feel simply has none of it */
+static int count_in_context(storage_interface const * adapter, void * partial, void * arg) {
+  count_query const * query = arg;
+  count_partial * result = partial;
+
+  int feel_id = 0;
+  result->knows_feel = !query->feel || adapter->get_feel_id(adapter, query->feel, &feel_id);
+  if(!result->knows_feel) return 1;
+
+  int64_t count = query->memos ? adapter->count_memos(adapter, query->range) : count_feels_in(adapter, query->feel, query->range, query->snapshot);
+  result->count = count;
+
+  return count >= 0;
+}
+
+/* Every context is counted on its own thread and connection */
+static int command_count_across_contexts(count_query const * query) {
+  size_t count = 0;
+  char ** names = alloc_context_names(&count);
+  count_partial * partials = calloc(count ? count : 1, sizeof * partials);
+  if(!partials) abort();
+
+  int ok = run_in_contexts(names, count, &count_in_context, (void *)query, partials, sizeof * partials);
+
+  int64_t total = 0;
+  int known = 0;
+  for(size_t i = 0; i < count; i++) {
+    total += partials[i].count;
+    known = known || partials[i].knows_feel;
+  }
+
+  free(partials), partials = NULL;
+  free_context_names(names, count);
+
+  if(ok && !known) {
+    fprintf(stderr, "No context is familiar with the feels '%s'.\n", query->feel);
+    return -1;
+  }
+
+  fprintf(stdout, "%lli\n", ok ? (long long)total : -1LL);
+  return ok ? 0 : -1;
+}
+
+static int command_count_feels(storage_interface const * adapter, int argc, char **argv) {
+  time_range range = { HIF_TIME_MIN, HIF_TIME_MAX };
+  int has_range = 0;
+  int all_contexts = 0;
+  int use_snapshot = 0;
+  char const * feel = NULL;
+
+  for(int i = 2; i < argc; i++) {
+    int parsed = parse_time_option(adapter, argc, argv, &i, &range);
+    if(parsed > 0) {
+      has_range = 1;
+    } else if(parsed == 0 && strcmp(argv[i], "--all-contexts") == 0) {
+      all_contexts = 1;
+    } else if(parsed == 0 && strcmp(argv[i], "--snapshot") == 0) {
+      use_snapshot = 1;
+    } else if(parsed == 0 && !feel && strncmp(argv[i], "--", 2) != 0) {
+      feel = argv[i];
+    } else {
+      if(parsed == 0) print_help(stderr);
+      return -1;
+    }
+  }
+
+  if(all_contexts) {
+    count_query query = { feel, has_range ? &range : NULL, 0, use_snapshot };
+    return command_count_across_contexts(&query);
+  }
+
+  int feel_id = 0;
+  if(feel && !adapter->get_feel_id(adapter, feel, &feel_id)) {
+    fprintf(stderr, "I'm not familiar with the feels '%s'.\n", feel);
+    return -1;
+  }
+
+  int64_t count = count_feels_in(adapter, feel, has_range ? &range : NULL, use_snapshot);
+  fprintf(stdout, "%lli\n", (long long)count);
+  return count < 0 ? -1 : 0;
+}
+
+static int command_add_feel(storage_interface const * adapter, int argc, char **argv) {
+  if(argc < 2) {
+    print_help(stderr);
+    return -1;
+  }
+
+  char * feel = argv[1];
+  if(*feel == '+') {
+    feel++;
+  } else {
+    if(argc < 3) {
+      print_help(stderr);
+      return -1;
+    }
+    feel = argv[2];
+  }
+  
+  /* A write that fails for any other reason is reported by the adapter */
+  int feel_id = 0;
+  if(!adapter->get_feel_id(adapter, feel, &feel_id)) {
+    fprintf(stderr, "I'm not familiar with the feels '%s'. Try create-emotion, first.\n", feel);
+    return -1;
+  }
+
+  char * description = NULL;
+  int rc = adapter->insert_feel(adapter, feel, &description);
+  if(rc) fprintf(stdout, "Feels '%s' logged, %s\n", feel, description ? description : "(yay)");
+  
+  if(description) free(description), description = NULL;
+  return rc ? 0 : -1;
+}
+
+static int command_export(storage_interface const * adapter, int argc, char **argv) {
+  export_options options = { NULL, 1, NULL, EXPORT_FORMAT_JSON, NULL, 0, NULL, NULL, EXPORT_COMPRESSION_NONE };
+  time_range range = { HIF_TIME_MIN, HIF_TIME_MAX };
+  export_cursor since;
+
+  for(int i = 2; i < argc; i++) {
+    int parsed = parse_time_option(adapter, argc, argv, &i, &range);
+    if(parsed > 0) {
+      options.range = &range;
+    } else if(parsed == 0 && strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      options.jobs = atoi(argv[++i]);
+    } else if(parsed == 0 && strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+      options.format = export_format_from_name(argv[++i]);
+      if(options.format == EXPORT_FORMAT_EOF) {
+        fprintf(stderr, "Unknown export format '%s'; try json, ndjson, csv or columnar.\n", argv[i]);
+        return -1;
+      }
+    } else if(parsed == 0 && strcmp(argv[i], "--all-contexts") == 0) {
+      if(!options.contexts) options.contexts = alloc_context_names(&options.context_count);
+    } else if(parsed == 0 && strcmp(argv[i], "--compress") == 0 && i + 1 < argc) {
+      options.compression = export_compression_from_name(argv[++i]);
+      if(options.compression == EXPORT_COMPRESSION_EOF || !export_compression_available(options.compression)) {
+        fprintf(stderr, options.compression == EXPORT_COMPRESSION_EOF
+          ? "Unknown compression '%s'; try gzip or zstd.\n" : "hif was built without %s support.\n", argv[i]);
+        free_context_names((char **)options.contexts, options.context_count);
+        return -1;
+      }
+    } else if(parsed == 0 && strcmp(argv[i], "--since-cursor") == 0 && i + 1 < argc) {
+      if(!export_cursor_from_text(argv[++i], &since)) {
+        fprintf(stderr, "'%s' is not an export cursor; start from 0.0.0.\n", argv[i]);
+        free_context_names((char **)options.contexts, options.context_count);
+        return -1;
+      }
+      options.since = &since;
+    } else {
+      if(parsed == 0) print_help(stderr);
+      free_context_names((char **)options.contexts, options.context_count);
+      return -1;
+    }
+  }
+
+  if(options.since && (options.contexts || options.range || options.format != EXPORT_FORMAT_JSON)) {
+    fprintf(stderr, "Changes since a cursor are exported as json, for the open context and all time.\n");
+    free_context_names((char **)options.contexts, options.context_count);
+    return -1;
+  }
+
+  if(options.contexts && options.format == EXPORT_FORMAT_COLUMNAR) {
+    fprintf(stderr, "Columnar exports hold a single context's emotions; export contexts one at a time.\n");
+    free_context_names((char **)options.contexts, options.context_count);
+    return -1;
+  }
+
+  int rc = adapter->export(adapter, &options);
+  free_context_names((char **)options.contexts, options.context_count);
+  if(rc != SQLITE_OK) {
+    fprintf(stderr, "Export failed: %s\n", sqlite3_errstr(rc));
+    return -1;
+  }
+  return 0;
+}
+
+static int command_delete_feel(storage_interface const * adapter, int argc, char **argv) {
+  if(argc < 3) {
+    print_help(stderr);
+    return 1;
+  }
+  int id = atoi(argv[2]);
+  int affected_rows = 0;
+  int rc = adapter->delete_feel(adapter, id, &affected_rows);
+
+  if(!rc || affected_rows == 0) {
+    fprintf(stderr, "Nothing to delete, feel id %i is not present!\n", (int)id);
+  } else {
+    fprintf(stdout, "Feel deleted!\n");
+  }
+  return rc && affected_rows ? 0 : 1;
+}
+
+/* Parses 1-100,200,300-400 into first and last ids; returns the count of
+ * ranges, or -1 for anything else */
+static int parse_id_ranges(char const * list, int64_t ** ranges) {
+  int count = 0;
+  *ranges = NULL;
+
+  for(char const * p = list; *p; ) {
+    char * end = NULL;
+    long long first = strtoll(p, &end, 10), last = first;
+    if(end == p || first < 0) goto err0;
+    if(*end == '-') {
+      p = end + 1;
+      last = strtoll(p, &end, 10);
+      if(end == p || last < first) goto err0;
+    }
+    if(*end == ',') end++;
+    else if(*end) goto err0;
+    p = end;
+
+    *ranges = realloc(*ranges, (size_t)(count + 1) * 2 * sizeof ** ranges);
+    if(!*ranges) abort();
+    (*ranges)[count * 2] = first;
+    (*ranges)[count * 2 + 1] = last;
+    count++;
+  }
+
+  if(count) return count;
+
+err0:
+  free(*ranges), *ranges = NULL;
+  return -1;
+}
+
+/* Deletes a batch per transaction, so other writers are never held up for
+ * long, until nothing matches */
+static int command_delete_feels(storage_interface const * adapter, int argc, char **argv) {
+  time_range range = { HIF_TIME_MIN, HIF_TIME_MAX };
+  int has_range = 0;
+  char const * feel = NULL;
+  char const * ids = NULL;
+  int batch_size = HIF_DELETE_DEFAULT_BATCH_SIZE;
+
+  for(int i = 2; i < argc; i++) {
+    int parsed = parse_time_option(adapter, argc, argv, &i, &range);
+    if(parsed > 0) {
+      has_range = 1;
+    } else if(parsed == 0 && strcmp(argv[i], "--feel") == 0 && i + 1 < argc) {
+      feel = argv[++i];
+    } else if(parsed == 0 && strcmp(argv[i], "--ids") == 0 && i + 1 < argc) {
+      ids = argv[++i];
+    } else if(parsed == 0 && strcmp(argv[i], "--batch-size") == 0 && i + 1 < argc) {
+      batch_size = atoi(argv[++i]);
+    } else {
+      if(parsed == 0) print_help(stderr);
+      return -1;
+    }
+  }
+
+  if(!has_range && !feel && !ids) {
+    fprintf(stderr, "Refusing to delete every feel; pass --ids, --feel, --since or --until.\n");
+    return -1;
+  }
+  if(batch_size <= 0) {
+    fprintf(stderr, "The batch size must be at least 1.\n");
+    return -1;
+  }
+
+  int feel_id = 0;
+  if(feel && !adapter->get_feel_id(adapter, feel, &feel_id)) {
+    fprintf(stderr, "I'm not familiar with the feels '%s'.\n", feel);
+    return -1;
+  }
+
+  int64_t all_ids[] = { 0, INT64_MAX };
+  int64_t * id_ranges = all_ids;
+  int range_count = 1;
+  if(ids && (range_count = parse_id_ranges(ids, &id_ranges)) < 0) {
+    fprintf(stderr, "Unable to make sense of the ids '%s'.\n", ids);
+    return -1;
+  }
+
+  long total = 0;
+  int deleted = 0;
+  for(int i = 0; i < range_count && deleted >= 0; i++) {
+    feel_filter filter = { feel, has_range ? &range : NULL, id_ranges[i * 2], id_ranges[i * 2 + 1] };
+    while((deleted = adapter->delete_feels(adapter, &filter, batch_size)) > 0) total += deleted;
+  }
+
+  if(id_ranges != all_ids) free(id_ranges), id_ranges = NULL;
+
+  fprintf(deleted < 0 ? stderr : stdout, "Deleted %li feels.\n", total);
+  return deleted < 0 ? -1 : 0;
+}
+
+static int command_create_feel(storage_interface const * adapter, int argc, char **argv) {
+  if(argc < 3) {
+    print_help(stderr);
+    return -1;
+  }
+  char const * name = argv[2];
+  char const * description = NULL;
+  if(argc > 3) {
+    description = argv[3];  
+  }
+
+  int rc = adapter->create_feel(adapter, name, description);
+  if(!rc) {
+    fprintf(stderr, "Skipped adding feel '%s'; it already exists!\n", name);
+  } else {
+    fprintf(stdout, "Created feel '%s': %s\n", name, description ? description : "[empty]");
+  }
+  return rc ? 0 : -1;
+}
+
+static int command_count_memos(storage_interface const * adapter, int argc, char **argv) {
+  time_range range = { HIF_TIME_MIN, HIF_TIME_MAX };
+  int has_range = 0;
+  int all_contexts = 0;
+
+  for(int i = 2; i < argc; i++) {
+    int parsed = parse_time_option(adapter, argc, argv, &i, &range);
+    if(parsed > 0) {
+      has_range = 1;
+    } else if(parsed == 0 && strcmp(argv[i], "--all-contexts") == 0) {
+      all_contexts = 1;
+    } else {
+      if(parsed == 0) print_help(stderr);
+      return -1;
+    }
+  }
+
+  if(all_contexts) {
+    count_query query = { NULL, has_range ? &range : NULL, 1, 0 };
+    return command_count_across_contexts(&query);
+  }
+
+  memo_repository_interface const * repository = memo_repository_alloc(adapter);
+  int64_t count = repository->count_memos(repository, has_range ? &range : NULL);
+  repository->free(repository);
+
+  fprintf(stdout, "%lli\n", (long long)count);
+  return count < 0 ? -1 : 0;
+}
+
+static int command_add_memo(storage_interface const * adapter, int argc, char **argv) {
+  if(argc < 3) {
+    print_help(stderr);
+    return -1;
+  }
+
+  char const * memo = argv[2];
+
+  int affected_rows;
+  int rc = adapter->insert_memo(adapter, memo, &affected_rows);
+
+  if(!rc) {
+    fprintf(stderr, "Failed to add memo.\n");
+  } else {
+    fprintf(stdout, "Added new memo, '%s'\n", memo);
+  }
+  return rc ? 0 : -1;
+}
+
+static int command_delete_memo(storage_interface const * adapter, int argc, char **argv) {
+  if(argc < 3) {
+    print_help(stderr);
+    return 1;
+  }
+  int id = atoi(argv[2]);
+  int affected_rows = 0;
+
+  memo_repository_interface const * repository = memo_repository_alloc(adapter);
+  int rc = repository->delete_memo(repository, id, &affected_rows);
+  repository->free(repository);
+  if(!rc || affected_rows == 0) {
+    fprintf(stderr, "Nothing to delete, memo id %i is not present!\n", (int)id);
+  } else {
+    fprintf(stdout, "Memo deleted!\n");
+  }
+  return rc && affected_rows ? 0 : 1;
+}
+
+/* Every word becomes a quoted FTS5 string, so punctuation is searched for
+ * rather than parsed; a trailing * still matches as a prefix. */
+static char * alloc_search_query(int argc, char **argv, int raw) {
+  size_t capacity = 1;
+  for(int i = 0; i < argc; i++) capacity += strlen(argv[i]) * 4 + 1;
+
+  char * query = malloc(capacity);
+  if(!query) abort();
+  char * d = query;
+
+  for(int i = 0; i < argc; i++) {
+    if(raw) {
+      if(d != query) *d++ = ' ';
+      d = stpcpy(d, argv[i]);
+      continue;
+    }
+
+    for(char const * s = argv[i]; *s;) {
+      while(*s && isspace((unsigned char)*s)) s++;
+      if(!*s) break;
+
+      char const * end = s;
+      while(*end && !isspace((unsigned char)*end)) end++;
+
+      int is_prefix = end - s > 1 && end[-1] == '*';
+      if(d != query) *d++ = ' ';
+      *d++ = '"';
+      for(; s < end - is_prefix; s++) {
+        if(*s == '"') *d++ = '"';
+        *d++ = *s;
+      }
+      *d++ = '"';
+      if(is_prefix) *d++ = '*';
+      s = end;
+    }
+  }
+  *d = '\0';
+
+  return query;
+}
+
+static int print_memo_match(void * context, int64_t id, char const * datetime, char const * memo) {
+  ++*(int *)context;
+  fprintf(stdout, "%lli\t%s\t%s\n", (long long)id, datetime, memo);
+  return 1;
+}
+
+static int command_search(storage_interface const * adapter, int argc, char **argv) {
+  time_range range = { HIF_TIME_MIN, HIF_TIME_MAX };
+  int has_range = 0;
+  int limit = HIF_SEARCH_DEFAULT_LIMIT;
+  int raw = 0;
+
+  char ** terms = calloc((size_t)argc, sizeof * terms);
+  if(!terms) abort();
+  int term_count = 0;
+
+  for(int i = 2; i < argc; i++) {
+    int parsed = parse_time_option(adapter, argc, argv, &i, &range);
+    if(parsed > 0) {
+      has_range = 1;
+    } else if(parsed == 0 && strcmp(argv[i], "--limit") == 0 && i + 1 < argc) {
+      limit = atoi(argv[++i]);
+    } else if(parsed == 0 && strcmp(argv[i], "--raw") == 0) {
+      raw = 1;
+    } else if(parsed == 0 && strncmp(argv[i], "--", 2) != 0) {
+      terms[term_count++] = argv[i];
+    } else {
+      if(parsed == 0) print_help(stderr);
+      free(terms), terms = NULL;
+      return -1;
+    }
+  }
+
+  char * query = alloc_search_query(term_count, terms, raw);
+  free(terms), terms = NULL;
+  if(!*query) {
+    free(query), query = NULL;
+    print_help(stderr);
+    return -1;
+  }
+
+  int matches = 0;
+  memo_repository_interface const * repository = memo_repository_alloc(adapter);
+  int rc = repository->search_memos(repository, query, has_range ? &range : NULL, limit, &print_memo_match, &matches);
+  repository->free(repository);
+  metrics_count_rows_read(matches);
+
+  if(!rc) fprintf(stderr, "Unable to search for '%s'.\n", query);
+  free(query), query = NULL;
+
+  return rc ? (matches ? 0 : 1) : -1;
+}
+
+static int command_search_index(storage_interface const * adapter, int argc, char **argv) {
+  storage_search_task task = STORAGE_SEARCH_EOF;
+  if(argc == 3 && strcmp(argv[2], "rebuild") == 0) task = STORAGE_SEARCH_REBUILD;
+  if(argc == 3 && strcmp(argv[2], "optimize") == 0) task = STORAGE_SEARCH_OPTIMIZE;
+  if(task == STORAGE_SEARCH_EOF) {
+    print_help(stderr);
+    return -1;
+  }
+
+  if(!adapter->maintain_search(adapter, task)) {
+    fprintf(stderr, "Failed to %s the search index.\n", argv[2]);
+    return -1;
+  }
+  fprintf(stdout, "Search index %s.\n", task == STORAGE_SEARCH_REBUILD ? "rebuilt" : "optimized");
+  return 0;
+}
+
+static int command_get_feel_description(storage_interface const * adapter, int argc, char **argv) {
+  if(argc < 3) {
+    print_help(stderr);
+    return -1;
+  }
+
+  char * feel = argv[2];
+  char * description = NULL;
+
+  int rc = adapter->get_feel_description(adapter, feel, &description);
+  if(rc) {
+    fprintf(stderr, "Feel not found; try list-feels\n");
+    return -1;
+  }
+
+  fprintf(stdout, "%s\n", description);
+
+  free(description), description = NULL;
+  return 0;
+}
+
+static int run_import(storage_interface const * adapter, int argc, char **argv, import_format format) {
+  char const * path = NULL;
+  int batch_size = HIF_IMPORT_DEFAULT_BATCH_SIZE;
+
+  for(int i = 2; i < argc; i++) {
+    if(strcmp(argv[i], "--format") == 0 && i + 1 < argc && format != IMPORT_FORMAT_JSON) {
+      format = import_format_from_name(argv[++i]);
+    } else if(strcmp(argv[i], "--batch-size") == 0 && i + 1 < argc) {
+      batch_size = atoi(argv[++i]);
+    } else if(!path) {
+      path = argv[i];
+    } else {
+      print_help(stderr);
+      return -1;
+    }
+  }
+
+  FILE * in = stdin;
+  if(path && strcmp(path, "-") != 0) {
+    in = fopen(path, "r");
+    if(!in) {
+      fprintf(stderr, "Unable to open '%s' for import.\n", path);
+      return -1;
+    }
+    if(format == IMPORT_FORMAT_AUTO) {
+      char const * extension = strrchr(path, '.');
+      if(extension) format = import_format_from_name(extension + 1);
+    }
+  }
+
+  import_stats stats;
+  importer_interface const * importer = importer_alloc(adapter, batch_size);
+  int rc = importer->import(importer, in, format, &stats);
+  importer->free(importer);
+
+  if(in != stdin) fclose(in);
+
+  if(!rc) {
+    fprintf(stderr, "Import failed; nothing after the last committed batch was saved.\n");
+  } else if(format == IMPORT_FORMAT_JSON) {
+    fprintf(stdout, "Restored %li feels and created %li emotions, skipped %li records.\n", stats.feels, stats.statuses, stats.skipped);
+    if(stats.existing) fprintf(stdout, "Left out %li feels whose ids were already taken.\n", stats.existing);
+  } else {
+    fprintf(stdout, "Imported %li feels and %li memos, skipped %li records.\n", stats.feels, stats.memos, stats.skipped);
+  }
+  return rc ? 0 : -1;
+}
+
+static int command_import(storage_interface const * adapter, int argc, char **argv) {
+  return run_import(adapter, argc, argv, IMPORT_FORMAT_AUTO);
+}
+
+static int command_import_json(storage_interface const * adapter, int argc, char **argv) {
+  return run_import(adapter, argc, argv, IMPORT_FORMAT_JSON);
+}
+
+static int command_durability(storage_interface const * adapter, int argc, char **argv) {
+  if(argc < 3) {
+    fprintf(stdout, "%s\n", storage_durability_name(adapter->get_durability(adapter)));
+    return 0;
+  }
+
+  storage_durability durability = storage_durability_from_name(argv[2]);
+  if(durability == STORAGE_DURABILITY_EOF) {
+    fprintf(stderr, "Unknown durability '%s'; try strict, fast or batched.\n", argv[2]);
+    return -1;
+  }
+
+  if(!adapter->set_durability(adapter, durability, 1)) {
+    fprintf(stderr, "Failed to set durability to '%s'.\n", argv[2]);
+    return -1;
+  }
+
+  fprintf(stdout, "Durability set to '%s'\n", storage_durability_name(durability));
+  return 0;
+}
+
+static int print_shard(void * context, int month, int64_t feels, int sealed) {
+  (void)context;
+
+  char name[HIF_SHARD_NAME_SIZE];
+  shard_month_name(month, name);
+  fprintf(stdout, "%s\t%lld feels%s\n", name, (long long)feels, sealed ? "\tsealed" : "");
+
+  return 1;
+}
+
+static int command_shards(storage_interface const * adapter, int argc, char **argv) {
+  if(argc < 3) {
+    fprintf(stdout, "Partitioning: %s\n", storage_partitioning_name(adapter->get_partitioning(adapter)));
+    return adapter->query_shards(adapter, &print_shard, NULL) ? 0 : -1;
+  }
+
+  storage_partitioning partitioning = storage_partitioning_from_name(argv[2]);
+  if(partitioning != STORAGE_PARTITIONING_EOF) {
+    if(!adapter->set_partitioning(adapter, partitioning)) {
+      fprintf(stderr, "Failed to set partitioning to '%s'.\n", argv[2]);
+      return -1;
+    }
+    fprintf(stdout, "Partitioning set to '%s'\n", storage_partitioning_name(partitioning));
+    return 0;
+  }
+
+  storage_shard_task task = STORAGE_SHARD_EOF;
+  if(strcmp(argv[2], "seal") == 0) task = STORAGE_SHARD_SEAL;
+  if(strcmp(argv[2], "compact") == 0) task = STORAGE_SHARD_COMPACT;
+  int month = argc == 4 ? shard_month_from_name(argv[3]) : 0;
+  if(task == STORAGE_SHARD_EOF || !month) {
+    print_help(stderr);
+    return -1;
+  }
+
+  if(!adapter->maintain_shard(adapter, month, task)) {
+    fprintf(stderr, "Failed to %s the %s shard.\n", argv[2], argv[3]);
+    return -1;
+  }
+  fprintf(stdout, "Shard %s %s.\n", argv[3], task == STORAGE_SHARD_SEAL ? "sealed" : "compacted");
+  return 0;
+}
+
+/* Each step is a transaction of its own, so writers get in between */
+static int command_compact(storage_interface const * adapter, int argc, char **argv) {
+  if(argc > 3 || (argc == 3 && strcmp(argv[2], "--full") != 0)) {
+    print_help(stderr);
+    return -1;
+  }
+
+  if(argc == 3) {
+    if(!adapter->vacuum(adapter)) {
+      fprintf(stderr, "Failed to vacuum the context.\n");
+      return -1;
+    }
+    fprintf(stdout, "Context vacuumed.\n");
+    return 0;
+  }
+
+  long total = 0;
+  int freed = 0;
+  while((freed = adapter->reclaim_space(adapter, HIF_COMPACT_PAGES)) > 0) total += freed;
+
+  fprintf(freed < 0 ? stderr : stdout, "Reclaimed %li free pages.\n", total);
+  return freed < 0 ? -1 : 0;
+}
+
+static int command_snapshot(storage_interface const * adapter, int argc, char **argv) {
+  (void)argv;
+  if(argc > 2) {
+    print_help(stderr);
+    return -1;
+  }
+
+  snapshot * snap = adapter->open_snapshot(adapter);
+  if(!snap) {
+    fprintf(stderr, "Failed to update the snapshot.\n");
+    return -1;
+  }
+
+  fprintf(stdout, "Snapshot holds %lli feels, %lli of them new.\n", (long long)snapshot_rows(snap), (long long)snapshot_appended(snap));
+  snapshot_close(snap);
+
+  return 0;
+}
+
+typedef struct stats_days {
+  int64_t today;
+
+  int64_t first;
+  int64_t last;
+  long active;
+
+  int64_t streak_first;
+  long streak;
+  int64_t longest_first;
+  long longest;
+
+  int64_t day; /* the day being printed by print_recent_day */
+} stats_days;
+
+static void format_day(int64_t day, char * buffer, size_t len) {
+  time_t t = (time_t)(day * HIF_SECONDS_PER_DAY);
+  struct tm tm;
+  gmtime_r(&t, &tm);
+  strftime(buffer, len, "%Y-%m-%d", &tm);
+}
+
+static int print_status_total(void * context, int64_t bucket, char const * feel, int64_t feels) {
+  (void)bucket;
+  int64_t total = *(int64_t *)context;
+
+  fprintf(stdout, "\t%-12s %10lli %6.1f%%\n", feel, (long long)feels, total > 0 ? 100.0 * feels / total : 0.0);
+  return 1;
+}
+
+static int add_hour(void * context, int64_t bucket, char const * feel, int64_t feels) {
+  (void)feel;
+  int64_t * hours = context;
+
+  if(bucket >= 0 && bucket < 24) hours[bucket] += feels;
+  return 1;
+}
+
+static int add_active_day(void * context, int64_t day, char const * feel, int64_t feels) {
+  (void)feel; (void)feels;
+  stats_days * days = context;
+
+  if(!days->active++) days->first = day;
+  if(days->streak && day == days->last + 1) {
+    days->streak++;
+  } else {
+    days->streak = 1;
+    days->streak_first = day;
+  }
+  if(days->streak > days->longest) {
+    days->longest = days->streak;
+    days->longest_first = days->streak_first;
+  }
+  days->last = day;
+
+  return 1;
+}
+
+static int print_recent_day(void * context, int64_t day, char const * feel, int64_t feels) {
+  stats_days * days = context;
+
+  if(day != days->day) {
+    char date[16];
+    format_day(day, date, sizeof date);
+    fprintf(stdout, "%s\t%s  %s %lli", days->day == INT64_MIN ? "" : "\n", date, feel, (long long)feels);
+    days->day = day;
+  } else {
+    fprintf(stdout, ", %s %lli", feel, (long long)feels);
+  }
+
+  return 1;
+}
+
+typedef struct rollup_row {
+  int64_t bucket;
+  char const * feel; /* NULL for active days */
+  int64_t feels;
+} rollup_row;
+
+typedef struct rollup_table {
+  rollup_row * rows;
+  size_t len;
+  size_t capacity;
+} rollup_table;
+
+/* One context's share of stats */
+typedef struct stats_partial {
+  int64_t total;
+  rollup_table rollups[STORAGE_ROLLUP_EOF];
+} stats_partial;
+
+static int collect_rollup_row(void * context, int64_t bucket, char const * feel, int64_t feels) {
+  rollup_table * table = context;
+
+  if(table->len == table->capacity) {
+    table->capacity = table->capacity ? table->capacity * 2 : 64;
+    table->rows = realloc(table->rows, table->capacity * sizeof * table->rows);
+    if(!table->rows) abort();
+  }
+
+  rollup_row * row = &table->rows[table->len++];
+  row->bucket = bucket;
+  row->feel = feel ? strdup(feel) : NULL;
+  row->feels = feels;
+
+  return 1;
+}
+
+typedef struct stats_query {
+  int64_t first_recent_day;
+  int snapshot; /* scan the context's snapshot rather than read its rollups */
+} stats_query;
+
+static int collect_stats(storage_interface const * adapter, void * partial, void * arg) {
+  stats_partial * stats = partial;
+  stats_query const * query = arg;
+
+  snapshot * snap = NULL;
+  if(query->snapshot && !(snap = adapter->open_snapshot(adapter))) return 0;
+
+  int64_t total = snap ? snapshot_rows(snap) : adapter->count_feels(adapter, NULL, NULL);
+  int ok = total >= 0;
+  stats->total = total;
+
+  for(storage_rollup rollup = STORAGE_ROLLUP_STATUS; ok && rollup < STORAGE_ROLLUP_EOF; rollup++) {
+    int64_t first_day = rollup == STORAGE_ROLLUP_DAY ? query->first_recent_day : INT64_MIN;
+    ok = snap
+      ? snapshot_query_rollup(snap, rollup, first_day, &collect_rollup_row, &stats->rollups[rollup])
+      : adapter->query_rollup(adapter, rollup, first_day, &collect_rollup_row, &stats->rollups[rollup]);
+  }
+
+  snapshot_close(snap);
+
+  return ok;
+}
+
+static void free_stats_partial(stats_partial * stats) {
+  for(storage_rollup rollup = STORAGE_ROLLUP_STATUS; rollup < STORAGE_ROLLUP_EOF; rollup++) {
+    rollup_table * table = &stats->rollups[rollup];
+    for(size_t i = 0; i < table->len; i++) free((char *)table->rows[i].feel);
+    free(table->rows), table->rows = NULL;
+    table->len = table->capacity = 0;
+  }
+}
+
+static int compare_rollup_rows(void const * a, void const * b) {
+  rollup_row const * left = a, * right = b;
+
+  if(left->bucket != right->bucket) return left->bucket < right->bucket ? -1 : 1;
+  if(!left->feel || !right->feel) return !right->feel - !left->feel;
+  return strcmp(left->feel, right->feel);
+}
+
+/* Rows from several contexts are summed by bucket and feel, in that order.
+ * A single context's rows are taken as they are, in the database's order.
+ * The merged table borrows the partials' feel names. */
+static void merge_rollups(rollup_table * merged, stats_partial const * partials, size_t count, storage_rollup rollup) {
+  memset(merged, 0, sizeof * merged);
+
+  for(size_t i = 0; i < count; i++) merged->capacity += partials[i].rollups[rollup].len;
+  merged->rows = calloc(merged->capacity ? merged->capacity : 1, sizeof * merged->rows);
+  if(!merged->rows) abort();
+
+  for(size_t i = 0; i < count; i++) {
+    rollup_table const * table = &partials[i].rollups[rollup];
+    memcpy(merged->rows + merged->len, table->rows, table->len * sizeof * table->rows);
+    merged->len += table->len;
+  }
+  if(count < 2) return;
+
+  qsort(merged->rows, merged->len, sizeof * merged->rows, &compare_rollup_rows);
+
+  size_t len = 0;
+  for(size_t i = 0; i < merged->len; i++) {
+    if(len && compare_rollup_rows(&merged->rows[len - 1], &merged->rows[i]) == 0) {
+      merged->rows[len - 1].feels += merged->rows[i].feels;
+    } else {
+      merged->rows[len++] = merged->rows[i];
+    }
+  }
+  merged->len = len;
+}
+
+static int replay_rollup(rollup_table const * table, rollup_handler handler, void * context) {
+  for(size_t i = 0; i < table->len; i++) {
+    if(!handler(context, table->rows[i].bucket, table->rows[i].feel, table->rows[i].feels)) return 0;
+  }
+
+  return 1;
+}
+
+/* Everything here is read from the rollup and counter tables, never from
+ * hif_feels, or with --snapshot from a scan of each context's snapshot.
+ * --all-contexts gathers every context's rollups on its own thread and sums
+ * them. */
+static int command_stats(storage_interface const * adapter, int argc, char **argv) {
+  int recent_days = HIF_STATS_DEFAULT_DAYS;
+  int all_contexts = 0;
+  stats_query query = { 0, 0 };
+
+  for(int i = 2; i < argc; i++) {
+    if(strcmp(argv[i], "--days") == 0 && i + 1 < argc) {
+      recent_days = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "--all-contexts") == 0) {
+      all_contexts = 1;
+    } else if(strcmp(argv[i], "--snapshot") == 0) {
+      query.snapshot = 1;
+    } else {
+      print_help(stderr);
+      return -1;
+    }
+  }
+
+  stats_days days;
+  memset(&days, 0, sizeof days);
+  days.today = (int64_t)time(NULL) / HIF_SECONDS_PER_DAY;
+  query.first_recent_day = recent_days > 0 ? days.today - recent_days + 1 : INT64_MAX;
+
+  size_t count = 1;
+  char ** names = all_contexts ? alloc_context_names(&count) : NULL;
+  stats_partial * partials = calloc(count ? count : 1, sizeof * partials);
+  if(!partials) abort();
+
+  int ok = all_contexts
+    ? run_in_contexts(names, count, &collect_stats, &query, partials, sizeof * partials)
+    : collect_stats(adapter, partials, &query);
+  if(!ok) goto err0;
+
+  int64_t total = 0;
+  for(size_t i = 0; i < count; i++) total += partials[i].total;
+
+  rollup_table merged[STORAGE_ROLLUP_EOF];
+  for(storage_rollup rollup = STORAGE_ROLLUP_STATUS; rollup < STORAGE_ROLLUP_EOF; rollup++) {
+    merge_rollups(&merged[rollup], partials, count, rollup);
+  }
+
+  int64_t hours[24] = { 0 };
+  replay_rollup(&merged[STORAGE_ROLLUP_ACTIVE_DAY], &add_active_day, &days);
+  replay_rollup(&merged[STORAGE_ROLLUP_HOUR], &add_hour, hours);
+
+  char first[16] = "", last[16] = "";
+  if(days.active) {
+    format_day(days.first, first, sizeof first);
+    format_day(days.last, last, sizeof last);
+    fprintf(stdout, "%lli feels from %s to %s, on %li days\n", (long long)total, first, last, days.active);
+  } else {
+    fprintf(stdout, "%lli feels\n", (long long)total);
+  }
+  if(all_contexts) fprintf(stdout, "across %zu contexts\n", count);
+
+  fprintf(stdout, "\nBy emotion\n");
+  replay_rollup(&merged[STORAGE_ROLLUP_STATUS], &print_status_total, &total);
+
+  int64_t busiest = 1;
+  for(int hour = 0; hour < 24; hour++) {
+    if(hours[hour] > busiest) busiest = hours[hour];
+  }
+
+  fprintf(stdout, "\nBy hour of day (UTC)\n");
+  for(int hour = 0; hour < 24; hour++) {
+    int width = (int)(hours[hour] * HIF_STATS_BAR_WIDTH / busiest);
+    fprintf(stdout, "\t%02i %10lli %.*s\n", hour, (long long)hours[hour], width, "########################################");
+  }
+
+  if(recent_days > 0) {
+    fprintf(stdout, "\nBy day, last %i days\n", recent_days);
+    days.day = INT64_MIN;
+    replay_rollup(&merged[STORAGE_ROLLUP_DAY], &print_recent_day, &days);
+    if(days.day != INT64_MIN) fprintf(stdout, "\n");
+  }
+
+  /* A streak is still current until a whole day passes without a feel */
+  long current = days.active && days.last >= days.today - 1 ? days.streak : 0;
+
+  fprintf(stdout, "\nStreaks\n");
+  fprintf(stdout, "\tCurrent %li days\n", current);
+  if(days.longest) {
+    format_day(days.longest_first, first, sizeof first);
+    format_day(days.longest_first + days.longest - 1, last, sizeof last);
+    fprintf(stdout, "\tLongest %li days, %s to %s\n", days.longest, first, last);
+  }
+
+  for(storage_rollup rollup = STORAGE_ROLLUP_STATUS; rollup < STORAGE_ROLLUP_EOF; rollup++) {
+    free(merged[rollup].rows), merged[rollup].rows = NULL;
+  }
+
+err0:
+  for(size_t i = 0; i < count; i++) free_stats_partial(&partials[i]);
+  free(partials), partials = NULL;
+  free_context_names(names, count);
+
+  return ok ? 0 : -1;
+}
+
+/* A file is written beside itself and renamed into place, as node_exporter's
+ * textfile collector expects */
+static int command_metrics(storage_interface const * adapter, int argc, char **argv) {
+  (void)adapter;
+  if(argc > 3) {
+    print_help(stderr);
+    return -1;
+  }
+  if(argc < 3 || strcmp(argv[2], "-") == 0) return metrics_write_prometheus(stdout) ? 0 : -1;
+
+  char * temp_path = NULL;
+  asprintf(&temp_path, "%s.tmp", argv[2]);
+  if(!temp_path) abort();
+
+  int ok = 0;
+  FILE * out = fopen(temp_path, "w");
+  if(out) {
+    ok = metrics_write_prometheus(out);
+    ok = fclose(out) == 0 && ok;
+    ok = ok && rename(temp_path, argv[2]) == 0;
+    if(!ok) remove(temp_path);
+  }
+  if(!ok) fprintf(stderr, "Failed to write metrics to %s.\n", argv[2]);
+
+  free(temp_path), temp_path = NULL;
+  return ok ? 0 : -1;
+}
+
+/* Splits line in place into words, as a shell would: single quotes keep
+ * everything, double quotes and bare words honour backslash escapes. Words
+ * start at (*words)[1], leaving room for the program name, and end with a
+ * NULL. Returns the number of words, or -1 for an unterminated quote. */
+static int split_command_line(char * line, char *** words, size_t * capacity) {
+  int count = 0;
+  char * in = line, * out = line;
+
+  for(;;) {
+    while(isspace((unsigned char)*in)) in++;
+    if(!*in) break;
+
+    if((size_t)count + 3 > *capacity) {
+      *capacity *= 2;
+      *words = realloc(*words, *capacity * sizeof ** words);
+      if(!*words) abort();
+    }
+    (*words)[1 + count++] = out;
+
+    char quote = '\0';
+    for(; *in && (quote || !isspace((unsigned char)*in)); in++) {
+      if(quote == '\'' && *in != '\'') {
+        *out++ = *in;
+      } else if(*in == '\\' && in[1]) {
+        *out++ = *++in;
+      } else if(*in == '\'' || *in == '"') {
+        if(!quote) quote = *in;
+        else if(quote == *in) quote = '\0';
+        else *out++ = *in;
+      } else {
+        *out++ = *in;
+      }
+    }
+    if(quote) return -1;
+
+    if(*in) in++;
+    *out++ = '\0';
+  }
+
+  (*words)[1 + count] = NULL;
+  return count;
+}
+
+/* The option or subcommand that keeps a line from running inside the
+ * batch's transaction, "" for the command itself, or NULL when it can run.
+ * Anything that commits on its own, changes the journal mode, detaches or
+ * rewrites a shard, or writes on a connection of its own cannot; nor can a
+ * snapshot, which must only hold committed feels, or anything that reads on
+ * connections of its own and would miss the batch's writes. */
+static char const * batch_conflict(hif_command command, int argc, char **argv) {
+  static char const * const OWN_CONNECTION_OPTIONS[] = { "--snapshot", "--jobs", "--all-contexts" };
+
+  if(command == HIF_COMMAND_BATCH || command == HIF_COMMAND_IMPORT || command == HIF_COMMAND_IMPORT_JSON
+      || command == HIF_COMMAND_COMPACT || command == HIF_COMMAND_SNAPSHOT || command == HIF_COMMAND_DURABILITY
+      || command == HIF_COMMAND_CREATE) {
+    return "";
+  }
+  if(command == HIF_COMMAND_SHARDS && argc > 2 && (strcmp(argv[2], "seal") == 0 || strcmp(argv[2], "compact") == 0)) {
+    return argv[2];
+  }
+
+  for(int i = 2; i < argc; i++) {
+    for(size_t j = 0; j < sizeof(OWN_CONNECTION_OPTIONS) / sizeof(*OWN_CONNECTION_OPTIONS); j++) {
+      if(strcmp(argv[i], OWN_CONNECTION_OPTIONS[j]) == 0) return OWN_CONNECTION_OPTIONS[j];
+    }
+  }
+
+  return NULL;
+}
+
+/* Lines run as if each were given to hif on its own, against the one open
+ * context. A failing line is reported and the rest carry on; only a failed
+ * commit loses the lines before it. */
+static int command_batch(storage_interface const * adapter, int argc, char **argv) {
+  char const * path = NULL;
+  long group_size = 0;
+
+  for(int i = 2; i < argc; i++) {
+    if(strcmp(argv[i], "--group-size") == 0 && i + 1 < argc) {
+      group_size = atol(argv[++i]);
+    } else if(!path) {
+      path = argv[i];
+    } else {
+      print_help(stderr);
+      return -1;
+    }
+  }
+
+  FILE * in = stdin;
+  if(path && strcmp(path, "-") != 0) {
+    in = fopen(path, "r");
+    if(!in) {
+      fprintf(stderr, "Unable to open '%s' for batch.\n", path);
+      return -1;
+    }
+  }
+
+  size_t capacity = 16;
+  char ** words = malloc(capacity * sizeof * words);
+  if(!words) abort();
+
+  char * line = NULL;
+  size_t line_capacity = 0;
+  long line_number = 0, first_in_group = 1, in_group = 0, commands = 0, failed = 0;
+
+  int in_transaction = adapter->begin_transaction(adapter);
+  if(!in_transaction) goto err0;
+
+  while(getline(&line, &line_capacity, in) >= 0) {
+    line_number++;
+
+    int count = split_command_line(line, &words, &capacity);
+    if(count == 0 || (count > 0 && words[1][0] == '#')) continue;
+    words[0] = argv[0];
+
+    commands++;
+    in_group++;
+    if(count < 0) {
+      fprintf(stderr, "line %li: unterminated quote.\n", line_number);
+      failed++;
+    } else {
+      hif_command command = str_to_command(str_lower(words[1]));
+      char const * conflict = command == HIF_COMMAND_EOF ? NULL : batch_conflict(command, count + 1, words);
+      if(command == HIF_COMMAND_EOF) {
+        fprintf(stderr, "line %li: unknown command '%s'.\n", line_number, words[1]);
+        failed++;
+      } else if(conflict) {
+        fprintf(stderr, "line %li: %s%s%s cannot run inside a batch.\n", line_number, command_name(command), *conflict ? " " : "", conflict);
+        failed++;
+      } else if(run_command(adapter, command, count + 1, words) != 0) {
+        fprintf(stderr, "line %li: %s failed.\n", line_number, command_name(command));
+        failed++;
+      }
+    }
+
+    if(group_size > 0 && in_group >= group_size) {
+      if(!adapter->commit_transaction(adapter)) {
+        fprintf(stderr, "lines %li-%li: failed to commit; they were not saved.\n", first_in_group, line_number);
+        adapter->rollback_transaction(adapter);
+        failed += in_group;
+      }
+      first_in_group = line_number + 1;
+      in_group = 0;
+
+      in_transaction = adapter->begin_transaction(adapter);
+      if(!in_transaction) break;
+    }
+  }
+
+  if(in_transaction && !adapter->commit_transaction(adapter)) {
+    fprintf(stderr, "lines %li-%li: failed to commit; they were not saved.\n", first_in_group, line_number);
+    adapter->rollback_transaction(adapter);
+    failed += in_group;
+  }
+
+  if(failed) fprintf(stderr, "%li of %li commands failed.\n", failed, commands);
+
+err0:
+  free(line), line = NULL;
+  free(words), words = NULL;
+  if(in != stdin) fclose(in);
+
+  return in_transaction && !failed ? 0 : -1;
+}
+
+static int command_help(storage_interface const * adapter, int argc, char **argv) {
+  (void)adapter; (void)argc; (void)argv;
+  print_help(stdout);
+  return 0;
+}
+
+static int command_version(storage_interface const * adapter, int argc, char **argv) {
+  (void)adapter; (void)argc; (void)argv;
+  print_version(stdout);
+  return 0;
+}
+
+static command_fn fns[] = {
+  &command_create, /* HIF_COMMAND_CREATE */
+  &command_count_feels, /* HIF_COMMAND_COUNT_FEELS */
+  &command_export, /* HIF_COMMAND_JSON */
+  &command_delete_feel, /* HIF_COMMAND_DELETE_FEEL */
+  &command_delete_feels, /* HIF_COMMAND_DELETE_FEELS */
+  &command_create_feel, /* HIF_COMMAND_CREATE_FEEL */
+  &command_add_feel, /* HIF_COMMAND_ADD_FEEL */
+  &command_count_memos, /* HIF_COMMAND_COUNT_MEMOS */
+  &command_add_memo, /* HIF_COMMAND_ADD_MEMO */
+  &command_get_feel_description, /* HIF_COMMAND_GET_FEEL_DESCRIPTION */
+  &command_delete_memo, /* HIF_COMMAND_DELETE_MEMO */
+  &command_search, /* HIF_COMMAND_SEARCH */
+  &command_search_index, /* HIF_COMMAND_SEARCH_INDEX */
+  &command_import, /* HIF_COMMAND_IMPORT */
+  &command_import_json, /* HIF_COMMAND_IMPORT_JSON */
+  &command_stats, /* HIF_COMMAND_STATS */
+  &command_durability, /* HIF_COMMAND_DURABILITY */
+  &command_shards, /* HIF_COMMAND_SHARDS */
+  &command_compact, /* HIF_COMMAND_COMPACT */
+  &command_metrics, /* HIF_COMMAND_METRICS */
+  &command_batch, /* HIF_COMMAND_BATCH */
+  &command_snapshot, /* HIF_COMMAND_SNAPSHOT */
+  &command_help, /* HIF_COMMAND_HELP */
+  &command_version /* HIF_COMMAND_VERSION */
+};
+
+_Static_assert(sizeof(fns) / sizeof(*fns) == HIF_COMMAND_EOF, "fns must match hif_command");
+
+static char const * const COMMAND_NAMES[] = {
+  "create-context", /* HIF_COMMAND_CREATE */
+  "count-feels", /* HIF_COMMAND_COUNT_FEELS */
+  "export-json", /* HIF_COMMAND_JSON */
+  "delete-feel", /* HIF_COMMAND_DELETE_FEEL */
+  "delete-feels", /* HIF_COMMAND_DELETE_FEELS */
+  "create-emotion", /* HIF_COMMAND_CREATE_FEEL */
+  "add", /* HIF_COMMAND_ADD_FEEL */
+  "count-memos", /* HIF_COMMAND_COUNT_MEMOS */
+  "memo", /* HIF_COMMAND_ADD_MEMO */
+  "describe-feel", /* HIF_COMMAND_GET_FEEL_DESCRIPTION */
+  "delete-memo", /* HIF_COMMAND_DELETE_MEMO */
+  "search", /* HIF_COMMAND_SEARCH */
+  "search-index", /* HIF_COMMAND_SEARCH_INDEX */
+  "import", /* HIF_COMMAND_IMPORT */
+  "import-json", /* HIF_COMMAND_IMPORT_JSON */
+  "stats", /* HIF_COMMAND_STATS */
+  "durability", /* HIF_COMMAND_DURABILITY */
+  "shards", /* HIF_COMMAND_SHARDS */
+  "compact", /* HIF_COMMAND_COMPACT */
+  "metrics", /* HIF_COMMAND_METRICS */
+  "batch", /* HIF_COMMAND_BATCH */
+  "snapshot", /* HIF_COMMAND_SNAPSHOT */
+  "help", /* HIF_COMMAND_HELP */
+  "version" /* HIF_COMMAND_VERSION */
+};
+
+_Static_assert(sizeof(COMMAND_NAMES) / sizeof(*COMMAND_NAMES) == HIF_COMMAND_EOF, "COMMAND_NAMES must match hif_command");
+
+char const * command_name(hif_command command) {
+  if(command < HIF_COMMAND_CREATE || command >= HIF_COMMAND_EOF) return NULL;
+
+  return COMMAND_NAMES[command];
+}
+
+int command_requires_storage(hif_command command) {
+  return command != HIF_COMMAND_HELP && command != HIF_COMMAND_VERSION && command != HIF_COMMAND_METRICS;
+}
+
+int run_command(storage_interface const * adapter, hif_command command, int argc, char **argv) {
+  if(command < HIF_COMMAND_CREATE || command >= HIF_COMMAND_EOF) return -1;
+
+  return fns[command](adapter, argc, argv);
+}
+
@@ -0,0 +1,331 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "trace.h"
+#include "compressed_output.h"
+
+/* Fast levels; the point is to write less than the disk can take, not the
+ * least possible */
+#define HIF_GZIP_LEVEL 1
+#define HIF_GZIP_WINDOW_BITS (15 + 16) /* 16 asks zlib for a gzip header */
+#define HIF_ZSTD_LEVEL 3
+#define HIF_COMPRESSED_BUFFER_SIZE (1 << 18)
+
+static char const * const COMPRESSION_NAMES[] = {
+  "none", /* EXPORT_COMPRESSION_NONE */
+  "gzip", /* EXPORT_COMPRESSION_GZIP */
+  "zstd" /* EXPORT_COMPRESSION_ZSTD */
+};
+
+_Static_assert(sizeof(COMPRESSION_NAMES) / sizeof(*COMPRESSION_NAMES) == EXPORT_COMPRESSION_EOF, "COMPRESSION_NAMES must match export_compression");
+
+typedef struct compressed_block {
+  char * data;
+  size_t len;
+  size_t capacity;
+} compressed_block;
+
+struct compressed_output {
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  pthread_t thread;
+
+  export_compression compression;
+  int fd;
+  size_t block_size;
+
+  /* Full blocks in order, and emptied ones for the buffer to take back;
+   * new blocks are allocated while there are no spares yet */
+  compressed_block queued[HIF_COMPRESS_QUEUE_BLOCKS];
+  size_t first_queued;
+  size_t queued_count;
+  compressed_block spares[HIF_COMPRESS_QUEUE_BLOCKS + 1];
+  size_t spare_count;
+
+  int finishing;
+  int failed;
+
+#ifdef HAVE_ZLIB
+  z_stream gzip;
+#endif
+#ifdef HAVE_ZSTD
+  ZSTD_CCtx * zstd;
+#endif
+  char * compressed;
+  size_t compressed_capacity;
+
+  /* For the trace */
+  int64_t started;
+  int64_t compress_us;
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+  long waits;
+};
+
+export_compression export_compression_from_name(char const * name) {
+  if(!name) return EXPORT_COMPRESSION_EOF;
+
+  for(export_compression compression = EXPORT_COMPRESSION_NONE; compression < EXPORT_COMPRESSION_EOF; compression++) {
+    if(strcasecmp(name, COMPRESSION_NAMES[compression]) == 0) return compression;
+  }
+  if(strcasecmp(name, "gz") == 0) return EXPORT_COMPRESSION_GZIP;
+  if(strcasecmp(name, "zst") == 0) return EXPORT_COMPRESSION_ZSTD;
+
+  return EXPORT_COMPRESSION_EOF;
+}
+
+char const * export_compression_name(export_compression compression) {
+  return compression < EXPORT_COMPRESSION_EOF ? COMPRESSION_NAMES[compression] : NULL;
+}
+
+int export_compression_available(export_compression compression) {
+  switch(compression) {
+    case EXPORT_COMPRESSION_NONE:
+      return 1;
+#ifdef HAVE_ZLIB
+    case EXPORT_COMPRESSION_GZIP:
+      return 1;
+#endif
+#ifdef HAVE_ZSTD
+    case EXPORT_COMPRESSION_ZSTD:
+      return 1;
+#endif
+    default:
+      return 0;
+  }
+}
+
+static int write_all(int fd, char const * p, size_t remaining) {
+  while(remaining > 0) {
+    ssize_t written = write(fd, p, remaining);
+    if(written < 0) {
+      if(errno == EINTR) continue;
+      return 0;
+    }
+    p += written;
+    remaining -= (size_t)written;
+  }
+
+  return 1;
+}
+
+static int write_compressed(compressed_output * output, size_t len) {
+  output->bytes_out += len;
+  return write_all(output->fd, output->compressed, len);
+}
+
+/* Runs on the compressor thread only; finish ends the stream */
+static int compress_block(compressed_output * output, char const * data, size_t len, int finish) {
+  output->bytes_in += len;
+
+  switch(output->compression) {
+#ifdef HAVE_ZLIB
+    case EXPORT_COMPRESSION_GZIP: {
+      z_stream * stream = &output->gzip;
+      stream->next_in = (Bytef *)data;
+      stream->avail_in = (uInt)len;
+
+      do {
+        stream->next_out = (Bytef *)output->compressed;
+        stream->avail_out = (uInt)output->compressed_capacity;
+        if(deflate(stream, finish ? Z_FINISH : Z_NO_FLUSH) == Z_STREAM_ERROR) return 0;
+        if(!write_compressed(output, output->compressed_capacity - stream->avail_out)) return 0;
+      } while(stream->avail_out == 0);
+
+      return 1;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    case EXPORT_COMPRESSION_ZSTD: {
+      ZSTD_inBuffer in = { data, len, 0 };
+      size_t remaining;
+
+      do {
+        ZSTD_outBuffer out = { output->compressed, output->compressed_capacity, 0 };
+        remaining = ZSTD_compressStream2(output->zstd, &out, &in, finish ? ZSTD_e_end : ZSTD_e_continue);
+        if(ZSTD_isError(remaining)) return 0;
+        if(!write_compressed(output, out.pos)) return 0;
+      } while(finish ? remaining != 0 : in.pos < in.size);
+
+      return 1;
+    }
+#endif
+    default:
+      (void)data; (void)finish;
+      return 0;
+  }
+}
+
+static void * compress_worker(void * arg) {
+  compressed_output * output = arg;
+
+  for(;;) {
+    pthread_mutex_lock(&output->lock);
+    while(!output->queued_count && !output->finishing) pthread_cond_wait(&output->changed, &output->lock);
+    if(!output->queued_count) {
+      pthread_mutex_unlock(&output->lock);
+      break;
+    }
+    compressed_block block = output->queued[output->first_queued];
+    output->first_queued = (output->first_queued + 1) % HIF_COMPRESS_QUEUE_BLOCKS;
+    output->queued_count--;
+    int failed = output->failed;
+    pthread_mutex_unlock(&output->lock);
+
+    int64_t started = trace_now();
+    int ok = !failed && compress_block(output, block.data, block.len, 0);
+    output->compress_us += trace_now() - started;
+
+    pthread_mutex_lock(&output->lock);
+    output->spares[output->spare_count++] = block;
+    if(!ok) output->failed = 1;
+    pthread_cond_broadcast(&output->changed);
+    pthread_mutex_unlock(&output->lock);
+  }
+
+  if(!output->failed && !compress_block(output, NULL, 0, 1)) output->failed = 1;
+
+  return NULL;
+}
+
+/* Waits for room in the queue rather than letting blocks pile up; there is
+ * always a spare, or room to allocate one, once there is room. */
+static char * hand_off(void * consumer, char * data, size_t len, size_t * capacity) {
+  compressed_output * output = consumer;
+
+  pthread_mutex_lock(&output->lock);
+  if(output->queued_count == HIF_COMPRESS_QUEUE_BLOCKS && !output->failed) output->waits++;
+  while(output->queued_count == HIF_COMPRESS_QUEUE_BLOCKS && !output->failed) pthread_cond_wait(&output->changed, &output->lock);
+  if(output->failed) {
+    pthread_mutex_unlock(&output->lock);
+    return NULL;
+  }
+
+  compressed_block block = { data, len, *capacity };
+  output->queued[(output->first_queued + output->queued_count++) % HIF_COMPRESS_QUEUE_BLOCKS] = block;
+  pthread_cond_broadcast(&output->changed);
+
+  compressed_block spare = { NULL, 0, output->block_size };
+  if(output->spare_count) spare = output->spares[--output->spare_count];
+  pthread_mutex_unlock(&output->lock);
+
+  if(!spare.data) {
+    spare.data = malloc(spare.capacity);
+    if(!spare.data) abort();
+  }
+  *capacity = spare.capacity;
+
+  return spare.data;
+}
+
+static int init_compressor(compressed_output * output) {
+  switch(output->compression) {
+#ifdef HAVE_ZLIB
+    case EXPORT_COMPRESSION_GZIP:
+      output->compressed_capacity = HIF_COMPRESSED_BUFFER_SIZE;
+      return deflateInit2(&output->gzip, HIF_GZIP_LEVEL, Z_DEFLATED, HIF_GZIP_WINDOW_BITS, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+#endif
+#ifdef HAVE_ZSTD
+    case EXPORT_COMPRESSION_ZSTD:
+      output->compressed_capacity = ZSTD_CStreamOutSize();
+      output->zstd = ZSTD_createCCtx();
+      return output->zstd && !ZSTD_isError(ZSTD_CCtx_setParameter(output->zstd, ZSTD_c_compressionLevel, HIF_ZSTD_LEVEL));
+#endif
+    default:
+      return 0;
+  }
+}
+
+static void free_compressor(compressed_output * output) {
+  switch(output->compression) {
+#ifdef HAVE_ZLIB
+    case EXPORT_COMPRESSION_GZIP:
+      deflateEnd(&output->gzip);
+      break;
+#endif
+#ifdef HAVE_ZSTD
+    case EXPORT_COMPRESSION_ZSTD:
+      ZSTD_freeCCtx(output->zstd), output->zstd = NULL;
+      break;
+#endif
+    default:
+      break;
+  }
+}
+
+compressed_output * compressed_output_start(int fd, export_compression compression, size_t block_size) {
+  if(compression == EXPORT_COMPRESSION_NONE || !export_compression_available(compression)) return NULL;
+
+  compressed_output * output = calloc(1, sizeof * output);
+  if(!output) abort();
+
+  output->compression = compression;
+  output->fd = fd;
+  output->block_size = block_size ? block_size : HIF_OUTPUT_BUFFER_SIZE;
+  output->started = trace_now();
+
+  if(!init_compressor(output)) goto err0;
+
+  output->compressed = malloc(output->compressed_capacity);
+  if(!output->compressed) abort();
+
+  pthread_mutex_init(&output->lock, NULL);
+  pthread_cond_init(&output->changed, NULL);
+  if(pthread_create(&output->thread, NULL, &compress_worker, output) != 0) goto err1;
+
+  return output;
+
+err1:
+  pthread_cond_destroy(&output->changed);
+  pthread_mutex_destroy(&output->lock);
+  free(output->compressed), output->compressed = NULL;
+err0:
+  free_compressor(output);
+  free(output), output = NULL;
+
+  return NULL;
+}
+
+void compressed_output_attach(compressed_output * output, output_buffer * buffer) {
+  buffer->handoff = &hand_off;
+  buffer->consumer = output;
+}
+
+int compressed_output_finish(compressed_output * output) {
+  pthread_mutex_lock(&output->lock);
+  output->finishing = 1;
+  pthread_cond_broadcast(&output->changed);
+  pthread_mutex_unlock(&output->lock);
+
+  pthread_join(output->thread, NULL);
+  int ok = !output->failed;
+
+  if(trace_enabled) {
+    trace_compression(COMPRESSION_NAMES[output->compression], output->started, output->compress_us,
+      output->bytes_in, output->bytes_out, output->waits);
+  }
+
+  for(size_t i = 0; i < output->spare_count; i++) free(output->spares[i].data), output->spares[i].data = NULL;
+  free(output->compressed), output->compressed = NULL;
+  free_compressor(output);
+
+  pthread_cond_destroy(&output->changed);
+  pthread_mutex_destroy(&output->lock);
+  free(output), output = NULL;
+
+  return ok;
+}
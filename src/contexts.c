@@ -0,0 +1,154 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sqlite3.h>
+
+#include "environment.h"
+#include "contexts.h"
+
+#define HIF_SQLITE_HEADER "SQLite format 3"
+
+typedef struct context_job {
+  char const * name;
+  context_task task;
+  void * arg;
+  void * partial;
+
+  pthread_t thread;
+  int started;
+  int ok;
+} context_job;
+
+static int has_suffix(char const * s, char const * suffix) {
+  size_t len = strlen(s), suffix_len = strlen(suffix);
+  return len >= suffix_len && strcmp(s + len - suffix_len, suffix) == 0;
+}
+
+char * alloc_context_file_name(char const * name) {
+  if(context_exists(name) || has_suffix(name, ".db")) return strdup(name);
+
+  char * file_name = NULL;
+  if(asprintf(&file_name, "%s.db", name) < 0) abort();
+  return file_name;
+}
+
+/* The header check is cheap and keeps sqlite from opening arbitrary files;
+ * the schema check leaves out other applications' databases. */
+static int is_context(char const * path) {
+  char header[sizeof(HIF_SQLITE_HEADER)] = { 0 };
+
+  FILE * file = fopen(path, "rb");
+  if(!file) return 0;
+  size_t read = fread(header, 1, sizeof header, file);
+  fclose(file);
+  if(read != sizeof header || memcmp(header, HIF_SQLITE_HEADER, sizeof header) != 0) return 0;
+
+  sqlite3 * db = NULL;
+  sqlite3_stmt * stmt = NULL;
+  int found = 0;
+  if(sqlite3_open_v2(path, &db, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK
+    && sqlite3_prepare_v2(db, "select 1 from sqlite_master where type = 'table' and name = 'hif_feels';", -1, &stmt, NULL) == SQLITE_OK) {
+    found = sqlite3_step(stmt) == SQLITE_ROW;
+  }
+  sqlite3_finalize(stmt);
+  sqlite3_close(db);
+
+  return found;
+}
+
+static int compare_names(void const * a, void const * b) {
+  return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+char ** alloc_context_names(size_t * count) {
+  *count = 0;
+
+  char const * config_path = get_config_path();
+  DIR * dir = opendir(config_path);
+  if(!dir) return NULL;
+
+  size_t capacity = 8;
+  char ** names = calloc(capacity, sizeof * names);
+  if(!names) abort();
+
+  struct dirent * entry = NULL;
+  while((entry = readdir(dir))) {
+    char const * name = entry->d_name;
+    if(*name == '.' || has_suffix(name, "-wal") || has_suffix(name, "-shm") || has_suffix(name, "-journal")) continue;
+
+    char * path = alloc_concat_path(config_path, name);
+    int found = is_context(path);
+    free(path), path = NULL;
+    if(!found) continue;
+
+    if(*count == capacity) {
+      capacity *= 2;
+      names = realloc(names, capacity * sizeof * names);
+      if(!names) abort();
+    }
+    names[(*count)++] = strdup(name);
+  }
+  closedir(dir);
+
+  qsort(names, *count, sizeof * names, &compare_names);
+
+  return names;
+}
+
+void free_context_names(char ** names, size_t count) {
+  if(!names) return;
+
+  for(size_t i = 0; i < count; i++) free(names[i]), names[i] = NULL;
+  free(names);
+}
+
+static void * context_worker(void * arg) {
+  context_job * job = arg;
+
+  storage_interface const * adapter = storage_adapter_alloc();
+  int rc = adapter->open_storage_read_only(adapter, job->name);
+  if(rc == SQLITE_OK) {
+    job->ok = job->task(adapter, job->partial, job->arg);
+    if(!adapter->close(adapter)) job->ok = 0;
+  } else if(rc == SQLITE_SCHEMA) {
+    fprintf(stderr, "Context %s was made by an older hif; open it with --context to upgrade it. Left out.\n", job->name);
+    job->ok = 1;
+  } else {
+    fprintf(stderr, "Unable to open context %s.\n", job->name);
+  }
+  adapter->free(adapter);
+
+  return NULL;
+}
+
+/* Each context is read on its own read-only connection and thread, so the
+ * whole takes about as long as the slowest context rather than all of them
+ * together, and touches none of them. Contexts still to be migrated are
+ * left out. */
+int run_in_contexts(char * const * names, size_t count, context_task task, void * arg, void * partials, size_t partial_size) {
+  if(!count) return 1;
+
+  context_job * jobs = calloc(count, sizeof * jobs);
+  if(!jobs) abort();
+
+  for(size_t i = 0; i < count; i++) {
+    jobs[i].name = names[i];
+    jobs[i].task = task;
+    jobs[i].arg = arg;
+    jobs[i].partial = (char *)partials + i * partial_size;
+    jobs[i].started = pthread_create(&jobs[i].thread, NULL, &context_worker, &jobs[i]) == 0;
+    if(!jobs[i].started) context_worker(&jobs[i]);
+  }
+
+  int ok = 1;
+  for(size_t i = 0; i < count; i++) {
+    if(jobs[i].started) pthread_join(jobs[i].thread, NULL);
+    ok = ok && jobs[i].ok;
+  }
+
+  free(jobs), jobs = NULL;
+
+  return ok;
+}
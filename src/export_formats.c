@@ -0,0 +1,323 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sqlite3.h>
+
+#include "json_escape.h"
+#include "export_formats.h"
+
+#define HIF_EXPORT_TEXT_COLUMNS \
+  "select f.feel_id 'id', s.status 'feel', s.description 'description', " \
+  "datetime(f.dtm / 1000000, 'unixepoch') 'datetime' " \
+  "from hif_feels f inner join hif_statuses s on f.feel = s.status_id "
+
+#define HIF_EXPORT_COLUMNAR_COLUMNS \
+  "select f.feel_id, f.dtm, f.feel " \
+  "from hif_feels f inner join hif_statuses s on f.feel = s.status_id "
+
+static char const * const FORMAT_NAMES[] = {
+  "json", /* EXPORT_FORMAT_JSON */
+  "ndjson", /* EXPORT_FORMAT_NDJSON */
+  "csv", /* EXPORT_FORMAT_CSV */
+  "columnar" /* EXPORT_FORMAT_COLUMNAR */
+};
+
+_Static_assert(sizeof(FORMAT_NAMES) / sizeof(*FORMAT_NAMES) == EXPORT_FORMAT_EOF, "FORMAT_NAMES must match export_format");
+
+export_format export_format_from_name(char const * name) {
+  if(!name) return EXPORT_FORMAT_EOF;
+
+  for(export_format format = EXPORT_FORMAT_JSON; format < EXPORT_FORMAT_EOF; format++) {
+    if(strcasecmp(name, FORMAT_NAMES[format]) == 0) return format;
+  }
+  if(strcasecmp(name, "jsonl") == 0) return EXPORT_FORMAT_NDJSON;
+
+  return EXPORT_FORMAT_EOF;
+}
+
+/* json and ndjson */
+
+static void write_json_value(output_buffer * out, sqlite3_stmt * stmt, int col) {
+  int type = sqlite3_column_type(stmt, col);
+  if(type == SQLITE_NULL) {
+    output_buffer_write(out, "null", sizeof("null") - 1);
+    return;
+  }
+
+  unsigned char const * value = sqlite3_column_text(stmt, col);
+  size_t len = (size_t)sqlite3_column_bytes(stmt, col);
+
+  if(type == SQLITE_INTEGER || type == SQLITE_FLOAT) {
+    output_buffer_write(out, value, len);
+    return;
+  }
+
+  char * d = output_buffer_reserve(out, len * HIF_JSON_ESCAPE_MAX_GROWTH + 2);
+  *d++ = '"';
+  d += json_escape(d, value, len);
+  *d++ = '"';
+  out->len = (size_t)(d - out->data);
+}
+
+static void write_json_object(output_buffer * out, sqlite3_stmt * stmt, export_columns const * columns) {
+  output_buffer_write(out, "{ ", 2);
+
+  for(int col = 0; col < columns->count; col++) {
+    if(col) output_buffer_write(out, ", ", 2);
+
+    output_buffer_write(out, "\"", 1);
+    output_buffer_puts(out, columns->keys[col]);
+    output_buffer_write(out, "\": ", 3);
+    write_json_value(out, stmt, col);
+  }
+
+  output_buffer_write(out, " }", 2);
+}
+
+static int write_json_header(sqlite3 * db, output_buffer * out, export_columns const * columns) {
+  (void)db; (void)columns;
+  output_buffer_puts(out, "{\n\t\"feels\": [");
+  return 1;
+}
+
+static void write_json_row(export_writer * writer, sqlite3_stmt * stmt) {
+  output_buffer_write(writer->out, ",\n\t\t", 4);
+  write_json_object(writer->out, stmt, writer->columns);
+}
+
+static void write_json_footer(output_buffer * out, long rows) {
+  output_buffer_puts(out, rows ? "\n\t]\n}\n" : "]\n}\n");
+}
+
+static int write_no_header(sqlite3 * db, output_buffer * out, export_columns const * columns) {
+  (void)db; (void)out; (void)columns;
+  return 1;
+}
+
+static void write_ndjson_row(export_writer * writer, sqlite3_stmt * stmt) {
+  write_json_object(writer->out, stmt, writer->columns);
+  output_buffer_write(writer->out, "\n", 1);
+}
+
+static void finish_no_rows(export_writer * writer) {
+  (void)writer;
+}
+
+static void write_no_footer(output_buffer * out, long rows) {
+  (void)out; (void)rows;
+}
+
+/* csv, RFC 4180 quoting */
+
+static void write_csv_field(output_buffer * out, unsigned char const * value, size_t len) {
+  if(!value) return;
+
+  if(!memchr(value, '"', len) && !memchr(value, ',', len) && !memchr(value, '\n', len) && !memchr(value, '\r', len)) {
+    output_buffer_write(out, value, len);
+    return;
+  }
+
+  char * d = output_buffer_reserve(out, len * 2 + 2);
+  *d++ = '"';
+  for(size_t i = 0; i < len; i++) {
+    if(value[i] == '"') *d++ = '"';
+    *d++ = (char)value[i];
+  }
+  *d++ = '"';
+  out->len = (size_t)(d - out->data);
+}
+
+static int write_csv_header(sqlite3 * db, output_buffer * out, export_columns const * columns) {
+  (void)db;
+
+  for(int col = 0; col < columns->count; col++) {
+    if(col) output_buffer_write(out, ",", 1);
+    write_csv_field(out, (unsigned char const *)columns->names[col], strlen(columns->names[col]));
+  }
+  output_buffer_write(out, "\r\n", 2);
+
+  return 1;
+}
+
+static void write_csv_row(export_writer * writer, sqlite3_stmt * stmt) {
+  for(int col = 0; col < writer->columns->count; col++) {
+    if(col) output_buffer_write(writer->out, ",", 1);
+    write_csv_field(writer->out, sqlite3_column_text(stmt, col), (size_t)sqlite3_column_bytes(stmt, col));
+  }
+  output_buffer_write(writer->out, "\r\n", 2);
+}
+
+/* columnar */
+
+typedef struct columnar_group {
+  int64_t ids[HIF_COLUMNAR_GROUP_ROWS];
+  int64_t dtms[HIF_COLUMNAR_GROUP_ROWS];
+  uint16_t statuses[HIF_COLUMNAR_GROUP_ROWS];
+  uint32_t len;
+} columnar_group;
+
+static void put_u16(char * d, uint16_t v) {
+  d[0] = (char)(v & 0xff);
+  d[1] = (char)(v >> 8);
+}
+
+static void put_u32(char * d, uint32_t v) {
+  for(int i = 0; i < 4; i++) d[i] = (char)((v >> (8 * i)) & 0xff);
+}
+
+static void put_u64(char * d, uint64_t v) {
+  for(int i = 0; i < 8; i++) d[i] = (char)((v >> (8 * i)) & 0xff);
+}
+
+static void write_u32(output_buffer * out, uint32_t v) {
+  char * d = output_buffer_reserve(out, 4);
+  put_u32(d, v);
+  out->len += 4;
+}
+
+static void write_padding(output_buffer * out, size_t written) {
+  static char const ZEROES[8] = { 0 };
+  if(written % 8) output_buffer_write(out, ZEROES, 8 - written % 8);
+}
+
+static void write_columnar_string(output_buffer * out, unsigned char const * value, size_t * written) {
+  if(!value) {
+    write_u32(out, HIF_COLUMNAR_NULL_LEN);
+    *written += 4;
+    return;
+  }
+
+  size_t len = strlen((char const *)value);
+  write_u32(out, (uint32_t)len);
+  output_buffer_write(out, value, len);
+  *written += 4 + len;
+}
+
+/* The dictionary is every status, used or not, so readers can resolve ids
+ * without a second pass. */
+static int write_columnar_header(sqlite3 * db, output_buffer * out, export_columns const * columns) {
+  (void)columns;
+
+  sqlite3_stmt * stmt = NULL;
+  int rc = sqlite3_prepare_v2(db, "select status_id, status, description from hif_statuses order by status_id;", -1, &stmt, NULL);
+  if(rc != SQLITE_OK) return 0;
+
+  uint32_t count = 0;
+  while(sqlite3_step(stmt) == SQLITE_ROW) count++;
+  sqlite3_reset(stmt);
+
+  output_buffer_write(out, HIF_COLUMNAR_MAGIC, 8);
+  write_u32(out, HIF_COLUMNAR_VERSION);
+  write_u32(out, count);
+  size_t written = 16;
+
+  int ok = 1;
+  while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    sqlite3_int64 status_id = sqlite3_column_int64(stmt, 0);
+    if(status_id < 0 || status_id > UINT16_MAX) ok = 0;
+
+    write_u32(out, (uint32_t)status_id);
+    written += 4;
+    write_columnar_string(out, sqlite3_column_text(stmt, 1), &written);
+    write_columnar_string(out, sqlite3_column_text(stmt, 2), &written);
+  }
+  write_padding(out, written);
+
+  sqlite3_finalize(stmt);
+
+  return ok && rc == SQLITE_DONE;
+}
+
+static void finish_columnar_rows(export_writer * writer) {
+  columnar_group * group = writer->state;
+  if(!group->len) return;
+
+  size_t n = group->len;
+  size_t len = 8 + n * 8 * 2 + n * 2;
+  char * d = output_buffer_reserve(writer->out, len + 8);
+  char * start = d;
+
+  put_u32(d, (uint32_t)n), put_u32(d + 4, 0);
+  d += 8;
+  for(size_t i = 0; i < n; i++, d += 8) put_u64(d, (uint64_t)group->ids[i]);
+  for(size_t i = 0; i < n; i++, d += 8) put_u64(d, (uint64_t)group->dtms[i]);
+  for(size_t i = 0; i < n; i++, d += 2) put_u16(d, group->statuses[i]);
+  while((size_t)(d - start) % 8) *d++ = 0;
+
+  writer->out->len += (size_t)(d - start);
+  group->len = 0;
+}
+
+static void write_columnar_row(export_writer * writer, sqlite3_stmt * stmt) {
+  columnar_group * group = writer->state;
+
+  group->ids[group->len] = sqlite3_column_int64(stmt, 0);
+  group->dtms[group->len] = sqlite3_column_int64(stmt, 1);
+  group->statuses[group->len] = (uint16_t)sqlite3_column_int(stmt, 2);
+
+  if(++group->len == HIF_COLUMNAR_GROUP_ROWS) finish_columnar_rows(writer);
+}
+
+static void write_columnar_footer(output_buffer * out, long rows) {
+  char * d = output_buffer_reserve(out, 16);
+  put_u32(d, 0), put_u32(d + 4, 0);
+  put_u64(d + 8, (uint64_t)rows);
+  out->len += 16;
+}
+
+static void * alloc_columnar_state() {
+  columnar_group * group = malloc(sizeof * group);
+  if(!group) abort();
+  group->len = 0;
+  return group;
+}
+
+static void * alloc_no_state() {
+  return NULL;
+}
+
+static void free_state(void * state) {
+  free(state);
+}
+
+static export_format_interface const FORMATS[] = {
+  { /* EXPORT_FORMAT_JSON */
+    HIF_EXPORT_TEXT_COLUMNS, 1,
+    &write_json_header, &write_json_row, &finish_no_rows, &write_json_footer,
+    &alloc_no_state, &free_state
+  },
+  { /* EXPORT_FORMAT_NDJSON */
+    HIF_EXPORT_TEXT_COLUMNS, 0,
+    &write_no_header, &write_ndjson_row, &finish_no_rows, &write_no_footer,
+    &alloc_no_state, &free_state
+  },
+  { /* EXPORT_FORMAT_CSV */
+    HIF_EXPORT_TEXT_COLUMNS, 0,
+    &write_csv_header, &write_csv_row, &finish_no_rows, &write_no_footer,
+    &alloc_no_state, &free_state
+  },
+  { /* EXPORT_FORMAT_COLUMNAR */
+    HIF_EXPORT_COLUMNAR_COLUMNS, 0,
+    &write_columnar_header, &write_columnar_row, &finish_columnar_rows, &write_columnar_footer,
+    &alloc_columnar_state, &free_state
+  }
+};
+
+_Static_assert(sizeof(FORMATS) / sizeof(*FORMATS) == EXPORT_FORMAT_EOF, "FORMATS must match export_format");
+
+export_format_interface const * get_export_format(export_format format) {
+  if(format < EXPORT_FORMAT_JSON || format >= EXPORT_FORMAT_EOF) return NULL;
+
+  return &FORMATS[format];
+}
+
+void export_writer_init(export_writer * writer, export_format_interface const * format, output_buffer * out, export_columns const * columns) {
+  writer->out = out;
+  writer->columns = columns;
+  writer->state = format->alloc_state();
+}
+
+void export_writer_free(export_writer * writer, export_format_interface const * format) {
+  format->free_state(writer->state), writer->state = NULL;
+}
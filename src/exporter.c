@@ -0,0 +1,597 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sqlite3.h>
+
+#include "environment.h"
+#include "storage_adapter.h"
+#include "output_buffer.h"
+#include "json_escape.h"
+#include "export_formats.h"
+#include "compressed_output.h"
+#include "exporter.h"
+#include "trace.h"
+#include "metrics.h"
+
+/* Parallel exports hand out feel_id ranges of this width; at most
+ * HIF_EXPORT_WINDOW_PER_JOB ranges per job are formatted ahead of the writer. */
+#define HIF_EXPORT_CHUNK_IDS 16384
+#define HIF_EXPORT_WINDOW_PER_JOB 4
+#define HIF_EXPORT_CHUNK_BUFFER_SIZE (1 << 18)
+
+#define HIF_EXPORT_IN_TIME_RANGE "f.dtm >= ?3 and f.dtm < ?4 "
+
+/* Appended to a format's select. Unbounded exports walk the table in rowid
+ * order; bounded ones find their rows through the dtm index and sort only
+ * those. */
+static char const * const EXPORT_SQL = "order by f.feel_id;";
+static char const * const EXPORT_TIME_RANGE_SQL = "where " HIF_EXPORT_IN_TIME_RANGE "order by f.feel_id;";
+
+static char const * const EXPORT_ID_RANGE_SQL = "where f.feel_id between ?1 and ?2 order by f.feel_id;";
+static char const * const EXPORT_ID_AND_TIME_RANGE_SQL =
+  "where f.feel_id between ?1 and ?2 and " HIF_EXPORT_IN_TIME_RANGE "order by f.feel_id;";
+
+/* Changes between two cursors are rows with ids past the first, plus rows
+ * whose id was deleted since and then handed out again, or restored by
+ * import-json. Ids are bound as ?1 and ?2 and the tombstone window as ?3
+ * and ?4; deletes of rows added since the first cursor cancel out. */
+#define HIF_EXPORT_REUSED_ID(column, kinds) \
+  column " <= ?1 and " column " in (select row_id from hif_tombstones " \
+    "where kind in (" kinds ") and tombstone_id > ?3 and tombstone_id <= ?4)"
+
+static char const * const EXPORT_REUSED_FEELS_SQL =
+  "where " HIF_EXPORT_REUSED_ID("f.feel_id", "'feels', 'restored feels'") " order by f.feel_id;";
+
+static char const * const EXPORT_MEMOS_SQL =
+  "select memo_id 'id', memo 'memo', datetime(dtm / 1000000, 'unixepoch') 'datetime' from hif_memos " \
+  "where memo_id > ?1 and memo_id <= ?2 or " HIF_EXPORT_REUSED_ID("memo_id", "'memos'") " order by memo_id;";
+
+static char const * const EXPORT_DELETED_SQL =
+  "select kind 'table', row_id 'id' from hif_tombstones where tombstone_id > ?3 and tombstone_id <= ?4 " \
+  "and kind in ('feels', 'memos') and row_id <= case kind when 'feels' then ?1 else ?2 end order by tombstone_id;";
+
+typedef struct export_chunk {
+  sqlite3_int64 first_id;
+  sqlite3_int64 last_id;
+
+  output_buffer buffer;
+  long rows;
+
+  int done;
+  int failed;
+} export_chunk;
+
+typedef struct export_job {
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+
+  char const * path;
+  export_format_interface const * format;
+  export_columns const * columns;
+  time_range const * range;
+
+  export_chunk * chunks;
+  size_t chunk_count;
+  size_t next_chunk;
+  size_t written;
+  size_t window;
+
+  int cancelled;
+} export_job;
+
+static void write_kvp_row(output_buffer * out, sqlite3_stmt * stmt, export_columns const * columns, kvp_handler kvp) {
+  output_buffer_write(out, "\t\t{ ", 4);
+
+  for(int col = 0; col < columns->count; col++) {
+    if(col) output_buffer_write(out, ", ", 2);
+
+    char * escaped_value = alloc_json_escape_string(sqlite3_column_text(stmt, col));
+    int type = sqlite3_column_type(stmt, col);
+
+    output_buffer_flush(out);
+    kvp(columns->keys[col], escaped_value, (type == SQLITE_INTEGER || type == SQLITE_FLOAT));
+    fflush(stdout);
+
+    free(escaped_value), escaped_value = NULL;
+  }
+
+  output_buffer_write(out, " }", 2);
+}
+
+/* The first row goes through a scratch buffer so its leading separator can
+ * be dropped before it reaches out. */
+static void write_first_row(export_format_interface const * format, export_writer * writer, sqlite3_stmt * stmt) {
+  output_buffer * out = writer->out;
+
+  output_buffer first;
+  output_buffer_init(&first, -1, HIF_EXPORT_CHUNK_BUFFER_SIZE);
+
+  writer->out = &first;
+  format->write_row(writer, stmt);
+  writer->out = out;
+
+  if(first.len > format->first_row_skip) output_buffer_write(out, first.data + format->first_row_skip, first.len - format->first_row_skip);
+  output_buffer_free(&first);
+}
+
+static int export_serial(sqlite3_stmt * stmt, export_format_interface const * format, export_columns const * columns, kvp_handler kvp, output_buffer * out, long * rows) {
+  export_writer writer;
+  export_writer_init(&writer, format, out, columns);
+
+  int rc;
+  while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    if(kvp) {
+      output_buffer_puts(out, *rows ? ",\n" : "\n");
+      write_kvp_row(out, stmt, columns, kvp);
+    } else if(!*rows) {
+      write_first_row(format, &writer, stmt);
+    } else {
+      format->write_row(&writer, stmt);
+    }
+
+    ++*rows;
+  }
+  format->finish_rows(&writer);
+
+  export_writer_free(&writer, format);
+
+  return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+/* Every row of a chunk carries its leading separator; the writer drops it in
+ * front of the very first row of the export. */
+static int format_chunk(sqlite3_stmt * stmt, export_chunk * chunk, export_format_interface const * format, export_columns const * columns) {
+  export_writer writer;
+  export_writer_init(&writer, format, &chunk->buffer, columns);
+
+  sqlite3_bind_int64(stmt, 1, chunk->first_id);
+  sqlite3_bind_int64(stmt, 2, chunk->last_id);
+
+  int rc;
+  while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    format->write_row(&writer, stmt);
+    chunk->rows++;
+  }
+  format->finish_rows(&writer);
+
+  export_writer_free(&writer, format);
+  sqlite3_reset(stmt);
+
+  return rc == SQLITE_DONE;
+}
+
+static char * alloc_export_sql(export_format_interface const * format, char const * filter) {
+  char * sql = NULL;
+  if(asprintf(&sql, "%s%s", format->select_sql, filter) < 0) abort();
+  return sql;
+}
+
+static int bind_time_range(sqlite3_stmt * stmt, time_range const * range) {
+  if(!range) return SQLITE_OK;
+
+  int rc = sqlite3_bind_int64(stmt, 3, range->since);
+  if(rc == SQLITE_OK) rc = sqlite3_bind_int64(stmt, 4, range->until);
+
+  return rc;
+}
+
+static void * export_worker(void * arg) {
+  export_job * job = arg;
+
+  sqlite3 * db = NULL;
+  sqlite3_stmt * stmt = NULL;
+
+  char * sql = alloc_export_sql(job->format, job->range ? EXPORT_ID_AND_TIME_RANGE_SQL : EXPORT_ID_RANGE_SQL);
+
+  int rc = sqlite3_open_v2(job->path, &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL);
+  if(rc == SQLITE_OK) rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+  if(rc == SQLITE_OK) rc = bind_time_range(stmt, job->range);
+
+  free(sql), sql = NULL;
+
+  for(;;) {
+    pthread_mutex_lock(&job->lock);
+    while(!job->cancelled && job->next_chunk < job->chunk_count && job->next_chunk >= job->written + job->window) {
+      pthread_cond_wait(&job->changed, &job->lock);
+    }
+    if(job->cancelled || job->next_chunk >= job->chunk_count) {
+      pthread_mutex_unlock(&job->lock);
+      break;
+    }
+    export_chunk * chunk = &job->chunks[job->next_chunk++];
+    pthread_mutex_unlock(&job->lock);
+
+    output_buffer_init(&chunk->buffer, -1, HIF_EXPORT_CHUNK_BUFFER_SIZE);
+    int failed = rc != SQLITE_OK || !format_chunk(stmt, chunk, job->format, job->columns);
+
+    pthread_mutex_lock(&job->lock);
+    chunk->done = 1;
+    chunk->failed = failed;
+    pthread_cond_broadcast(&job->changed);
+    pthread_mutex_unlock(&job->lock);
+  }
+
+  sqlite3_finalize(stmt);
+  sqlite3_close(db);
+
+  return NULL;
+}
+
+static int get_feel_id_bounds(sqlite3 * db, time_range const * range, sqlite3_int64 * first_id, sqlite3_int64 * last_id) {
+  sqlite3_stmt * stmt = NULL;
+  int rc = sqlite3_prepare_v2(db, range
+    ? "select min(feel_id), max(feel_id) from hif_feels f where " HIF_EXPORT_IN_TIME_RANGE ";"
+    : "select min(feel_id), max(feel_id) from hif_feels;", -1, &stmt, NULL);
+  if(rc == SQLITE_OK) rc = bind_time_range(stmt, range);
+  if(rc != SQLITE_OK) {
+    sqlite3_finalize(stmt);
+    return 0;
+  }
+
+  int found = 0;
+  if(sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL) {
+    *first_id = sqlite3_column_int64(stmt, 0);
+    *last_id = sqlite3_column_int64(stmt, 1);
+    found = 1;
+  }
+  sqlite3_finalize(stmt);
+
+  return found;
+}
+
+/* Ranges are scanned on their own connections and threads, but written
+ * strictly in feel_id order so the output matches a serial export. */
+static int export_parallel(sqlite3 * db, char const * path, int jobs, time_range const * range, export_format_interface const * format, export_columns const * columns, output_buffer * out, long * rows) {
+  sqlite3_int64 first_id = 0, last_id = 0;
+  if(!get_feel_id_bounds(db, range, &first_id, &last_id)) return SQLITE_OK;
+
+  export_job job;
+  memset(&job, 0, sizeof job);
+  pthread_mutex_init(&job.lock, NULL);
+  pthread_cond_init(&job.changed, NULL);
+
+  job.path = path;
+  job.format = format;
+  job.columns = columns;
+  job.range = range;
+  job.chunk_count = (size_t)((last_id - first_id) / HIF_EXPORT_CHUNK_IDS) + 1;
+  job.window = (size_t)jobs * HIF_EXPORT_WINDOW_PER_JOB;
+  job.chunks = calloc(job.chunk_count, sizeof * job.chunks);
+  if(!job.chunks) abort();
+
+  for(size_t i = 0; i < job.chunk_count; i++) {
+    job.chunks[i].first_id = first_id + (sqlite3_int64)i * HIF_EXPORT_CHUNK_IDS;
+    job.chunks[i].last_id = job.chunks[i].first_id + HIF_EXPORT_CHUNK_IDS - 1;
+  }
+
+  if((size_t)jobs > job.chunk_count) jobs = (int)job.chunk_count;
+
+  pthread_t * threads = calloc((size_t)jobs, sizeof * threads);
+  if(!threads) abort();
+
+  int started = 0;
+  for(; started < jobs; started++) {
+    if(pthread_create(&threads[started], NULL, &export_worker, &job) != 0) break;
+  }
+
+  int rc = started > 0 ? SQLITE_OK : SQLITE_ERROR;
+  for(size_t i = 0; rc == SQLITE_OK && i < job.chunk_count; i++) {
+    export_chunk * chunk = &job.chunks[i];
+
+    pthread_mutex_lock(&job.lock);
+    while(!chunk->done) pthread_cond_wait(&job.changed, &job.lock);
+    pthread_mutex_unlock(&job.lock);
+
+    if(chunk->failed) {
+      rc = SQLITE_ERROR;
+    } else if(chunk->rows) {
+      size_t skip = *rows ? 0 : format->first_row_skip;
+      if(skip > chunk->buffer.len) skip = chunk->buffer.len;
+      output_buffer_write(out, chunk->buffer.data + skip, chunk->buffer.len - skip);
+      *rows += chunk->rows;
+    }
+    output_buffer_free(&chunk->buffer);
+
+    pthread_mutex_lock(&job.lock);
+    job.written++;
+    if(rc != SQLITE_OK) job.cancelled = 1;
+    pthread_cond_broadcast(&job.changed);
+    pthread_mutex_unlock(&job.lock);
+  }
+
+  for(int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+
+  for(size_t i = 0; i < job.chunk_count; i++) output_buffer_free(&job.chunks[i].buffer);
+  free(job.chunks), job.chunks = NULL;
+  free(threads), threads = NULL;
+
+  pthread_cond_destroy(&job.changed);
+  pthread_mutex_destroy(&job.lock);
+
+  return rc;
+}
+
+typedef struct context_export {
+  char * path;
+  export_format_interface const * format;
+  export_columns const * columns;
+  time_range const * range;
+  sqlite3_int64 first_id;
+  sqlite3_int64 last_id;
+
+  FILE * spool;
+  long rows;
+
+  pthread_t thread;
+  int started;
+  int ok;
+} context_export;
+
+/* A whole context is one chunk, spooled to a temporary file so memory use
+ * does not grow with the size of the context */
+static void * export_context_worker(void * arg) {
+  context_export * job = arg;
+
+  sqlite3 * db = NULL;
+  sqlite3_stmt * stmt = NULL;
+
+  char * sql = alloc_export_sql(job->format, job->range ? EXPORT_ID_AND_TIME_RANGE_SQL : EXPORT_ID_RANGE_SQL);
+
+  int rc = job->spool ? SQLITE_OK : SQLITE_CANTOPEN;
+  if(rc == SQLITE_OK) rc = sqlite3_open_v2(job->path, &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL);
+  if(rc == SQLITE_OK) rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+  if(rc == SQLITE_OK) rc = bind_time_range(stmt, job->range);
+
+  free(sql), sql = NULL;
+
+  if(rc == SQLITE_OK) {
+    export_chunk chunk;
+    memset(&chunk, 0, sizeof chunk);
+    chunk.first_id = job->first_id;
+    chunk.last_id = job->last_id;
+
+    output_buffer_init(&chunk.buffer, fileno(job->spool), HIF_EXPORT_CHUNK_BUFFER_SIZE);
+    job->ok = format_chunk(stmt, &chunk, job->format, job->columns);
+    job->ok = output_buffer_flush(&chunk.buffer) && job->ok;
+    output_buffer_free(&chunk.buffer);
+    job->rows = chunk.rows;
+  }
+
+  sqlite3_finalize(stmt);
+  sqlite3_close(db);
+
+  return NULL;
+}
+
+/* Contexts are formatted at once, one thread each, and copied out in the
+ * order given; feel ids are only unique within a context. */
+static int export_contexts(char * const * contexts, size_t count, time_range const * range, sqlite3_int64 first_id, sqlite3_int64 last_id, export_format_interface const * format, export_columns const * columns, output_buffer * out, long * rows) {
+  context_export * jobs = calloc(count, sizeof * jobs);
+  if(!jobs) abort();
+
+  char const * config_path = get_config_path();
+  for(size_t i = 0; i < count; i++) {
+    jobs[i].path = alloc_concat_path(config_path, contexts[i]);
+    jobs[i].format = format;
+    jobs[i].columns = columns;
+    jobs[i].range = range;
+    jobs[i].first_id = first_id;
+    jobs[i].last_id = last_id;
+    jobs[i].spool = tmpfile();
+    jobs[i].started = pthread_create(&jobs[i].thread, NULL, &export_context_worker, &jobs[i]) == 0;
+    if(!jobs[i].started) export_context_worker(&jobs[i]);
+  }
+
+  int rc = SQLITE_OK;
+  for(size_t i = 0; i < count; i++) {
+    context_export * job = &jobs[i];
+    if(job->started) pthread_join(job->thread, NULL);
+
+    if(!job->ok) {
+      if(rc == SQLITE_OK) fprintf(stderr, "Unable to export context %s.\n", contexts[i]);
+      rc = SQLITE_ERROR;
+    } else if(rc == SQLITE_OK && job->rows) {
+      fseek(job->spool, *rows ? 0 : (long)format->first_row_skip, SEEK_SET);
+
+      size_t read;
+      do {
+        char * d = output_buffer_reserve(out, HIF_EXPORT_CHUNK_BUFFER_SIZE);
+        read = fread(d, 1, HIF_EXPORT_CHUNK_BUFFER_SIZE, job->spool);
+        out->len += read;
+      } while(read == HIF_EXPORT_CHUNK_BUFFER_SIZE);
+      if(ferror(job->spool)) rc = SQLITE_IOERR;
+
+      *rows += job->rows;
+    }
+
+    if(job->spool) fclose(job->spool), job->spool = NULL;
+    free(job->path), job->path = NULL;
+  }
+
+  free(jobs), jobs = NULL;
+
+  return rc;
+}
+
+static void init_export_columns(export_columns * columns, sqlite3_stmt * stmt) {
+  columns->count = sqlite3_column_count(stmt);
+  columns->names = calloc((size_t)columns->count, sizeof * columns->names);
+  columns->keys = calloc((size_t)columns->count, sizeof * columns->keys);
+  if(!columns->names || !columns->keys) abort();
+
+  for(int col = 0; col < columns->count; col++) {
+    columns->names[col] = strdup(sqlite3_column_name(stmt, col));
+    columns->keys[col] = alloc_json_escape_string((unsigned char const *)columns->names[col]);
+    if(!columns->names[col]) abort();
+  }
+}
+
+static void free_export_columns(export_columns * columns) {
+  for(int col = 0; col < columns->count; col++) {
+    free(columns->names[col]), columns->names[col] = NULL;
+    free(columns->keys[col]), columns->keys[col] = NULL;
+  }
+  free(columns->names), columns->names = NULL;
+  free(columns->keys), columns->keys = NULL;
+}
+
+static int export_change_rows(sqlite3 * db, char const * sql, sqlite3_int64 const binds[4], export_format_interface const * format, output_buffer * out, long * rows) {
+  sqlite3_stmt * stmt = NULL;
+  int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+  for(int i = 0; rc == SQLITE_OK && i < 4; i++) rc = sqlite3_bind_int64(stmt, i + 1, binds[i]);
+  if(rc != SQLITE_OK) goto err0;
+
+  export_columns columns;
+  init_export_columns(&columns, stmt);
+  rc = export_serial(stmt, format, &columns, NULL, out, rows);
+  free_export_columns(&columns);
+
+err0:
+  sqlite3_finalize(stmt);
+
+  return rc;
+}
+
+static void write_next_key(output_buffer * out, long rows, char const * key) {
+  output_buffer_puts(out, rows ? "\n\t],\n\t\"" : "],\n\t\"");
+  output_buffer_puts(out, key);
+  output_buffer_puts(out, "\": ");
+}
+
+/* Follows the feels past the cursor with the reused and restored ids, then
+ * the memos, the deletes and the new cursor, all from db's one read
+ * transaction. Shards are read on connections of their own, after the
+ * cursor: their ids are bounded by it and never reused, so only a shard
+ * feel deleted meanwhile can be missing, and its delete comes next time. */
+static int export_changes(sqlite3 * db, export_cursor const * since, export_cursor const * until, export_format_interface const * format, output_buffer * out, long * rows) {
+  sqlite3_int64 const feel_binds[4] = { since->feel_id, until->feel_id, since->tombstone_id, until->tombstone_id };
+  sqlite3_int64 const memo_binds[4] = { since->memo_id, until->memo_id, since->tombstone_id, until->tombstone_id };
+  sqlite3_int64 const deleted_binds[4] = { since->feel_id, since->memo_id, since->tombstone_id, until->tombstone_id };
+
+  char * sql = alloc_export_sql(format, EXPORT_REUSED_FEELS_SQL);
+  int rc = export_change_rows(db, sql, feel_binds, format, out, rows);
+  free(sql), sql = NULL;
+
+  long memos = 0, deleted = 0;
+  if(rc == SQLITE_OK) {
+    write_next_key(out, *rows, "memos");
+    output_buffer_puts(out, "[");
+    rc = export_change_rows(db, EXPORT_MEMOS_SQL, memo_binds, format, out, &memos);
+  }
+  if(rc == SQLITE_OK) {
+    write_next_key(out, memos, "deleted");
+    output_buffer_puts(out, "[");
+    rc = export_change_rows(db, EXPORT_DELETED_SQL, deleted_binds, format, out, &deleted);
+  }
+  if(rc == SQLITE_OK) {
+    char cursor[HIF_EXPORT_CURSOR_SIZE];
+    export_cursor_text(until, cursor);
+
+    write_next_key(out, deleted, "cursor");
+    output_buffer_puts(out, "\"");
+    output_buffer_puts(out, cursor);
+    output_buffer_puts(out, "\"\n}\n");
+  }
+  *rows += memos + deleted;
+
+  return rc;
+}
+
+int export_cursor_from_text(char const * text, export_cursor * cursor) {
+  int end = 0;
+  if(!text || sscanf(text, "%" SCNd64 ".%" SCNd64 ".%" SCNd64 "%n", &cursor->feel_id, &cursor->memo_id, &cursor->tombstone_id, &end) != 3) return 0;
+
+  return text[end] == '\0' && cursor->feel_id >= 0 && cursor->memo_id >= 0 && cursor->tombstone_id >= 0;
+}
+
+void export_cursor_text(export_cursor const * cursor, char text[HIF_EXPORT_CURSOR_SIZE]) {
+  snprintf(text, HIF_EXPORT_CURSOR_SIZE, "%" PRId64 ".%" PRId64 ".%" PRId64, cursor->feel_id, cursor->memo_id, cursor->tombstone_id);
+}
+
+int export_feels(sqlite3 * db, char const * path, export_options const * options) {
+  static export_options const DEFAULT_OPTIONS = { NULL, 1, NULL, EXPORT_FORMAT_JSON, NULL, 0, NULL, NULL, EXPORT_COMPRESSION_NONE };
+  if(!options) options = &DEFAULT_OPTIONS;
+
+  /* The columnar dictionary comes from db; callers only combine contexts
+   * that share its status ids, such as a context and its shards */
+  export_format_interface const * format = get_export_format(options->format);
+  if(!format || (options->kvp && options->format != EXPORT_FORMAT_JSON)) return SQLITE_MISUSE;
+  if(options->contexts && options->kvp) return SQLITE_MISUSE;
+  if(options->compression != EXPORT_COMPRESSION_NONE && options->kvp) return SQLITE_MISUSE;
+
+  /* Changes since a cursor are a document of their own, with memos and deletes */
+  export_cursor const * since = options->since;
+  if(since && (!options->until || options->kvp || options->range || options->format != EXPORT_FORMAT_JSON)) return SQLITE_MISUSE;
+  sqlite3_int64 first_id = since ? since->feel_id + 1 : INT64_MIN;
+  sqlite3_int64 last_id = since ? options->until->feel_id : INT64_MAX;
+
+  sqlite3_stmt * stmt = NULL;
+  char * sql = alloc_export_sql(format, since ? EXPORT_ID_RANGE_SQL : options->range ? EXPORT_TIME_RANGE_SQL : EXPORT_SQL);
+  int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+  if(rc == SQLITE_OK) rc = since ? sqlite3_bind_int64(stmt, 1, first_id) : bind_time_range(stmt, options->range);
+  if(rc == SQLITE_OK && since) rc = sqlite3_bind_int64(stmt, 2, last_id);
+  free(sql), sql = NULL;
+  if(rc != SQLITE_OK) {
+    sqlite3_finalize(stmt);
+    goto err0;
+  }
+
+  /* Column names never change between rows; render their keys once */
+  export_columns columns;
+  init_export_columns(&columns, stmt);
+
+  output_buffer out;
+  fflush(stdout);
+  output_buffer_init(&out, fileno(stdout), HIF_OUTPUT_BUFFER_SIZE);
+
+  /* Full buffers go to the compressor's thread while the next fills */
+  compressed_output * compressed = NULL;
+  if(options->compression != EXPORT_COMPRESSION_NONE) {
+    compressed = compressed_output_start(fileno(stdout), options->compression, HIF_OUTPUT_BUFFER_SIZE);
+    if(compressed) compressed_output_attach(compressed, &out);
+  }
+
+  if(trace_enabled) trace_statement_begin(stmt);
+  TRACE_START(started);
+
+  long rows = 0;
+  if(options->compression != EXPORT_COMPRESSION_NONE && !compressed) {
+    rc = SQLITE_ERROR;
+  } else if(!format->write_header(db, &out, &columns)) {
+    rc = SQLITE_ERROR;
+  } else if(options->contexts && since) {
+    /* The context's own rows from db's transaction, then its shards' */
+    rc = export_serial(stmt, format, &columns, NULL, &out, &rows);
+    if(rc == SQLITE_OK) rc = export_contexts(options->contexts + 1, options->context_count - 1, options->range, first_id, last_id, format, &columns, &out, &rows);
+  } else if(options->contexts) {
+    rc = export_contexts(options->contexts, options->context_count, options->range, first_id, last_id, format, &columns, &out, &rows);
+  } else if(options->jobs > 1 && !options->kvp && !since && path) {
+    rc = export_parallel(db, path, options->jobs, options->range, format, &columns, &out, &rows);
+  } else {
+    rc = export_serial(stmt, format, &columns, options->kvp, &out, &rows);
+  }
+
+  if(rc == SQLITE_OK && since) {
+    rc = export_changes(db, since, options->until, format, &out, &rows);
+  } else if(rc == SQLITE_OK) {
+    format->write_footer(&out, rows);
+  }
+  metrics_count_rows_read(rows);
+  TRACE_PHASE("export_rows", started);
+
+  TRACE_START(flush_started);
+  if(!output_buffer_flush(&out) && rc == SQLITE_OK) rc = SQLITE_IOERR;
+  if(compressed && !compressed_output_finish(compressed) && rc == SQLITE_OK) rc = SQLITE_IOERR;
+  output_buffer_free(&out);
+  TRACE_PHASE("export_flush", flush_started);
+  if(trace_enabled) trace_statement_end(stmt);
+
+  free_export_columns(&columns);
+
+  sqlite3_finalize(stmt);
+
+err0:
+  return rc;
+}
@@ -9,91 +9,14 @@
 #include "environment.h"
 #include "memo_repository.h"
 #include "storage_adapter.h"
+#include "commands.h"
+#include "hifd_protocol.h"
+#include "trace.h"
+#include "metrics.h"
+#include "contexts.h"
 
 typedef int (*fn_command)(sqlite3 * db, void * payload);
 
-static void print_version(FILE * out) {
-  fprintf(out, HIF_EXECUTABLE " " HIF_VERSION "\n");
-}
-
-static void print_help(FILE * out) {
-  print_version(out);  
-  fprintf(out, "usage: hif [+emotion | command (args)*]\n\n");
-  if(out == stderr) {
-    fprintf(out, "Sorry bud, you need to tell me how you feel.\n");
-    fprintf(out, "\nOr try a command:\n");
-  }
-  fprintf(out, "\nEmotion Commands\n");
-  fprintf(out, "\tadd {emotion}        - Journal a new {emotion} feel.\n");
-  fprintf(out, "\t                       alias +, i.e. $ hif +sad\n");
-  fprintf(out, "\tdelete-feel {id}     - Delete a feel by id.\n");
-
-  fprintf(out, "\nJournaling Commands\n");
-  fprintf(out, "\tmemo {memo}          - Add a memo.\n");
-  fprintf(out, "\tdelete-memo {memo-id}- Delete a memo by id.\n");
-
-  fprintf(out, "\nMetadata Commands\n");
-  fprintf(out, "\tdescribe-feel {feel} - Describe a feel.\n");
-  fprintf(out, "\tcreate-emotion       - Create a new emotion.\n");
-  fprintf(out, "\tcount-feels          - Return a count of feels.\n");
-  fprintf(out, "\tcreate-context       - Create a new feels context database.\n");
-
-  fprintf(out, "\nImport/Export Commands\n");
-  fprintf(out, "\texport-json          - Dump feels in json format.\n");
-  fprintf(out, "\n");
-  fprintf(out, "\thelp                 - Print this message.\n");
-  fprintf(out, "\tversion              - Print hif version information.\n");
-  fprintf(out, "\n");
-  fprintf(out, "Examples:\n");
-  fprintf(out, "\n");
-  fprintf(out, "Creating a new emotion:\n");
-  fprintf(out, "$ hif create-emotion \"love\" \"I love you\"\n");
-
-  fprintf(out, "\n");
-  fprintf(out, "Journaling a happy feel:\n");
-  fprintf(out, "$ hif +love\n");
-}
-
-static char * str_lower(char * s) {
-  char * p = s;
-  for (; *p; ++p) { *p = tolower(*p); }
-  return s;
-}
-
-static hif_command str_to_command(const char * s) {
-  const size_t MAX_COMMAND_LENGTH = sizeof("describe-feel") - 1;
-
-  size_t len = strnlen(s, MAX_COMMAND_LENGTH);
-  if(*s == '+' || strncmp(s, "add", len) == 0) {
-    return HIF_COMMAND_ADD_FEEL;
-  } else if(strncmp(s, "describe-feel", len) == 0) {
-    return HIF_COMMAND_GET_FEEL_DESCRIPTION;
-  } else if(strncmp(s, "export-json", len) == 0) {
-    return HIF_COMMAND_JSON;
-  } else if(strncmp(s, "delete-feel", len) == 0) {
-    return HIF_COMMAND_DELETE_FEEL;
-  } else if(strncmp(s, "count-feels", len) == 0) {
-    return HIF_COMMAND_COUNT_FEELS;
-  } else if(strncmp(s, "create-context", len) == 0) {
-    return HIF_COMMAND_CREATE;
-  } else if(strncmp(s, "create-emotion", len) == 0) {
-    return HIF_COMMAND_CREATE_FEEL;
-  } else if(strncmp(s, "memo", len) == 0) {
-    return HIF_COMMAND_ADD_MEMO;
-  } else if(strncmp(s, "delete-memo", len) == 0) {
-    return HIF_COMMAND_DELETE_MEMO;
-  } else if(strncmp(s, "help", len) == 0) {
-    print_help(stdout);
-    exit(0);
-  } else if(strncmp(s, "version", len) == 0) {
-    print_version(stdout);
-    exit(0);
-  } else {
-    print_help(stderr);
-    exit(-1);
-  }
-}
-
 static void terminate() {
   char const * config_path = get_config_path();
   free((void *)config_path);
@@ -109,175 +32,101 @@ static int initialize() {
   return ret;
 }
 
-static void command_create(storage_interface const * adapter, int argc, char **argv) {
-  const char * path = NULL;
-  if(argc >= 3) {
-    path = argv[2];
-  }
-  adapter->create_storage(adapter, path);
-  fprintf(stdout, "Created context %s\n", path);
-}
+/* Counted from the start of main, so forwarded runs include the round trip
+ * to hifd. HIF_NO_METRICS=1 turns recording off. */
+static int record_metrics(hif_command command, int64_t started, int status) {
+  char const * disabled = getenv("HIF_NO_METRICS");
+  if(command == HIF_COMMAND_METRICS || (disabled && *disabled && strcmp(disabled, "0") != 0)) return status;
 
-static void command_count_feels(storage_interface const * adapter, int argc, char **argv) {
-  (void)argc;
-  (void)argv;
-
-  int count = adapter->count_feels(adapter);
-  fprintf(stdout, "%i\n", count);
-}
-
-static void command_add_feel(storage_interface const * adapter, int argc, char **argv) {
-  if(argc < 2) {
-    print_help(stderr);
-    exit(-1);
-  }
-
-  char * feel = argv[1];
-  if(*feel == '+') {
-    feel++;
-  } else {
-    if(argc < 3) {
-      print_help(stderr);
-      exit(-1);
+  int64_t elapsed = trace_now() - started;
+  ensure_config_path();
+  metrics_record(command_name(command), elapsed > 0 ? (uint64_t)elapsed : 0, status < 0);
+
+  return status;
+}
+
+/* Options before the command apply to this invocation only. They are
+ * consumed by shifting argv, so commands still find themselves in argv[1]. */
+static int parse_options(int * argc, char ***argv, char const ** context, storage_durability * durability, int * trace) {
+  int consumed = 0;
+  char **args = *argv;
+
+  while(consumed + 1 < *argc && strncmp(args[consumed + 1], "--", 2) == 0) {
+    char const * option = args[consumed + 1];
+    if(strcmp(option, "--durability") == 0 && consumed + 2 < *argc) {
+      *durability = storage_durability_from_name(args[consumed + 2]);
+      if(*durability == STORAGE_DURABILITY_EOF) return 0;
+      consumed += 2;
+    } else if(strcmp(option, "--context") == 0 && consumed + 2 < *argc) {
+      *context = args[consumed + 2];
+      consumed += 2;
+    } else if(strcmp(option, "--trace") == 0) {
+      *trace = 1;
+      consumed++;
+    } else {
+      return 0;
     }
-    feel = argv[2];
   }
-  
-  char * description = NULL;
-  int rc = adapter->insert_feel(adapter, feel, &description);
-  if(!rc) {
-    fprintf(stderr, "I'm not familiar with the feels '%s'. Try create-emotion, first.\n", feel);
-  } else {
-    fprintf(stdout, "Feels '%s' logged, %s\n", feel, description ? description : "(yay)");
-  }
-  
-  if(description) free(description), description = NULL;
-}
 
-static void command_export(storage_interface const * adapter, int argc, char **argv) {
-  (void)argc; (void)argv;
-  adapter->export(adapter, NULL);
-}
+  args[consumed] = args[0];
+  *argv = args + consumed;
+  *argc -= consumed;
 
-static void command_delete_feel(storage_interface const * adapter, int argc, char **argv) {
-  if(argc < 3) {
-    print_help(stderr);
-    exit(1);
-  }
-  int id = atoi(argv[2]);
-  int affected_rows = 0;
-  int rc = adapter->delete_feel(adapter, id, &affected_rows);
-
-  if(!rc || affected_rows == 0) {
-    fprintf(stderr, "Nothing to delete, feel id %i is not present!\n", (int)id);
-  } else {
-    fprintf(stdout, "Feel deleted!\n");
-  }
+  return 1;
 }
 
-static void command_create_feel(storage_interface const * adapter, int argc, char **argv) {
-  if(argc < 3) {
-    print_help(stderr);
-    exit(-1);
-  }
-  char const * name = argv[2];
-  char const * description = NULL;
-  if(argc > 3) {
-    description = argv[3];  
-  }
+/* hifd only ever has the default context open */
+static int is_default_context_only(char const * context, int argc, char **argv) {
+  if(context) return 0;
 
-  int rc = adapter->create_feel(adapter, name, description);
-  if(!rc) {
-    fprintf(stderr, "Skipped adding feel '%s'; it already exists!\n", name);
-  } else {
-    fprintf(stdout, "Created feel '%s': %s\n", name, description ? description : "[empty]");
+  for(int i = 2; i < argc; i++) {
+    if(strcmp(argv[i], "--all-contexts") == 0) return 0;
   }
-}
 
-static void command_count_memos(storage_interface const * adapter, int argc, char **argv) {
-  (void)adapter; (void)argc; (void)argv;
+  return 1;
 }
 
-static void command_add_memo(storage_interface const * adapter, int argc, char **argv) {
-  if(argc < 3) {
+int main(int argc, char **argv) {
+  int64_t started = trace_now();
+
+  char const * context = NULL;
+  storage_durability durability = STORAGE_DURABILITY_DEFAULT;
+  int trace = 0;
+  if(!parse_options(&argc, &argv, &context, &durability, &trace)) {
     print_help(stderr);
     exit(-1);
   }
 
-  char const * memo = argv[2];
-
-  int affected_rows;
-  int rc = adapter->insert_memo(adapter, memo, &affected_rows);
-
-  if(!rc) {
-    fprintf(stderr, "Failed to add memo.\n");
-  } else {
-    fprintf(stdout, "Added new memo, '%s'\n", memo);
-  }
-}
-
-static void command_delete_memo(storage_interface const * adapter, int argc, char **argv) {
-  if(argc < 3) {
-    print_help(stderr);
-    exit(1);
-  }
-  int id = atoi(argv[2]);
-  int affected_rows = 0;
-
-  memo_repository_interface const * repository = memo_repository_alloc(adapter);
-  int rc = repository->delete_memo(repository, id, &affected_rows);
-  repository->free(repository);
-  if(!rc || affected_rows == 0) {
-    fprintf(stderr, "Nothing to delete, memo id %i is not present!\n", (int)id);
-  } else {
-    fprintf(stdout, "Memo deleted!\n");
+  /* --trace always writes to stderr; HIF_TRACE may name a file instead */
+  char const * trace_destination = trace ? "stderr" : getenv("HIF_TRACE");
+  if(trace_destination && *trace_destination && strcmp(trace_destination, "0") != 0 && !trace_open(trace_destination)) {
+    fprintf(stderr, "Failed to open trace file %s\n", trace_destination);
+    exit(-1);
   }
 
-}
-
-static void command_get_feel_description(storage_interface const * adapter, int argc, char **argv) {
-  if(argc < 3) {
+  if(argc < 2) {
     print_help(stderr);
     exit(-1);
   }
 
-  char * feel = argv[2];
-  char * description = NULL;
+  char *p = str_lower(argv[1]);
 
-  int rc = adapter->get_feel_description(adapter, feel, &description);
-  if(rc) {
-    fprintf(stderr, "Feel not found; try list-feels\n");
+  hif_command command = str_to_command(p);
+  if((command < HIF_COMMAND_CREATE) || command >= HIF_COMMAND_EOF) {
+    print_help(stderr);
     exit(-1);
   }
 
-  fprintf(stdout, "%s\n", description);
+  if(!command_requires_storage(command)) return record_metrics(command, started, run_command(NULL, command, argc, argv));
 
-  free(description), description = NULL;
-}
+  /* A running hifd already has the context open and warm, at its own durability */
+  int status = 0;
+  if(durability == STORAGE_DURABILITY_DEFAULT && !trace_enabled && is_default_context_only(context, argc, argv)
+    && hifd_command_is_forwardable(command) && hifd_forward(argc, argv, &status)) return record_metrics(command, started, status);
 
-typedef void (*command_fn)(storage_interface const * adapter, int argc, char **argv);
-
-static command_fn fns[] = {
-  &command_create, /* HIF_COMMAND_CREATE */
-  &command_count_feels, /* HIF_COMMAND_COUNT_FEELS */
-  &command_export, /* HIF_COMMAND_JSON */
-  &command_delete_feel, /* HIF_COMMAND_DELETE_FEEL */
-  &command_create_feel, /* HIF_COMMAND_CREATE_FEEL */
-  &command_add_feel, /* HIF_COMMAND_ADD_FEEL */
-  &command_count_memos, /* HIF_COMMAND_COUNT_MEMOS */
-  &command_add_memo, /* HIF_COMMAND_ADD_MEMO */
-  &command_get_feel_description, /* HIF_COMMAND_GET_FEEL_DESCRIPTION */
-  &command_delete_memo /* HIF_COMMAND_DELETE_MEMO */
-};
-
-int main(int argc, char **argv) {
-  static const char * const DB = "hif.db";
-  
+  TRACE_START(phase_started);
   int call_terminate_on_exit = initialize();
-  if(argc < 2) {
-    print_help(stderr);
-    exit(-1);
-  }
+  TRACE_PHASE("initialize", phase_started);
 
   int ret = -1;
   storage_interface const * adapter = NULL;
@@ -286,30 +135,54 @@ int main(int argc, char **argv) {
   repository = memo_repository_alloc();
   repository->free((memo_repository_interface*)repository);
 
-  char *p = str_lower(argv[1]);
-  
-  hif_command command = str_to_command(p);
-  if((command < HIF_COMMAND_CREATE) || command > HIF_COMMAND_EOF) goto err0;
-
   adapter = storage_adapter_alloc();
+  char * db = alloc_context_file_name(context ? context : HIF_DEFAULT_CONTEXT);
 
-  if(!context_exists(DB)) {
-    ret = adapter->create_storage(adapter, DB);
+  if(trace_enabled) phase_started = trace_now();
+  if(!context_exists(db)) {
+    ret = adapter->create_storage(adapter, db);
     if(ret) goto err0;
+    TRACE_PHASE("create_storage", phase_started);
   }
 
-  ret = adapter->open_storage(adapter, DB);
+  if(trace_enabled) phase_started = trace_now();
+  ret = adapter->open_storage(adapter, db);
   if(ret) goto err0;
+  TRACE_PHASE("open_storage", phase_started);
 
-  fns[command](adapter, argc, argv);
-  
-  ret = adapter->close(adapter);
+  if(durability != STORAGE_DURABILITY_DEFAULT && !adapter->set_durability(adapter, durability, 0)) {
+    ret = -1;
+    goto err1;
+  }
+
+  if(trace_enabled) phase_started = trace_now();
+  status = run_command(adapter, command, argc, argv);
+  TRACE_PHASE("command", phase_started);
+
+  if(trace_enabled) {
+    phase_started = trace_now();
+    fflush(stdout);
+    trace_phase("output", phase_started);
+    trace_memory();
+    phase_started = trace_now();
+  }
+  ret = adapter->close(adapter) ? 0 : -1;
+  TRACE_PHASE("close", phase_started);
   if(ret) goto err0;
 
-  ret = 0;
+  ret = status;
+  goto err0;
 
+err1:
+  adapter->close(adapter);
 err0:
   if(adapter) adapter->free(adapter);
+  free(db), db = NULL;
+  record_metrics(command, started, ret);
+  if(trace_enabled) {
+    trace_phase("total", started);
+    trace_close();
+  }
   if(call_terminate_on_exit) terminate();
   
   return ret;
@@ -0,0 +1,310 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include <sqlite3.h>
+
+#include "hif.h"
+#include "environment.h"
+#include "storage_adapter.h"
+#include "trace.h"
+#include "commands.h"
+#include "hifd_protocol.h"
+
+/* A batched context commits grouped writes once the oldest has waited this
+ * long, or as soon as this many are waiting. */
+#define HIFD_GROUP_COMMIT_WINDOW_MS 5
+#define HIFD_GROUP_COMMIT_MAX_WRITES 64
+
+/* Each read of a request waits at most this long, so a client that
+ * connects and stalls cannot hold up the accept loop. */
+#define HIFD_RECEIVE_TIMEOUT_MS 1000
+
+/* Clients whose writes are in the open transaction; each hears its status,
+ * and on its stderr about a failed commit, once the transaction ends. */
+typedef struct group_commit {
+  int client_fds[HIFD_GROUP_COMMIT_MAX_WRITES];
+  int error_fds[HIFD_GROUP_COMMIT_MAX_WRITES];
+  int32_t statuses[HIFD_GROUP_COMMIT_MAX_WRITES];
+  size_t count;
+
+  long opened_at;
+} group_commit;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void on_stop_signal(int signal_number) {
+  (void)signal_number;
+  stopping = 1;
+}
+
+static void print_usage(FILE * out) {
+  fprintf(out, HIFD_EXECUTABLE " " HIF_VERSION "\n");
+  fprintf(out, "usage: " HIFD_EXECUTABLE " [--detach]\n\n");
+  fprintf(out, "Keeps the hif context open and serves hif commands over\n");
+  fprintf(out, "~/.config/hif/" HIFD_SOCKET_NAME " until interrupted.\n");
+}
+
+static int is_peer_trusted(int fd) {
+#ifdef SO_PEERCRED
+  struct ucred credentials;
+  socklen_t len = sizeof credentials;
+  if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &len) != 0) return 0;
+  return credentials.uid == getuid();
+#else
+  (void)fd;
+  return 1;
+#endif
+}
+
+static long now_milliseconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void flush_group(storage_interface const * adapter, group_commit * group) {
+  if(!group->count) return;
+
+  int committed = adapter->commit_transaction(adapter);
+  if(!committed) adapter->rollback_transaction(adapter);
+
+  for(size_t i = 0; i < group->count; i++) {
+    if(!committed) dprintf(group->error_fds[i], "Failed to commit; the change was not saved.\n");
+    hifd_send_status(group->client_fds[i], committed ? group->statuses[i] : -1);
+    close(group->error_fds[i]);
+    close(group->client_fds[i]);
+  }
+
+  group->count = 0;
+}
+
+static int group_is_due(group_commit const * group) {
+  return group->count && now_milliseconds() - group->opened_at >= HIFD_GROUP_COMMIT_WINDOW_MS;
+}
+
+/* Runs one request with the client's own stdout and stderr in place of ours.
+ * Returns 1 when the client joined the open group commit and must stay
+ * connected until it is flushed. */
+static int serve_client(storage_interface const * adapter, int client_fd, group_commit * group) {
+  struct timeval timeout = { HIFD_RECEIVE_TIMEOUT_MS / 1000, (HIFD_RECEIVE_TIMEOUT_MS % 1000) * 1000 };
+  if(setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout) != 0) return 0;
+
+  hifd_request request;
+  if(!is_peer_trusted(client_fd) || !hifd_recv_request(client_fd, &request)) return 0;
+
+  hif_command command = request.argc < 2 ? HIF_COMMAND_EOF : str_to_command(str_lower(request.argv[1]));
+  if(!hifd_command_is_forwardable(command)) {
+    hifd_send_status(client_fd, HIFD_STATUS_UNHANDLED);
+    hifd_free_request(&request);
+    return 0;
+  }
+
+  /* Anything else sees, and may change, the context only after pending writes commit */
+  int grouped = hifd_command_is_write(command) && adapter->get_durability(adapter) == STORAGE_DURABILITY_BATCHED;
+  if(!grouped) {
+    flush_group(adapter, group);
+  } else if(!group->count) {
+    grouped = adapter->begin_transaction(adapter);
+    group->opened_at = now_milliseconds();
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+
+  int saved_stdout = dup(STDOUT_FILENO);
+  int saved_stderr = dup(STDERR_FILENO);
+  dup2(request.fds[0], STDOUT_FILENO);
+  dup2(request.fds[1], STDERR_FILENO);
+
+  int status = run_command(adapter, command, request.argc, request.argv);
+
+  fflush(stdout);
+  fflush(stderr);
+  clearerr(stdout);
+  clearerr(stderr);
+
+  dup2(saved_stdout, STDOUT_FILENO);
+  dup2(saved_stderr, STDERR_FILENO);
+  close(saved_stdout);
+  close(saved_stderr);
+
+  if(grouped) {
+    group->client_fds[group->count] = client_fd;
+    group->error_fds[group->count] = dup(request.fds[1]);
+    group->statuses[group->count] = status;
+    group->count++;
+
+    hifd_free_request(&request);
+    if(group->count == HIFD_GROUP_COMMIT_MAX_WRITES) flush_group(adapter, group);
+
+    return 1;
+  }
+
+  hifd_send_status(client_fd, status);
+  hifd_free_request(&request);
+
+  return 0;
+}
+
+/* A socket nobody answers on is left over from a daemon that died */
+static int claim_socket_path(char const * path, struct sockaddr_un const * addr) {
+  int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(probe < 0) return 0;
+
+  int in_use = connect(probe, (struct sockaddr const *)addr, sizeof * addr) == 0;
+  close(probe);
+
+  if(in_use) {
+    fprintf(stderr, HIFD_EXECUTABLE " is already running on %s\n", path);
+    return 0;
+  }
+
+  unlink(path);
+  return 1;
+}
+
+static int open_listener(char const * path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  if(strlen(path) >= sizeof addr.sun_path) {
+    fprintf(stderr, "Socket path %s is too long\n", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  if(!claim_socket_path(path, &addr)) return -1;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(fd < 0) return -1;
+
+  mode_t mask = umask(0077);
+  int rc = bind(fd, (struct sockaddr const *)&addr, sizeof addr);
+  umask(mask);
+
+  if(rc != 0 || listen(fd, SOMAXCONN) != 0) {
+    fprintf(stderr, "Unable to listen on %s: %s\n", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+static int detach() {
+  pid_t pid = fork();
+  if(pid < 0) return 0;
+  if(pid > 0) _exit(0);
+
+  setsid();
+
+  int null_fd = open("/dev/null", O_RDWR);
+  if(null_fd >= 0) {
+    dup2(null_fd, STDIN_FILENO);
+    dup2(null_fd, STDOUT_FILENO);
+    dup2(null_fd, STDERR_FILENO);
+    if(null_fd > STDERR_FILENO) close(null_fd);
+  }
+
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  static const char * const DB = "hif.db";
+
+  int should_detach = 0;
+  for(int i = 1; i < argc; i++) {
+    if(strcmp(argv[i], "--detach") == 0) {
+      should_detach = 1;
+    } else {
+      print_usage(strcmp(argv[i], "help") == 0 ? stdout : stderr);
+      return strcmp(argv[i], "help") == 0 ? 0 : -1;
+    }
+  }
+
+  int ret = -1;
+  sqlite3_initialize();
+  ensure_config_path();
+
+  /* Traces every statement the daemon runs; name a file when detaching */
+  char const * trace_destination = getenv("HIF_TRACE");
+  if(trace_destination && *trace_destination && strcmp(trace_destination, "0") != 0 && !trace_open(trace_destination)) {
+    fprintf(stderr, "Failed to open trace file %s\n", trace_destination);
+  }
+
+  storage_interface const * adapter = storage_adapter_alloc();
+  char * path = hifd_alloc_socket_path();
+  int listen_fd = -1;
+
+  listen_fd = open_listener(path);
+  if(listen_fd < 0) goto err0;
+
+  /* Detach before opening the context; sqlite connections must not cross fork */
+  if(should_detach && !detach()) goto err1;
+
+  if(!context_exists(DB) && adapter->create_storage(adapter, DB)) goto err1;
+  if(adapter->open_storage(adapter, DB)) goto err1;
+
+  struct sigaction action;
+  memset(&action, 0, sizeof action);
+  action.sa_handler = &on_stop_signal;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  group_commit group;
+  memset(&group, 0, sizeof group);
+
+  while(!stopping) {
+    /* Wake up now and then in case a stop signal lands just before poll */
+    int timeout = 1000;
+    if(group.count) {
+      long remaining = group.opened_at + HIFD_GROUP_COMMIT_WINDOW_MS - now_milliseconds();
+      timeout = remaining > 0 ? (int)remaining : 0;
+    }
+
+    struct pollfd pfd = { listen_fd, POLLIN, 0 };
+    int ready = poll(&pfd, 1, timeout);
+    if(group_is_due(&group)) flush_group(adapter, &group);
+    if(ready == 0) continue;
+    if(ready < 0) {
+      if(errno == EINTR) continue;
+      break;
+    }
+
+    int client_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if(client_fd < 0) continue;
+
+    if(!serve_client(adapter, client_fd, &group)) close(client_fd);
+  }
+
+  flush_group(adapter, &group);
+  ret = 0;
+
+err1:
+  close(listen_fd);
+  unlink(path);
+err0:
+  free(path), path = NULL;
+  adapter->free(adapter);
+  if(trace_enabled) {
+    trace_memory();
+    trace_close();
+  }
+  sqlite3_shutdown();
+
+  return ret;
+}
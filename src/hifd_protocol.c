@@ -0,0 +1,254 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "hif.h"
+#include "environment.h"
+#include "hifd_protocol.h"
+
+char * hifd_alloc_socket_path() {
+  return alloc_concat_path(get_config_path(), HIFD_SOCKET_NAME);
+}
+
+/* Short writes and reads against the open context; anything long-running,
+ * such as exports and stats, or tied to the client's working directory
+ * stays in the client, since hifd serves one client at a time. */
+int hifd_command_is_forwardable(hif_command command) {
+  switch(command) {
+    case HIF_COMMAND_COUNT_FEELS:
+    case HIF_COMMAND_DELETE_FEEL:
+    case HIF_COMMAND_CREATE_FEEL:
+    case HIF_COMMAND_ADD_FEEL:
+    case HIF_COMMAND_COUNT_MEMOS:
+    case HIF_COMMAND_ADD_MEMO:
+    case HIF_COMMAND_GET_FEEL_DESCRIPTION:
+    case HIF_COMMAND_DELETE_MEMO:
+    case HIF_COMMAND_SEARCH:
+    case HIF_COMMAND_DURABILITY:
+    case HIF_COMMAND_SHARDS:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+int hifd_command_is_write(hif_command command) {
+  switch(command) {
+    case HIF_COMMAND_DELETE_FEEL:
+    case HIF_COMMAND_CREATE_FEEL:
+    case HIF_COMMAND_ADD_FEEL:
+    case HIF_COMMAND_ADD_MEMO:
+    case HIF_COMMAND_DELETE_MEMO:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static int write_fully(int fd, char const * p, size_t len) {
+  while(len > 0) {
+    ssize_t written = send(fd, p, len, MSG_NOSIGNAL);
+    if(written < 0) {
+      if(errno == EINTR) continue;
+      return 0;
+    }
+    p += written;
+    len -= (size_t)written;
+  }
+  return 1;
+}
+
+static int read_fully(int fd, char * p, size_t len) {
+  while(len > 0) {
+    ssize_t received = recv(fd, p, len, 0);
+    if(received < 0) {
+      if(errno == EINTR) continue;
+      return 0;
+    }
+    if(received == 0) return 0;
+    p += received;
+    len -= (size_t)received;
+  }
+  return 1;
+}
+
+int hifd_send_request(int socket_fd, int argc, char **argv, int const * fds) {
+  size_t payload_len = 0;
+  for(int i = 0; i < argc; i++) payload_len += strlen(argv[i]) + 1;
+  if(payload_len > HIFD_MAX_PAYLOAD) return 0;
+
+  char * payload = malloc(payload_len ? payload_len : 1);
+  if(!payload) abort();
+
+  char * p = payload;
+  for(int i = 0; i < argc; i++) {
+    size_t len = strlen(argv[i]) + 1;
+    memcpy(p, argv[i], len);
+    p += len;
+  }
+
+  hifd_request_header header = { HIFD_PROTOCOL_MAGIC, HIFD_PROTOCOL_VERSION, (uint32_t)argc, (uint32_t)payload_len };
+
+  union {
+    char buffer[CMSG_SPACE(sizeof(int) * HIFD_REQUEST_FDS)];
+    struct cmsghdr align;
+  } control;
+  memset(&control, 0, sizeof control);
+
+  struct iovec iov = { &header, sizeof header };
+  struct msghdr msg;
+  memset(&msg, 0, sizeof msg);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buffer;
+  msg.msg_controllen = sizeof control.buffer;
+
+  struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * HIFD_REQUEST_FDS);
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * HIFD_REQUEST_FDS);
+
+  /* The descriptors ride on the header; the payload follows as plain bytes */
+  ssize_t sent;
+  do {
+    sent = sendmsg(socket_fd, &msg, MSG_NOSIGNAL);
+  } while(sent < 0 && errno == EINTR);
+
+  int ok = sent >= 0
+    && write_fully(socket_fd, (char const *)&header + sent, sizeof header - (size_t)sent)
+    && write_fully(socket_fd, payload, payload_len);
+
+  free(payload), payload = NULL;
+
+  return ok;
+}
+
+int hifd_recv_request(int socket_fd, hifd_request * request) {
+  memset(request, 0, sizeof * request);
+  for(int i = 0; i < HIFD_REQUEST_FDS; i++) request->fds[i] = -1;
+
+  hifd_request_header header;
+
+  union {
+    char buffer[CMSG_SPACE(sizeof(int) * HIFD_REQUEST_FDS)];
+    struct cmsghdr align;
+  } control;
+
+  struct iovec iov = { &header, sizeof header };
+  struct msghdr msg;
+  memset(&msg, 0, sizeof msg);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buffer;
+  msg.msg_controllen = sizeof control.buffer;
+
+  ssize_t received;
+  do {
+    received = recvmsg(socket_fd, &msg, MSG_CMSG_CLOEXEC);
+  } while(received < 0 && errno == EINTR);
+  if(received <= 0) return 0;
+
+  for(struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS
+        && cmsg->cmsg_len == CMSG_LEN(sizeof(int) * HIFD_REQUEST_FDS)) {
+      memcpy(request->fds, CMSG_DATA(cmsg), sizeof(int) * HIFD_REQUEST_FDS);
+    }
+  }
+
+  if(!read_fully(socket_fd, (char *)&header + received, sizeof header - (size_t)received)) goto err0;
+
+  if(header.magic != HIFD_PROTOCOL_MAGIC || header.version != HIFD_PROTOCOL_VERSION) goto err0;
+  if(header.payload_len > HIFD_MAX_PAYLOAD || header.argc < 1 || header.argc > header.payload_len) goto err0;
+  if(request->fds[0] < 0 || request->fds[1] < 0) goto err0;
+
+  request->payload = malloc(header.payload_len);
+  request->argv = calloc(header.argc + 1, sizeof * request->argv);
+  if(!request->payload || !request->argv) abort();
+
+  if(!read_fully(socket_fd, request->payload, header.payload_len)) goto err0;
+  if(request->payload[header.payload_len - 1] != '\0') goto err0;
+
+  char * p = request->payload;
+  char * end = request->payload + header.payload_len;
+  for(uint32_t i = 0; i < header.argc; i++) {
+    if(p >= end) goto err0;
+    request->argv[i] = p;
+    p += strlen(p) + 1;
+  }
+  if(p != end) goto err0;
+
+  request->argc = (int)header.argc;
+
+  return 1;
+
+err0:
+  hifd_free_request(request);
+  return 0;
+}
+
+void hifd_free_request(hifd_request * request) {
+  for(int i = 0; i < HIFD_REQUEST_FDS; i++) {
+    if(request->fds[i] >= 0) close(request->fds[i]), request->fds[i] = -1;
+  }
+
+  free(request->argv), request->argv = NULL;
+  free(request->payload), request->payload = NULL;
+  request->argc = 0;
+}
+
+int hifd_send_status(int socket_fd, int32_t status) {
+  return write_fully(socket_fd, (char const *)&status, sizeof status);
+}
+
+int hifd_recv_status(int socket_fd, int32_t * status) {
+  return read_fully(socket_fd, (char *)status, sizeof * status);
+}
+
+int hifd_forward(int argc, char **argv, int * status) {
+  char const * no_daemon = getenv("HIF_NO_DAEMON");
+  if(no_daemon && *no_daemon && strcmp(no_daemon, "0") != 0) return 0;
+
+  int handled = 0;
+  char * path = hifd_alloc_socket_path();
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  if(strlen(path) >= sizeof addr.sun_path) goto err0;
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(fd < 0) goto err0;
+
+  if(connect(fd, (struct sockaddr const *)&addr, sizeof addr) != 0) goto err1;
+
+  fflush(stdout);
+  fflush(stderr);
+
+  int const fds[HIFD_REQUEST_FDS] = { fileno(stdout), fileno(stderr) };
+  if(!hifd_send_request(fd, argc, argv, fds)) goto err1;
+
+  /* The daemon has the whole request; it may already have run it */
+  int32_t remote = 0;
+  handled = 1;
+  if(!hifd_recv_status(fd, &remote)) {
+    fprintf(stderr, HIFD_EXECUTABLE " stopped before answering; the command may not have run.\n");
+    *status = -1;
+  } else if(remote == HIFD_STATUS_UNHANDLED) {
+    handled = 0;
+  } else {
+    *status = remote;
+  }
+
+err1:
+  close(fd);
+err0:
+  free(path), path = NULL;
+  return handled;
+}
@@ -0,0 +1,599 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "storage_adapter.h"
+#include "importer.h"
+
+static int import(importer_interface const * importer, FILE * in, import_format format, import_stats * stats);
+
+struct importer_data;
+
+typedef struct importer {
+  importer_interface _interface;
+
+  struct importer_data * data;
+} importer;
+
+typedef struct importer_data {
+  storage_interface const * adapter;
+  int batch_size;
+} importer_data;
+
+typedef struct import_record {
+  char const * id;
+  char const * feel;
+  char const * description;
+  char const * dtm;
+  char const * memo;
+
+  char id_number[32];
+  char dtm_number[64];
+} import_record;
+
+/* export-json documents are read through a fixed window; no single feel
+ * may be larger than a record buffer. */
+typedef struct json_stream {
+  FILE * in;
+
+  char buffer[HIF_IMPORT_JSON_BUFFER_SIZE];
+  size_t len;
+  size_t pos;
+} json_stream;
+
+importer_interface const * importer_alloc(storage_interface const * adapter, int batch_size) {
+  importer * imp = malloc(sizeof * imp);
+
+  return importer_init((importer_interface *)imp, adapter, batch_size);
+}
+
+importer_interface const * importer_init(importer_interface * imp, storage_interface const * adapter, int batch_size) {
+  importer_data * data = malloc(sizeof * data);
+  memset(data, 0, sizeof * data);
+  ((importer *)imp)->data = data;
+
+  data->adapter = adapter;
+  data->batch_size = batch_size > 0 ? batch_size : HIF_IMPORT_DEFAULT_BATCH_SIZE;
+
+  imp->import = &import;
+  imp->free = &importer_free;
+
+  return imp;
+}
+
+void importer_free(importer_interface const * imp) {
+  if(!imp) return;
+
+  importer_data * data = ((importer *)imp)->data;
+  if(data) {
+    free(data), ((importer *)imp)->data = NULL;
+  }
+  free((importer *)imp), imp = NULL;
+}
+
+import_format import_format_from_name(char const * name) {
+  if(!name) return IMPORT_FORMAT_AUTO;
+  if(strcasecmp(name, "ndjson") == 0 || strcasecmp(name, "jsonl") == 0) return IMPORT_FORMAT_NDJSON;
+  if(strcasecmp(name, "csv") == 0) return IMPORT_FORMAT_CSV;
+
+  return IMPORT_FORMAT_AUTO;
+}
+
+static char * skip_ws(char * p) {
+  while(*p && isspace((unsigned char)*p)) ++p;
+  return p;
+}
+
+static int hex_value(char c) {
+  if(c >= '0' && c <= '9') return c - '0';
+  if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static long parse_hex4(char const * p) {
+  long value = 0;
+  for(int i = 0; i < 4; i++) {
+    int h = hex_value(p[i]);
+    if(h < 0) return -1;
+    value = (value << 4) | h;
+  }
+  return value;
+}
+
+static char * put_utf8(char * d, long cp) {
+  if(cp < 0x80) {
+    *d++ = (char)cp;
+  } else if(cp < 0x800) {
+    *d++ = (char)(0xc0 | (cp >> 6));
+    *d++ = (char)(0x80 | (cp & 0x3f));
+  } else if(cp < 0x10000) {
+    *d++ = (char)(0xe0 | (cp >> 12));
+    *d++ = (char)(0x80 | ((cp >> 6) & 0x3f));
+    *d++ = (char)(0x80 | (cp & 0x3f));
+  } else {
+    *d++ = (char)(0xf0 | (cp >> 18));
+    *d++ = (char)(0x80 | ((cp >> 12) & 0x3f));
+    *d++ = (char)(0x80 | ((cp >> 6) & 0x3f));
+    *d++ = (char)(0x80 | (cp & 0x3f));
+  }
+  return d;
+}
+
+/* Unescapes the JSON string starting at the opening quote in place; the
+ * decoded form is never longer than the encoded one. Returns the position
+ * after the closing quote, or NULL when the string is malformed. */
+static char * parse_json_string(char * p, char ** out) {
+  char * s = ++p;
+  char * d = s;
+
+  while(*s && *s != '"') {
+    if(*s != '\\') {
+      *d++ = *s++;
+      continue;
+    }
+
+    ++s;
+    switch(*s) {
+      case '"': case '\\': case '/': *d++ = *s; break;
+      case 'b': *d++ = '\b'; break;
+      case 'f': *d++ = '\f'; break;
+      case 'n': *d++ = '\n'; break;
+      case 'r': *d++ = '\r'; break;
+      case 't': *d++ = '\t'; break;
+      case 'u': {
+        long cp = parse_hex4(s + 1);
+        if(cp < 0) return NULL;
+        s += 4;
+        if(cp >= 0xd800 && cp <= 0xdbff && s[1] == '\\' && s[2] == 'u') {
+          long low = parse_hex4(s + 3);
+          if(low >= 0xdc00 && low <= 0xdfff) {
+            cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+            s += 6;
+          }
+        }
+        d = put_utf8(d, cp);
+        break;
+      }
+      default:
+        return NULL;
+    }
+    ++s;
+  }
+
+  if(*s != '"') return NULL;
+
+  *d = '\0';
+  *out = p;
+
+  return s + 1;
+}
+
+/* Skips any JSON value other than a string, including nested containers */
+static char * skip_json_value(char * p, char * token, size_t token_len) {
+  char * start = p;
+  int depth = 0;
+
+  while(*p) {
+    if(*p == '"') {
+      char * ignored = NULL;
+      p = parse_json_string(p, &ignored);
+      if(!p) return NULL;
+      continue;
+    }
+    if(*p == '{' || *p == '[') depth++;
+    else if(*p == '}' || *p == ']') {
+      if(depth == 0) break;
+      depth--;
+    } else if(*p == ',' && depth == 0) break;
+    ++p;
+  }
+
+  if(token) {
+    size_t len = (size_t)(p - start);
+    while(len > 0 && isspace((unsigned char)start[len - 1])) len--;
+    if(len >= token_len) len = token_len - 1;
+    memcpy(token, start, len);
+    token[len] = '\0';
+  }
+
+  return p;
+}
+
+static bool is_key(char const * key, char const * const * names) {
+  for(; *names; ++names) {
+    if(strcmp(key, *names) == 0) return true;
+  }
+  return false;
+}
+
+static int parse_ndjson_record(char * line, import_record * record) {
+  static char const * const FEEL_KEYS[] = { "feel", "emotion", NULL };
+  static char const * const DTM_KEYS[] = { "datetime", "dtm", "timestamp", NULL };
+  static char const * const MEMO_KEYS[] = { "memo", NULL };
+  static char const * const DESCRIPTION_KEYS[] = { "description", NULL };
+  static char const * const ID_KEYS[] = { "id", "feel_id", NULL };
+
+  char * p = skip_ws(line);
+  if(*p != '{') return 0;
+  p = skip_ws(p + 1);
+
+  while(*p && *p != '}') {
+    char * key = NULL;
+    if(*p != '"' || !(p = parse_json_string(p, &key))) return 0;
+
+    p = skip_ws(p);
+    if(*p != ':') return 0;
+    p = skip_ws(p + 1);
+
+    if(*p == '"') {
+      char * value = NULL;
+      if(!(p = parse_json_string(p, &value))) return 0;
+
+      if(is_key(key, FEEL_KEYS)) record->feel = value;
+      else if(is_key(key, DTM_KEYS)) record->dtm = value;
+      else if(is_key(key, MEMO_KEYS)) record->memo = value;
+      else if(is_key(key, DESCRIPTION_KEYS)) record->description = value;
+    } else if(is_key(key, DTM_KEYS)) {
+      if(!(p = skip_json_value(p, record->dtm_number, sizeof(record->dtm_number)))) return 0;
+      if(strcmp(record->dtm_number, "null") != 0) record->dtm = record->dtm_number;
+    } else if(is_key(key, ID_KEYS)) {
+      if(!(p = skip_json_value(p, record->id_number, sizeof(record->id_number)))) return 0;
+      if(strcmp(record->id_number, "null") != 0) record->id = record->id_number;
+    } else {
+      if(!(p = skip_json_value(p, NULL, 0))) return 0;
+    }
+
+    p = skip_ws(p);
+    if(*p == ',') p = skip_ws(p + 1);
+  }
+
+  return *p == '}';
+}
+
+/* Splits one CSV record in place; doubled quotes inside quoted fields collapse */
+static int split_csv_record(char * line, char ** fields, int max_fields) {
+  int count = 0;
+  char * s = line;
+
+  while(count < max_fields) {
+    char * d = s;
+    fields[count++] = d;
+
+    if(*s == '"') {
+      ++s;
+      while(*s) {
+        if(*s == '"') {
+          if(s[1] != '"') { ++s; break; }
+          ++s;
+        }
+        *d++ = *s++;
+      }
+      while(*s && *s != ',') ++s;
+    } else {
+      while(*s && *s != ',') *d++ = *s++;
+    }
+
+    int more = *s == ',';
+    *d = '\0';
+    if(!more) break;
+    s++;
+  }
+
+  return count;
+}
+
+static int parse_csv_record(char * line, import_record * record) {
+  char * fields[3] = { NULL, NULL, NULL };
+  int count = split_csv_record(line, fields, 3);
+
+  record->feel = fields[0];
+  if(count > 1) record->dtm = fields[1];
+  if(count > 2) record->memo = fields[2];
+
+  return record->feel && *record->feel;
+}
+
+static bool has_open_quote(char const * line) {
+  bool open = false;
+  for(; *line; ++line) {
+    if(*line == '"') open = !open;
+  }
+  return open;
+}
+
+static void trim_line_ending(char * line, ssize_t * len) {
+  while(*len > 0 && (line[*len - 1] == '\n' || line[*len - 1] == '\r')) {
+    line[--*len] = '\0';
+  }
+}
+
+/* Quoted CSV fields may span lines, so keep reading until quotes balance */
+static ssize_t read_record(FILE * in, char ** line, size_t * capacity, import_format format, long * line_number) {
+  ssize_t len = getline(line, capacity, in);
+  if(len < 0) return len;
+  ++*line_number;
+
+  if(format != IMPORT_FORMAT_CSV) return len;
+
+  char * next = NULL;
+  size_t next_capacity = 0;
+  while(has_open_quote(*line)) {
+    ssize_t next_len = getline(&next, &next_capacity, in);
+    if(next_len < 0) break;
+    ++*line_number;
+
+    if((size_t)(len + next_len + 1) > *capacity) {
+      size_t grown = (size_t)(len + next_len + 1) * 2;
+      char * buffer = realloc(*line, grown);
+      if(!buffer) abort();
+      *line = buffer, *capacity = grown;
+    }
+    memcpy(*line + len, next, (size_t)next_len + 1);
+    len += next_len;
+  }
+  free(next), next = NULL;
+
+  return len;
+}
+
+static int stream_peek(json_stream * stream) {
+  if(stream->pos == stream->len) {
+    stream->len = fread(stream->buffer, 1, sizeof stream->buffer, stream->in);
+    stream->pos = 0;
+    if(!stream->len) return EOF;
+  }
+  return (unsigned char)stream->buffer[stream->pos];
+}
+
+static int stream_next(json_stream * stream) {
+  int c = stream_peek(stream);
+  if(c != EOF) stream->pos++;
+  return c;
+}
+
+static int stream_skip_ws(json_stream * stream) {
+  int c;
+  while((c = stream_peek(stream)) != EOF && isspace(c)) stream->pos++;
+  return c;
+}
+
+/* Copies the next JSON value, whatever its kind, into record; with no record
+ * it is only skipped. Returns the value's length, or -1 when it is malformed
+ * or does not fit. */
+static long stream_read_value(json_stream * stream, char * record, size_t capacity) {
+  size_t len = 0;
+  int depth = 0;
+  bool in_string = false;
+  bool escaped = false;
+
+  int c = stream_skip_ws(stream);
+  bool is_scalar = c != '{' && c != '[' && c != '"';
+
+  while((c = stream_peek(stream)) != EOF) {
+    if(is_scalar && (c == ',' || c == '}' || c == ']' || isspace(c))) break;
+    stream->pos++;
+
+    if(record) {
+      if(len + 1 >= capacity) return -1;
+      record[len] = (char)c;
+    }
+    len++;
+
+    if(in_string) {
+      if(escaped) escaped = false;
+      else if(c == '\\') escaped = true;
+      else if(c == '"') in_string = false;
+    } else if(c == '"') {
+      in_string = true;
+    } else if(c == '{' || c == '[') {
+      depth++;
+    } else if(c == '}' || c == ']') {
+      depth--;
+    }
+
+    if(!is_scalar && !in_string && depth == 0) break;
+  }
+
+  if(in_string || depth != 0 || len == 0) return -1;
+  if(record) record[len] = '\0';
+
+  return (long)len;
+}
+
+static int import_document_feel(importer_data * data, char * record, long number, import_stats * stats) {
+  storage_interface const * adapter = data->adapter;
+
+  import_record parsed;
+  memset(&parsed, 0, sizeof parsed);
+
+  char * end = NULL;
+  long long id = 0;
+  if(!parse_ndjson_record(record, &parsed) || !parsed.feel || !parsed.dtm || !parsed.id
+      || (id = strtoll(parsed.id, &end, 10)) <= 0 || *end) {
+    fprintf(stderr, "Feel %li: malformed record, skipped.\n", number);
+    stats->skipped++;
+    return 1;
+  }
+
+  int feel_id = -1;
+  if(!adapter->get_feel_id(adapter, parsed.feel, &feel_id)) {
+    if(!adapter->create_feel(adapter, parsed.feel, parsed.description) || !adapter->get_feel_id(adapter, parsed.feel, &feel_id)) {
+      fprintf(stderr, "Feel %li: unable to create emotion '%s'.\n", number, parsed.feel);
+      return 0;
+    }
+    stats->statuses++;
+  }
+
+  if(!adapter->restore_feel(adapter, (int64_t)id, feel_id, parsed.dtm)) {
+    fprintf(stderr, "Feel %li: failed to restore feel %lli, skipped.\n", number, id);
+    stats->skipped++;
+    return 1;
+  }
+
+  stats->feels++;
+
+  return 1;
+}
+
+/* Reads the document export-json writes, { "feels": [ {...}, ... ] }, one
+ * feel at a time, so memory stays flat however large the dump is. */
+static int import_document(importer_data * data, FILE * in, import_stats * stats) {
+  storage_interface const * adapter = data->adapter;
+
+  json_stream * stream = malloc(sizeof * stream);
+  char * record = malloc(HIF_IMPORT_JSON_MAX_RECORD);
+  if(!stream || !record) abort();
+  stream->in = in;
+  stream->len = stream->pos = 0;
+
+  long number = 0;
+  int pending = 0;
+
+  if(!adapter->begin_transaction(adapter)) goto err2;
+  if(stream_skip_ws(stream) != '{') goto err0;
+  stream_next(stream);
+
+  while(stream_skip_ws(stream) != '}') {
+    char * key = NULL;
+    if(stream_read_value(stream, record, HIF_IMPORT_JSON_MAX_RECORD) < 0 || *record != '"' || !parse_json_string(record, &key)) goto err0;
+    if(stream_skip_ws(stream) != ':') goto err0;
+    stream_next(stream);
+
+    if(strcmp(key, "feels") != 0) {
+      if(stream_read_value(stream, NULL, 0) < 0) goto err0;
+    } else {
+      if(stream_skip_ws(stream) != '[') goto err0;
+      stream_next(stream);
+
+      while(stream_skip_ws(stream) != ']') {
+        ++number;
+        if(stream_skip_ws(stream) != '{') goto err0;
+        if(stream_read_value(stream, record, HIF_IMPORT_JSON_MAX_RECORD) < 0) {
+          fprintf(stderr, "Feel %li: malformed or larger than %i bytes.\n", number, HIF_IMPORT_JSON_MAX_RECORD);
+          goto err1;
+        }
+        if(!import_document_feel(data, record, number, stats)) goto err1;
+
+        if(++pending >= data->batch_size) {
+          if(!adapter->flush_imports(adapter, &stats->existing)) goto err1;
+          if(!adapter->commit_transaction(adapter)) goto err1;
+          if(!adapter->begin_transaction(adapter)) goto err2;
+          pending = 0;
+        }
+
+        if(stream_skip_ws(stream) == ',') stream_next(stream);
+        else if(stream_peek(stream) != ']') goto err0;
+      }
+      stream_next(stream);
+    }
+
+    if(stream_skip_ws(stream) == ',') stream_next(stream);
+    else if(stream_peek(stream) != '}') goto err0;
+  }
+
+  if(!adapter->flush_imports(adapter, &stats->existing) || !adapter->commit_transaction(adapter)) goto err1;
+  stats->feels -= stats->existing;
+
+  free(record), record = NULL;
+  free(stream), stream = NULL;
+  return 1;
+
+err0:
+  fprintf(stderr, "Not an export-json document; stopped after %li feels.\n", number);
+err1:
+  adapter->rollback_transaction(adapter);
+err2:
+  free(record), record = NULL;
+  free(stream), stream = NULL;
+  return 0;
+}
+
+static int import(importer_interface const * imp, FILE * in, import_format format, import_stats * stats) {
+  importer_data * data = ((importer *)imp)->data;
+  storage_interface const * adapter = data->adapter;
+
+  memset(stats, 0, sizeof * stats);
+  if(format == IMPORT_FORMAT_JSON) return import_document(data, in, stats);
+
+  char * line = NULL;
+  size_t capacity = 0;
+  long line_number = 0;
+  int pending = 0;
+  bool first = true;
+
+  if(!adapter->begin_transaction(adapter)) return 0;
+
+  ssize_t len;
+  while((len = read_record(in, &line, &capacity, format, &line_number)) >= 0) {
+    trim_line_ending(line, &len);
+
+    char * p = skip_ws(line);
+    if(!*p) continue;
+
+    if(format == IMPORT_FORMAT_AUTO) {
+      format = *p == '{' ? IMPORT_FORMAT_NDJSON : IMPORT_FORMAT_CSV;
+      if(format == IMPORT_FORMAT_CSV && has_open_quote(line)) {
+        fprintf(stderr, "Line %li: unterminated quoted field, skipped.\n", line_number);
+        stats->skipped++;
+        continue;
+      }
+    }
+
+    import_record record;
+    memset(&record, 0, sizeof record);
+
+    int parsed = format == IMPORT_FORMAT_NDJSON
+      ? parse_ndjson_record(p, &record)
+      : parse_csv_record(p, &record);
+
+    if(first && format == IMPORT_FORMAT_CSV && parsed && strcasecmp(record.feel, "feel") == 0) {
+      first = false;
+      continue;
+    }
+    first = false;
+
+    if(!parsed || !record.feel) {
+      fprintf(stderr, "Line %li: malformed record, skipped.\n", line_number);
+      stats->skipped++;
+      continue;
+    }
+
+    /* The adapter's status cache makes this a hash lookup */
+    int feel_id = -1;
+    if(!adapter->get_feel_id(adapter, record.feel, &feel_id)) {
+      fprintf(stderr, "Line %li: unknown feel '%s', skipped.\n", line_number, record.feel);
+      stats->skipped++;
+      continue;
+    }
+
+    if(!adapter->import_feel(adapter, feel_id, record.dtm, record.memo)) {
+      fprintf(stderr, "Line %li: failed to import feel '%s', skipped.\n", line_number, record.feel);
+      stats->skipped++;
+      continue;
+    }
+
+    stats->feels++;
+    if(record.memo && *record.memo) stats->memos++;
+
+    if(++pending >= data->batch_size) {
+      if(!adapter->flush_imports(adapter, NULL)) goto err0;
+      if(!adapter->commit_transaction(adapter)) goto err0;
+      if(!adapter->begin_transaction(adapter)) goto err1;
+      pending = 0;
+    }
+  }
+
+  free(line), line = NULL;
+  if(!adapter->flush_imports(adapter, NULL)) goto err0;
+  return adapter->commit_transaction(adapter);
+
+err0:
+  adapter->rollback_transaction(adapter);
+err1:
+  free(line), line = NULL;
+  return 0;
+}
@@ -0,0 +1,252 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_escape.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HIF_JSON_ESCAPE_X86 1
+#include <immintrin.h>
+#endif
+
+typedef size_t (*escape_fn)(char * dest, unsigned char const * source, size_t source_len);
+
+/* The character following the backslash, 'u' for \u00XX, or 0 when the byte
+ * is copied as is. */
+static char const ESCAPES[256] = {
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+  ['"'] = '"',
+  ['\\'] = '\\'
+};
+
+static char * escape_byte(char * d, unsigned char c) {
+  static char const HEX[] = "0123456789abcdef";
+
+  *d++ = '\\';
+  if(ESCAPES[c] != 'u') {
+    *d++ = ESCAPES[c];
+    return d;
+  }
+
+  *d++ = 'u'; *d++ = '0'; *d++ = '0';
+  *d++ = HEX[c >> 4]; *d++ = HEX[c & 0xf];
+
+  return d;
+}
+
+static size_t escape_growth(unsigned char c) {
+  if(!ESCAPES[c]) return 0;
+  return ESCAPES[c] == 'u' ? HIF_JSON_ESCAPE_MAX_GROWTH - 1 : 1;
+}
+
+static size_t escape_scalar(char * dest, unsigned char const * source, size_t source_len) {
+  char * d = dest;
+  unsigned char const * end = source + source_len;
+
+  for(unsigned char const * s = source; s < end; ++s) {
+    if(ESCAPES[*s]) d = escape_byte(d, *s);
+    else *d++ = (char)*s;
+  }
+
+  return (size_t)(d - dest);
+}
+
+/* Copies the clean bytes of a block around the escapes flagged in mask;
+ * dense blocks are cheaper to walk byte by byte than run by run. */
+static char * escape_block(char * d, unsigned char const * s, size_t block_len, unsigned mask) {
+  if(__builtin_popcount(mask) > 3) return d + escape_scalar(d, s, block_len);
+
+  size_t pos = 0;
+  while(mask) {
+    size_t k = (size_t)__builtin_ctz(mask);
+    memcpy(d, s + pos, k - pos);
+    d += k - pos;
+    d = escape_byte(d, s[k]);
+    pos = k + 1;
+    mask &= mask - 1;
+  }
+  memcpy(d, s + pos, block_len - pos);
+
+  return d + (block_len - pos);
+}
+
+#ifdef HIF_JSON_ESCAPE_X86
+
+/* A byte needs escaping when it is '"', '\\' or below 0x20; the unsigned
+ * max trick avoids the signed-only byte comparisons. */
+__attribute__((target("sse2")))
+static unsigned special_mask_sse2(__m128i chunk) {
+  __m128i const quote = _mm_set1_epi8('"');
+  __m128i const backslash = _mm_set1_epi8('\\');
+  __m128i const control = _mm_set1_epi8(0x1f);
+
+  __m128i special = _mm_or_si128(
+    _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)),
+    _mm_cmpeq_epi8(_mm_max_epu8(chunk, control), control));
+
+  return (unsigned)_mm_movemask_epi8(special);
+}
+
+__attribute__((target("sse2")))
+static size_t escape_sse2(char * dest, unsigned char const * source, size_t source_len) {
+  char * d = dest;
+  unsigned char const * s = source;
+  unsigned char const * end = source + source_len;
+
+  while(end - s >= 16) {
+    __m128i chunk = _mm_loadu_si128((__m128i const *)s);
+    unsigned mask = special_mask_sse2(chunk);
+    if(!mask) {
+      _mm_storeu_si128((__m128i *)d, chunk);
+      d += 16;
+    } else {
+      d = escape_block(d, s, 16, mask);
+    }
+    s += 16;
+  }
+
+  return (size_t)(d - dest) + escape_scalar(d, s, (size_t)(end - s));
+}
+
+__attribute__((target("avx2")))
+static unsigned special_mask_avx2(__m256i chunk) {
+  __m256i const quote = _mm256_set1_epi8('"');
+  __m256i const backslash = _mm256_set1_epi8('\\');
+  __m256i const control = _mm256_set1_epi8(0x1f);
+
+  __m256i special = _mm256_or_si256(
+    _mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote), _mm256_cmpeq_epi8(chunk, backslash)),
+    _mm256_cmpeq_epi8(_mm256_max_epu8(chunk, control), control));
+
+  return (unsigned)_mm256_movemask_epi8(special);
+}
+
+__attribute__((target("avx2")))
+static size_t escape_avx2(char * dest, unsigned char const * source, size_t source_len) {
+  char * d = dest;
+  unsigned char const * s = source;
+  unsigned char const * end = source + source_len;
+
+  while(end - s >= 32) {
+    __m256i chunk = _mm256_loadu_si256((__m256i const *)s);
+    unsigned mask = special_mask_avx2(chunk);
+    if(!mask) {
+      _mm256_storeu_si256((__m256i *)d, chunk);
+      d += 32;
+    } else {
+      d = escape_block(d, s, 32, mask);
+    }
+    s += 32;
+  }
+
+  return (size_t)(d - dest) + escape_sse2(d, s, (size_t)(end - s));
+}
+
+__attribute__((target("sse2")))
+static size_t escaped_length_sse2(unsigned char const * source, size_t source_len) {
+  size_t len = source_len;
+  unsigned char const * s = source;
+  unsigned char const * end = source + source_len;
+
+  while(end - s >= 16) {
+    unsigned mask = special_mask_sse2(_mm_loadu_si128((__m128i const *)s));
+    while(mask) {
+      len += escape_growth(s[__builtin_ctz(mask)]);
+      mask &= mask - 1;
+    }
+    s += 16;
+  }
+
+  for(; s < end; ++s) len += escape_growth(*s);
+
+  return len;
+}
+
+#endif /* HIF_JSON_ESCAPE_X86 */
+
+int json_escape_kernel_supported(json_escape_kernel kernel) {
+  switch(kernel) {
+    case JSON_ESCAPE_KERNEL_SCALAR:
+      return 1;
+#ifdef HIF_JSON_ESCAPE_X86
+    case JSON_ESCAPE_KERNEL_SSE2:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("sse2");
+    case JSON_ESCAPE_KERNEL_AVX2:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2");
+#endif
+    default:
+      return 0;
+  }
+}
+
+char const * json_escape_kernel_name(json_escape_kernel kernel) {
+  static char const * const NAMES[] = { "scalar", "sse2", "avx2" };
+  if(kernel < JSON_ESCAPE_KERNEL_SCALAR || kernel >= JSON_ESCAPE_KERNEL_EOF) return "unknown";
+  return NAMES[kernel];
+}
+
+static escape_fn get_kernel(json_escape_kernel kernel) {
+  switch(kernel) {
+#ifdef HIF_JSON_ESCAPE_X86
+    case JSON_ESCAPE_KERNEL_SSE2: return &escape_sse2;
+    case JSON_ESCAPE_KERNEL_AVX2: return &escape_avx2;
+#endif
+    default: return &escape_scalar;
+  }
+}
+
+size_t json_escape_using(json_escape_kernel kernel, char * dest, unsigned char const * source, size_t source_len) {
+  if(!json_escape_kernel_supported(kernel)) kernel = JSON_ESCAPE_KERNEL_SCALAR;
+  return get_kernel(kernel)(dest, source, source_len);
+}
+
+/* Picks the widest supported kernel on first use; racing threads resolve
+ * the same answer so a relaxed store is enough. */
+static escape_fn resolve_kernel() {
+  static escape_fn resolved = NULL;
+
+  escape_fn fn = __atomic_load_n(&resolved, __ATOMIC_RELAXED);
+  if(fn) return fn;
+
+  json_escape_kernel kernel = JSON_ESCAPE_KERNEL_SCALAR;
+  if(json_escape_kernel_supported(JSON_ESCAPE_KERNEL_AVX2)) kernel = JSON_ESCAPE_KERNEL_AVX2;
+  else if(json_escape_kernel_supported(JSON_ESCAPE_KERNEL_SSE2)) kernel = JSON_ESCAPE_KERNEL_SSE2;
+
+  fn = get_kernel(kernel);
+  __atomic_store_n(&resolved, fn, __ATOMIC_RELAXED);
+
+  return fn;
+}
+
+/* dest must hold json_escaped_length(source, source_len) bytes */
+size_t json_escape(char * dest, unsigned char const * source, size_t source_len) {
+  return resolve_kernel()(dest, source, source_len);
+}
+
+size_t json_escaped_length(unsigned char const * source, size_t source_len) {
+#ifdef HIF_JSON_ESCAPE_X86
+  if(resolve_kernel() != &escape_scalar) return escaped_length_sse2(source, source_len);
+#endif
+
+  size_t len = source_len;
+  for(unsigned char const * s = source; s < source + source_len; ++s) len += escape_growth(*s);
+
+  return len;
+}
+
+char * alloc_json_escape_string(unsigned char const * source) {
+  if(!source) return NULL;
+
+  size_t source_len = strlen((char const *)source);
+  size_t len = json_escaped_length(source, source_len);
+
+  char * dest = malloc(len + 1);
+  if(!dest) return NULL;
+
+  size_t written = json_escape(dest, source, source_len);
+  dest[written] = 0;
+
+  return dest;
+}
@@ -5,6 +5,8 @@
 
 static int delete_memo(memo_repository_interface const * repository, int id, int * affected_rows);
 static int insert_memo(memo_repository_interface const * repository, char const * memo, int * affected_rows);
+static int64_t count_memos(memo_repository_interface const * repository, time_range const * range);
+static int search_memos(memo_repository_interface const * repository, char const * query, time_range const * range, int limit, memo_handler handler, void * context);
 
 struct memo_repository_data;
 
@@ -32,6 +34,8 @@ memo_repository_interface const * memo_repository_init(memo_repository_interface
 
   repository->insert_memo = &insert_memo;  
   repository->delete_memo = &delete_memo;
+  repository->count_memos = &count_memos;
+  repository->search_memos = &search_memos;
   repository->free = &memo_repository_free;
 
   return repository;
@@ -56,3 +60,12 @@ static int delete_memo(memo_repository_interface const * repository, int id, int
   return adapter->delete_by_id(adapter, "hif_memos", id, affected_rows);
 }
 
+static int64_t count_memos(memo_repository_interface const * repository, time_range const * range) {
+  storage_interface const * adapter = ((memo_repository *)repository)->data->adapter;
+  return adapter->count_memos(adapter, range);
+}
+
+static int search_memos(memo_repository_interface const * repository, char const * query, time_range const * range, int limit, memo_handler handler, void * context) {
+  storage_interface const * adapter = ((memo_repository *)repository)->data->adapter;
+  return adapter->search_memos(adapter, query, range, limit, handler, context);
+}
@@ -0,0 +1,269 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "environment.h"
+#include "metrics.h"
+
+#define HIF_METRICS_SUB_BUCKETS 4
+
+/* Prometheus buckets are every other power of two microseconds, 64us to 67s */
+#define HIF_METRICS_EXPORT_FIRST_POWER 6
+#define HIF_METRICS_EXPORT_LAST_POWER 26
+
+static double const QUANTILES[] = { 0.5, 0.9, 0.99 };
+static char const * const QUANTILE_LABELS[] = { "0.5", "0.9", "0.99" };
+
+_Static_assert(sizeof(QUANTILES) / sizeof(*QUANTILES) == sizeof(QUANTILE_LABELS) / sizeof(*QUANTILE_LABELS), "QUANTILE_LABELS must match QUANTILES");
+
+static int64_t rows_read = 0;
+static int64_t rows_written = 0;
+
+/* Contexts are read on threads of their own, so tallies are atomic too */
+void metrics_count_rows_read(int64_t rows) {
+  __atomic_fetch_add(&rows_read, rows, __ATOMIC_RELAXED);
+}
+
+void metrics_count_rows_written(int64_t rows) {
+  __atomic_fetch_add(&rows_written, rows, __ATOMIC_RELAXED);
+}
+
+/* Values below 4 get a bucket each; past that a power of two is split in four */
+size_t metrics_bucket(uint64_t us) {
+  if(us < HIF_METRICS_SUB_BUCKETS) return (size_t)us;
+
+  int power = 63 - __builtin_clzll(us);
+  size_t sub = (size_t)(us >> (power - 2)) & (HIF_METRICS_SUB_BUCKETS - 1);
+  size_t bucket = (size_t)(power - 1) * HIF_METRICS_SUB_BUCKETS + sub;
+
+  return bucket < HIF_METRICS_BUCKETS ? bucket : HIF_METRICS_BUCKETS - 1;
+}
+
+uint64_t metrics_bucket_limit(size_t bucket) {
+  if(bucket >= HIF_METRICS_BUCKETS - 1) return UINT64_MAX;
+  if(bucket < HIF_METRICS_SUB_BUCKETS) return (uint64_t)bucket + 1;
+
+  int power = (int)(bucket / HIF_METRICS_SUB_BUCKETS) + 1;
+  uint64_t sub = bucket % HIF_METRICS_SUB_BUCKETS;
+
+  return (HIF_METRICS_SUB_BUCKETS + 1 + sub) << (power - 2);
+}
+
+static int is_compatible(metrics_file const * file) {
+  return memcmp(file->magic, HIF_METRICS_MAGIC, sizeof file->magic) == 0
+    && file->version == HIF_METRICS_VERSION
+    && file->slot_count == HIF_METRICS_SLOTS
+    && file->bucket_count == HIF_METRICS_BUCKETS;
+}
+
+/* A new file is all zeroes; racing writers stamp the same header */
+static metrics_file * map_metrics(int writable) {
+  char * path = alloc_concat_path(get_config_path(), HIF_METRICS_FILE);
+  int fd = open(path, (writable ? O_RDWR | O_CREAT : O_RDONLY) | O_CLOEXEC, 0600);
+  free(path), path = NULL;
+  if(fd < 0) return NULL;
+
+  metrics_file * file = NULL;
+  struct stat st;
+  if(fstat(fd, &st) != 0) goto err0;
+  if((size_t)st.st_size < sizeof * file) {
+    if(!writable || ftruncate(fd, (off_t)sizeof * file) != 0) goto err0;
+  }
+
+  file = mmap(NULL, sizeof * file, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+  if(file == MAP_FAILED) {
+    file = NULL;
+    goto err0;
+  }
+
+  if(writable && file->magic[0] == '\0') {
+    file->version = HIF_METRICS_VERSION;
+    file->slot_count = HIF_METRICS_SLOTS;
+    file->bucket_count = HIF_METRICS_BUCKETS;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(file->magic, HIF_METRICS_MAGIC, sizeof file->magic);
+  }
+
+  if(!is_compatible(file)) {
+    munmap(file, sizeof * file), file = NULL;
+  }
+
+err0:
+  close(fd);
+  return file;
+}
+
+/* Two runs claiming a slot for the same command at once may each take one;
+ * readers merge slots by name. */
+static metrics_slot * find_slot(metrics_file * file, char const * command) {
+  for(size_t i = 0; i < HIF_METRICS_SLOTS; i++) {
+    metrics_slot * slot = &file->slots[i];
+
+    uint32_t state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+    if(state == 0 && __atomic_compare_exchange_n(&slot->state, &state, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      strncpy(slot->command, command, HIF_METRICS_COMMAND_LEN - 1);
+      __atomic_store_n(&slot->state, 2, __ATOMIC_RELEASE);
+      return slot;
+    }
+    if(state == 2 && strncmp(slot->command, command, HIF_METRICS_COMMAND_LEN - 1) == 0) return slot;
+  }
+
+  return NULL;
+}
+
+int metrics_record(char const * command, uint64_t us, int failed) {
+  metrics_file * file = map_metrics(1);
+  if(!file) return 0;
+
+  metrics_slot * slot = find_slot(file, command);
+  if(slot) {
+    __atomic_fetch_add(&slot->buckets[metrics_bucket(us)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&slot->sum_us, us, __ATOMIC_RELAXED);
+    if(failed) __atomic_fetch_add(&slot->errors, 1, __ATOMIC_RELAXED);
+    if(rows_read > 0) __atomic_fetch_add(&slot->rows_read, (uint64_t)rows_read, __ATOMIC_RELAXED);
+    if(rows_written > 0) __atomic_fetch_add(&slot->rows_written, (uint64_t)rows_written, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&slot->max_us, __ATOMIC_RELAXED);
+    while(us > max && !__atomic_compare_exchange_n(&slot->max_us, &max, us, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  }
+  rows_read = rows_written = 0;
+
+  munmap(file, sizeof * file);
+
+  return slot != NULL;
+}
+
+typedef struct metrics_totals {
+  char command[HIF_METRICS_COMMAND_LEN];
+  uint64_t count;
+  uint64_t errors;
+  uint64_t sum_us;
+  uint64_t max_us;
+  uint64_t rows_read;
+  uint64_t rows_written;
+  uint64_t buckets[HIF_METRICS_BUCKETS];
+} metrics_totals;
+
+static size_t merge_slots(metrics_file const * file, metrics_totals * totals) {
+  size_t count = 0;
+
+  for(size_t i = 0; i < HIF_METRICS_SLOTS; i++) {
+    metrics_slot const * slot = &file->slots[i];
+    if(__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != 2) continue;
+
+    metrics_totals * total = NULL;
+    for(size_t j = 0; j < count && !total; j++) {
+      if(strncmp(totals[j].command, slot->command, HIF_METRICS_COMMAND_LEN - 1) == 0) total = &totals[j];
+    }
+    if(!total) {
+      total = &totals[count++];
+      strncpy(total->command, slot->command, HIF_METRICS_COMMAND_LEN - 1);
+    }
+
+    /* The count is the sum of the buckets, so a histogram always adds up */
+    for(size_t b = 0; b < HIF_METRICS_BUCKETS; b++) {
+      uint64_t n = __atomic_load_n(&slot->buckets[b], __ATOMIC_RELAXED);
+      total->buckets[b] += n;
+      total->count += n;
+    }
+    total->errors += __atomic_load_n(&slot->errors, __ATOMIC_RELAXED);
+    total->sum_us += __atomic_load_n(&slot->sum_us, __ATOMIC_RELAXED);
+    total->rows_read += __atomic_load_n(&slot->rows_read, __ATOMIC_RELAXED);
+    total->rows_written += __atomic_load_n(&slot->rows_written, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&slot->max_us, __ATOMIC_RELAXED);
+    if(max > total->max_us) total->max_us = max;
+  }
+
+  return count;
+}
+
+/* Reports the top of the bucket holding the quantile, an overestimate of at most 25% */
+static uint64_t quantile_us(metrics_totals const * total, double quantile) {
+  uint64_t rank = (uint64_t)(quantile * (double)total->count + 0.999999);
+  if(rank < 1) rank = 1;
+
+  uint64_t seen = 0;
+  for(size_t b = 0; b < HIF_METRICS_BUCKETS; b++) {
+    seen += total->buckets[b];
+    if(seen >= rank) {
+      uint64_t limit = metrics_bucket_limit(b);
+      return limit < total->max_us ? limit : total->max_us;
+    }
+  }
+
+  return total->max_us;
+}
+
+static double seconds(uint64_t us) {
+  return (double)us / 1e6;
+}
+
+int metrics_write_prometheus(FILE * out) {
+  metrics_totals * totals = calloc(HIF_METRICS_SLOTS, sizeof * totals);
+  if(!totals) abort();
+
+  size_t count = 0;
+  metrics_file * file = map_metrics(0);
+  if(file) {
+    count = merge_slots(file, totals);
+    munmap(file, sizeof * file), file = NULL;
+  }
+
+  fprintf(out, "# HELP hif_command_duration_seconds Wall time of hif commands, from start to exit.\n");
+  fprintf(out, "# TYPE hif_command_duration_seconds histogram\n");
+  for(size_t i = 0; i < count; i++) {
+    metrics_totals const * total = &totals[i];
+
+    uint64_t cumulative = 0;
+    size_t b = 0;
+    for(int power = HIF_METRICS_EXPORT_FIRST_POWER; power <= HIF_METRICS_EXPORT_LAST_POWER; power += 2) {
+      uint64_t le = (uint64_t)1 << power;
+      for(; b < HIF_METRICS_BUCKETS && metrics_bucket_limit(b) <= le; b++) cumulative += total->buckets[b];
+      fprintf(out, "hif_command_duration_seconds_bucket{command=\"%s\",le=\"%g\"} %llu\n", total->command, seconds(le), (unsigned long long)cumulative);
+    }
+    fprintf(out, "hif_command_duration_seconds_bucket{command=\"%s\",le=\"+Inf\"} %llu\n", total->command, (unsigned long long)total->count);
+    fprintf(out, "hif_command_duration_seconds_sum{command=\"%s\"} %.6f\n", total->command, seconds(total->sum_us));
+    fprintf(out, "hif_command_duration_seconds_count{command=\"%s\"} %llu\n", total->command, (unsigned long long)total->count);
+  }
+
+  fprintf(out, "# HELP hif_command_duration_quantile_seconds Latency quantiles of hif commands, within 25%%.\n");
+  fprintf(out, "# TYPE hif_command_duration_quantile_seconds gauge\n");
+  for(size_t i = 0; i < count; i++) {
+    if(!totals[i].count) continue;
+    for(size_t q = 0; q < sizeof(QUANTILES) / sizeof(*QUANTILES); q++) {
+      fprintf(out, "hif_command_duration_quantile_seconds{command=\"%s\",quantile=\"%s\"} %.6f\n", totals[i].command, QUANTILE_LABELS[q], seconds(quantile_us(&totals[i], QUANTILES[q])));
+    }
+  }
+
+  fprintf(out, "# HELP hif_command_duration_max_seconds Slowest run of each hif command.\n");
+  fprintf(out, "# TYPE hif_command_duration_max_seconds gauge\n");
+  for(size_t i = 0; i < count; i++) {
+    fprintf(out, "hif_command_duration_max_seconds{command=\"%s\"} %.6f\n", totals[i].command, seconds(totals[i].max_us));
+  }
+
+  fprintf(out, "# HELP hif_command_errors_total Runs of each hif command that failed.\n");
+  fprintf(out, "# TYPE hif_command_errors_total counter\n");
+  for(size_t i = 0; i < count; i++) {
+    fprintf(out, "hif_command_errors_total{command=\"%s\"} %llu\n", totals[i].command, (unsigned long long)totals[i].errors);
+  }
+
+  fprintf(out, "# HELP hif_command_rows_read_total Rows exported or matched by each hif command.\n");
+  fprintf(out, "# TYPE hif_command_rows_read_total counter\n");
+  for(size_t i = 0; i < count; i++) {
+    fprintf(out, "hif_command_rows_read_total{command=\"%s\"} %llu\n", totals[i].command, (unsigned long long)totals[i].rows_read);
+  }
+
+  fprintf(out, "# HELP hif_command_rows_written_total Rows inserted, updated or deleted by each hif command, trigger upkeep included.\n");
+  fprintf(out, "# TYPE hif_command_rows_written_total counter\n");
+  for(size_t i = 0; i < count; i++) {
+    fprintf(out, "hif_command_rows_written_total{command=\"%s\"} %llu\n", totals[i].command, (unsigned long long)totals[i].rows_written);
+  }
+
+  free(totals), totals = NULL;
+
+  return !ferror(out);
+}
@@ -0,0 +1,92 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "output_buffer.h"
+
+void output_buffer_init(output_buffer * buffer, int fd, size_t capacity) {
+  memset(buffer, 0, sizeof * buffer);
+
+  buffer->fd = fd;
+  buffer->capacity = capacity ? capacity : HIF_OUTPUT_BUFFER_SIZE;
+  buffer->data = malloc(buffer->capacity);
+  if(!buffer->data) abort();
+}
+
+void output_buffer_free(output_buffer * buffer) {
+  if(!buffer) return;
+
+  free(buffer->data), buffer->data = NULL;
+  buffer->len = buffer->capacity = 0;
+}
+
+static void write_all(output_buffer * buffer, char const * p, size_t remaining) {
+  while(remaining > 0 && !buffer->failed) {
+    ssize_t written = write(buffer->fd, p, remaining);
+    if(written < 0) {
+      if(errno == EINTR) continue;
+      buffer->failed = 1;
+      break;
+    }
+    p += written;
+    remaining -= (size_t)written;
+  }
+}
+
+int output_buffer_flush(output_buffer * buffer) {
+  if(buffer->handoff) {
+    if(buffer->len && !buffer->failed) {
+      char * data = buffer->handoff(buffer->consumer, buffer->data, buffer->len, &buffer->capacity);
+      if(data) {
+        buffer->data = data;
+      } else {
+        buffer->failed = 1;
+      }
+    }
+    buffer->len = 0;
+
+    return !buffer->failed;
+  }
+  if(buffer->fd < 0) return !buffer->failed;
+
+  write_all(buffer, buffer->data, buffer->len);
+  buffer->len = 0;
+
+  return !buffer->failed;
+}
+
+/* Returns room for at least len bytes at the end of the buffer; callers
+ * advance buffer->len by however much they actually used. */
+char * output_buffer_reserve(output_buffer * buffer, size_t len) {
+  if(buffer->len + len <= buffer->capacity) return buffer->data + buffer->len;
+
+  if(buffer->fd >= 0 || buffer->handoff) {
+    output_buffer_flush(buffer);
+    if(len <= buffer->capacity) return buffer->data;
+  }
+
+  size_t capacity = buffer->capacity;
+  while(capacity < buffer->len + len) capacity *= 2;
+
+  char * data = realloc(buffer->data, capacity);
+  if(!data) abort();
+
+  buffer->data = data;
+  buffer->capacity = capacity;
+
+  return buffer->data + buffer->len;
+}
+
+void output_buffer_write(output_buffer * buffer, void const * data, size_t len) {
+  /* Anything at least a buffer long goes straight to the descriptor */
+  if(buffer->fd >= 0 && !buffer->handoff && len >= buffer->capacity) {
+    output_buffer_flush(buffer);
+    write_all(buffer, data, len);
+    return;
+  }
+
+  char * d = output_buffer_reserve(buffer, len);
+  memcpy(d, data, len);
+  buffer->len += len;
+}
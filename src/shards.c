@@ -0,0 +1,195 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sqlite3.h>
+
+#include "environment.h"
+#include "shards.h"
+
+#define HIF_SHARD_COMPACT_SUFFIX ".compact"
+
+int shard_month_of(int64_t microseconds) {
+  int64_t seconds = microseconds / 1000000 - (microseconds % 1000000 < 0);
+  time_t t = (time_t)seconds;
+
+  struct tm tm;
+  if(!gmtime_r(&t, &tm)) return 0;
+
+  return (tm.tm_year + 1900) * 100 + tm.tm_mon + 1;
+}
+
+int shard_month_from_name(char const * name) {
+  if(!name || strlen(name) != HIF_SHARD_NAME_SIZE - 1 || name[4] != '-') return 0;
+
+  for(int i = 0; i < (int)HIF_SHARD_NAME_SIZE - 1; i++) {
+    if(i != 4 && !isdigit((unsigned char)name[i])) return 0;
+  }
+
+  int year = atoi(name), month = atoi(name + 5);
+  if(month < 1 || month > 12) return 0;
+
+  return year * 100 + month;
+}
+
+void shard_month_name(int month, char name[HIF_SHARD_NAME_SIZE]) {
+  snprintf(name, HIF_SHARD_NAME_SIZE, "%04u-%02u", (unsigned)(month / 100) % 10000, (unsigned)month % 100);
+}
+
+static int64_t month_start(int year, int month) {
+  struct tm tm;
+  memset(&tm, 0, sizeof tm);
+  tm.tm_year = year - 1900 + (month - 1) / 12;
+  tm.tm_mon = (month - 1) % 12;
+  tm.tm_mday = 1;
+
+  return (int64_t)timegm(&tm) * 1000000;
+}
+
+time_range shard_month_range(int month) {
+  time_range range = { month_start(month / 100, month % 100), month_start(month / 100, month % 100 + 1) };
+  return range;
+}
+
+char * alloc_shard_file_name(char const * context_name, int month) {
+  char name[HIF_SHARD_NAME_SIZE];
+  shard_month_name(month, name);
+
+  char * file_name = NULL;
+  if(asprintf(&file_name, "%s" HIF_SHARD_DIRECTORY_SUFFIX "/%s.db", context_name, name) < 0) abort();
+  return file_name;
+}
+
+static char * alloc_shard_path(char const * context_name, int month) {
+  char * file_name = alloc_shard_file_name(context_name, month);
+  char * path = alloc_concat_path(get_config_path(), file_name);
+  free(file_name), file_name = NULL;
+
+  return path;
+}
+
+/* Everything but unreserved characters and separators is percent-encoded,
+ * so '?', '#' and '%' in a home directory cannot end the path early. */
+char * alloc_shard_uri(char const * context_name, int month, char const * mode) {
+  char * path = alloc_shard_path(context_name, month);
+
+  if(strcmp(mode, "rwc") == 0) {
+    char * directory = NULL;
+    if(asprintf(&directory, "%s/%s" HIF_SHARD_DIRECTORY_SUFFIX, get_config_path(), context_name) < 0) abort();
+    mkdir(directory, 0700);
+    free(directory), directory = NULL;
+  }
+
+  size_t len = strlen(path);
+  char * uri = malloc(sizeof("file:") + len * 3 + sizeof("?mode=") + strlen(mode));
+  if(!uri) abort();
+
+  char * p = uri + sprintf(uri, "file:");
+  for(size_t i = 0; i < len; i++) {
+    unsigned char c = (unsigned char)path[i];
+    if(isalnum(c) || strchr("/-._~", c)) {
+      *p++ = (char)c;
+    } else {
+      p += sprintf(p, "%%%02X", c);
+    }
+  }
+  sprintf(p, "?mode=%s", mode);
+
+  free(path), path = NULL;
+
+  return uri;
+}
+
+static void add_name(char *** names, size_t * count, size_t * capacity, char * name) {
+  if(*count == *capacity) {
+    *capacity *= 2;
+    *names = realloc(*names, *capacity * sizeof ** names);
+    if(!*names) abort();
+  }
+  (*names)[(*count)++] = name;
+}
+
+/* Contexts from before partitioning have no hif_shards table and simply
+ * contribute themselves. */
+char ** alloc_partition_names(char * const * contexts, size_t count, time_range const * range, int64_t first_id, size_t * partition_count) {
+  size_t capacity = count + 8;
+  char ** names = calloc(capacity, sizeof * names);
+  if(!names) abort();
+  *partition_count = 0;
+
+  char const * config_path = get_config_path();
+  for(size_t i = 0; i < count; i++) {
+    char * name = strdup(contexts[i]);
+    if(!name) abort();
+    add_name(&names, partition_count, &capacity, name);
+
+    char * path = alloc_concat_path(config_path, contexts[i]);
+    sqlite3 * db = NULL;
+    sqlite3_stmt * stmt = NULL;
+    if(sqlite3_open_v2(path, &db, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK
+      && sqlite3_prepare_v2(db, "select month from hif_shards where since < ?2 and until > ?1 and feels > 0 and last_feel_id >= ?3 order by month;", -1, &stmt, NULL) == SQLITE_OK
+      && sqlite3_bind_int64(stmt, 1, range ? range->since : HIF_TIME_MIN) == SQLITE_OK
+      && sqlite3_bind_int64(stmt, 2, range ? range->until : HIF_TIME_MAX) == SQLITE_OK
+      && sqlite3_bind_int64(stmt, 3, first_id) == SQLITE_OK) {
+      while(sqlite3_step(stmt) == SQLITE_ROW) {
+        add_name(&names, partition_count, &capacity, alloc_shard_file_name(contexts[i], sqlite3_column_int(stmt, 0)));
+      }
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    free(path), path = NULL;
+  }
+
+  return names;
+}
+
+static int exec_on_shard(char const * path, int flags, char const * sql) {
+  sqlite3 * db = NULL;
+  char * err_msg = NULL;
+
+  int rc = sqlite3_open_v2(path, &db, flags, NULL);
+  if(rc == SQLITE_OK) rc = sqlite3_exec(db, sql, NULL, 0, &err_msg);
+  if(rc != SQLITE_OK) {
+    fprintf(stderr, "Failed to execute '%s' on %s: %s\n", sql, path, err_msg ? err_msg : sqlite3_errstr(rc));
+    sqlite3_free(err_msg), err_msg = NULL;
+  }
+  sqlite3_close(db);
+
+  return rc == SQLITE_OK;
+}
+
+/* A read-only file cannot have a WAL opened on it, so the journal goes
+ * back to delete mode, checkpointing any WAL, before permissions drop. */
+int seal_shard_file(char const * context_name, int month) {
+  char * path = alloc_shard_path(context_name, month);
+
+  int ok = exec_on_shard(path, SQLITE_OPEN_READWRITE, "pragma journal_mode = delete;")
+    && chmod(path, 0444) == 0;
+
+  free(path), path = NULL;
+
+  return ok;
+}
+
+int compact_shard_file(char const * context_name, int month) {
+  char * path = alloc_shard_path(context_name, month);
+  char * compact_path = NULL;
+  if(asprintf(&compact_path, "%s" HIF_SHARD_COMPACT_SUFFIX, path) < 0) abort();
+
+  char * sql = sqlite3_mprintf("vacuum into %Q;", compact_path);
+  if(!sql) abort();
+
+  remove(compact_path);
+  int ok = exec_on_shard(path, SQLITE_OPEN_READONLY, sql)
+    && chmod(compact_path, 0444) == 0
+    && rename(compact_path, path) == 0;
+  if(!ok) remove(compact_path);
+
+  sqlite3_free(sql), sql = NULL;
+  free(compact_path), compact_path = NULL;
+  free(path), path = NULL;
+
+  return ok;
+}
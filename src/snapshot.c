@@ -0,0 +1,594 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sqlite3.h>
+
+#include "environment.h"
+#include "contexts.h"
+#include "shards.h"
+#include "snapshot.h"
+
+#define HIF_SNAPSHOT_TEMP_SUFFIX ".tmp"
+#define HIF_MICROSECONDS_PER_DAY INT64_C(86400000000)
+#define HIF_MICROSECONDS_PER_HOUR INT64_C(3600000000)
+
+/* Day counts spanning more cells than this are tallied by sorting instead */
+#define HIF_SNAPSHOT_DENSE_CELLS (1 << 22)
+
+#define HIF_PADDED(len) (((len) + 7) & ~(uint64_t)7)
+
+typedef struct snapshot_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  int64_t last_feel_id;
+  int64_t last_tombstone_id;
+  uint64_t rows;
+  uint64_t size;
+  uint64_t statuses_offset;
+  int64_t feels;
+} snapshot_header;
+
+_Static_assert(sizeof(snapshot_header) == 64, "snapshot_header must match the layout in snapshot.h");
+
+typedef struct snapshot_record {
+  uint32_t kind;
+  uint32_t count;
+  uint64_t payload_size;
+} snapshot_record;
+
+typedef struct snapshot_status {
+  uint32_t id;
+  char * name;
+} snapshot_status;
+
+struct snapshot {
+  char const * data;
+  snapshot_header header;
+  int64_t appended;
+
+  /* In status id order; index maps a status id to its place, or -1 */
+  snapshot_status * statuses;
+  size_t status_count;
+  int32_t * index;
+  size_t index_len;
+};
+
+typedef struct snapshot_writer {
+  int fd;
+  snapshot_header header;
+  int failed;
+
+  uint32_t count;
+  int64_t dtm[HIF_SNAPSHOT_GROUP_ROWS];
+  uint16_t status[HIF_SNAPSHOT_GROUP_ROWS];
+} snapshot_writer;
+
+/* A run of rows from one record */
+typedef struct snapshot_rows_view {
+  int64_t const * dtm;
+  uint16_t const * status;
+  uint32_t count;
+} snapshot_rows_view;
+
+static int64_t floor_div(int64_t value, int64_t divisor) {
+  return value / divisor - (value % divisor < 0);
+}
+
+static char * alloc_snapshot_path(char const * context_name, char const * suffix) {
+  char * path = NULL;
+  if(asprintf(&path, "%s/%s" HIF_SNAPSHOT_SUFFIX "%s", get_config_path(), context_name, suffix) < 0) abort();
+  return path;
+}
+
+static int pwrite_all(int fd, void const * data, size_t len, off_t offset) {
+  char const * p = data;
+  while(len > 0) {
+    ssize_t written = pwrite(fd, p, len, offset);
+    if(written < 0) {
+      if(errno == EINTR) continue;
+      return 0;
+    }
+    p += written;
+    len -= (size_t)written;
+    offset += written;
+  }
+
+  return 1;
+}
+
+static int read_header(int fd, snapshot_header * header) {
+  struct stat st;
+  return pread(fd, header, sizeof * header, 0) == (ssize_t)sizeof * header
+    && memcmp(header->magic, HIF_SNAPSHOT_MAGIC, sizeof header->magic) == 0
+    && header->version == HIF_SNAPSHOT_VERSION
+    && header->size >= sizeof * header
+    && fstat(fd, &st) == 0 && (uint64_t)st.st_size >= header->size;
+}
+
+static void append_bytes(snapshot_writer * writer, void const * data, size_t len) {
+  static char const zeroes[8] = { 0 };
+
+  if(!writer->failed && !pwrite_all(writer->fd, data ? data : zeroes, len, (off_t)writer->header.size)) writer->failed = 1;
+  writer->header.size += len;
+}
+
+static void append_record(snapshot_writer * writer, uint32_t kind, uint32_t count, uint64_t payload_size) {
+  snapshot_record record = { kind, count, payload_size };
+  append_bytes(writer, &record, sizeof record);
+}
+
+static void flush_rows(snapshot_writer * writer) {
+  if(!writer->count) return;
+
+  size_t dtm_size = writer->count * sizeof * writer->dtm;
+  size_t status_size = writer->count * sizeof * writer->status;
+  uint64_t payload_size = HIF_PADDED(dtm_size + status_size);
+
+  append_record(writer, HIF_SNAPSHOT_ROWS, writer->count, payload_size);
+  append_bytes(writer, writer->dtm, dtm_size);
+  append_bytes(writer, writer->status, status_size);
+  append_bytes(writer, NULL, payload_size - dtm_size - status_size);
+
+  writer->header.rows += writer->count;
+  writer->count = 0;
+}
+
+static int append_source_feels(snapshot_writer * writer, sqlite3 * db, int64_t first_id, int64_t last_id) {
+  sqlite3_stmt * stmt = NULL;
+  int rc = sqlite3_prepare_v2(db, "select dtm, feel from hif_feels where feel_id between ?1 and ?2;", -1, &stmt, NULL);
+  if(rc == SQLITE_OK) rc = sqlite3_bind_int64(stmt, 1, first_id);
+  if(rc == SQLITE_OK) rc = sqlite3_bind_int64(stmt, 2, last_id);
+
+  while(rc == SQLITE_OK && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    int64_t status = sqlite3_column_type(stmt, 1) == SQLITE_NULL ? 0 : sqlite3_column_int64(stmt, 1);
+    if(status < 0 || status > UINT16_MAX) {
+      fprintf(stderr, "Emotion %lli has too large an id for a snapshot.\n", (long long)status);
+      rc = SQLITE_RANGE;
+      break;
+    }
+
+    writer->dtm[writer->count] = sqlite3_column_int64(stmt, 0);
+    writer->status[writer->count] = (uint16_t)status;
+    if(++writer->count == HIF_SNAPSHOT_GROUP_ROWS) flush_rows(writer);
+    rc = SQLITE_OK;
+  }
+  sqlite3_finalize(stmt);
+
+  return rc == SQLITE_DONE;
+}
+
+/* The context's own feels come from db, inside its read transaction; each
+ * shard holding newer ids is opened on its own */
+static int append_feels(snapshot_writer * writer, sqlite3 * db, char const * context_name, int64_t first_id, int64_t last_id) {
+  char * name = (char *)context_name;
+  size_t count = 0;
+  char ** partitions = alloc_partition_names(&name, 1, NULL, first_id, &count);
+
+  int ok = append_source_feels(writer, db, first_id, last_id);
+  for(size_t i = 1; ok && i < count; i++) {
+    char * path = alloc_concat_path(get_config_path(), partitions[i]);
+    sqlite3 * shard = NULL;
+    ok = sqlite3_open_v2(path, &shard, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK
+      && append_source_feels(writer, shard, first_id, last_id);
+    sqlite3_close(shard);
+    free(path), path = NULL;
+  }
+  flush_rows(writer);
+
+  free_context_names(partitions, count);
+
+  return ok && !writer->failed;
+}
+
+static char * alloc_statuses_payload(sqlite3 * db, uint32_t * count, uint64_t * payload_size) {
+  sqlite3_stmt * stmt = NULL;
+  if(sqlite3_prepare_v2(db, "select status_id, status from hif_statuses order by status_id;", -1, &stmt, NULL) != SQLITE_OK) return NULL;
+
+  size_t capacity = 1024, len = 0;
+  char * payload = malloc(capacity);
+  if(!payload) abort();
+  *count = 0;
+
+  int rc;
+  while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    uint32_t entry[2] = { (uint32_t)sqlite3_column_int64(stmt, 0), (uint32_t)sqlite3_column_bytes(stmt, 1) };
+    char const * name = (char const *)sqlite3_column_text(stmt, 1);
+
+    while(len + sizeof entry + entry[1] + 8 > capacity) {
+      capacity *= 2;
+      payload = realloc(payload, capacity);
+      if(!payload) abort();
+    }
+    memcpy(payload + len, entry, sizeof entry);
+    memcpy(payload + len + sizeof entry, name ? name : "", entry[1]);
+    len += sizeof entry + entry[1];
+    ++*count;
+  }
+  sqlite3_finalize(stmt);
+  if(rc != SQLITE_DONE) {
+    free(payload), payload = NULL;
+    return NULL;
+  }
+
+  *payload_size = HIF_PADDED(len);
+  memset(payload + len, 0, *payload_size - len);
+
+  return payload;
+}
+
+/* A new statuses record only when the emotions changed */
+static int append_statuses(snapshot_writer * writer, sqlite3 * db) {
+  uint32_t count = 0;
+  uint64_t payload_size = 0;
+  char * payload = alloc_statuses_payload(db, &count, &payload_size);
+  if(!payload) return 0;
+
+  int same = 0;
+  if(writer->header.statuses_offset) {
+    snapshot_record record;
+    char * current = malloc(payload_size ? payload_size : 1);
+    if(!current) abort();
+    same = pread(writer->fd, &record, sizeof record, (off_t)writer->header.statuses_offset) == (ssize_t)sizeof record
+      && record.count == count && record.payload_size == payload_size
+      && pread(writer->fd, current, payload_size, (off_t)(writer->header.statuses_offset + sizeof record)) == (ssize_t)payload_size
+      && memcmp(current, payload, payload_size) == 0;
+    free(current), current = NULL;
+  }
+
+  if(!same) {
+    writer->header.statuses_offset = writer->header.size;
+    append_record(writer, HIF_SNAPSHOT_STATUSES, count, payload_size);
+    append_bytes(writer, payload, payload_size);
+  }
+  free(payload), payload = NULL;
+
+  return !writer->failed;
+}
+
+static int next_record(snapshot const * snap, uint64_t * offset, snapshot_record * record) {
+  if(*offset + sizeof * record > snap->header.size) return 0;
+
+  memcpy(record, snap->data + *offset, sizeof * record);
+  if(record->payload_size > snap->header.size - *offset - sizeof * record) return 0;
+  *offset += sizeof * record;
+
+  return 1;
+}
+
+static int load_statuses(snapshot * snap) {
+  uint64_t offset = snap->header.statuses_offset;
+  snapshot_record record;
+  if(!offset || !next_record(snap, &offset, &record) || record.kind != HIF_SNAPSHOT_STATUSES) return 0;
+
+  snap->statuses = calloc(record.count ? record.count : 1, sizeof * snap->statuses);
+  if(!snap->statuses) abort();
+
+  char const * p = snap->data + offset;
+  char const * end = p + record.payload_size;
+  for(uint32_t i = 0; i < record.count; i++) {
+    uint32_t entry[2];
+    if((size_t)(end - p) < sizeof entry) return 0;
+    memcpy(entry, p, sizeof entry);
+    p += sizeof entry;
+    if((size_t)(end - p) < entry[1]) return 0;
+
+    snapshot_status * status = &snap->statuses[snap->status_count++];
+    status->id = entry[0];
+    status->name = strndup(p, entry[1]);
+    if(!status->name) abort();
+    p += entry[1];
+
+    if(status->id >= snap->index_len) snap->index_len = status->id + 1;
+  }
+
+  snap->index = malloc((snap->index_len ? snap->index_len : 1) * sizeof * snap->index);
+  if(!snap->index) abort();
+  for(size_t i = 0; i < snap->index_len; i++) snap->index[i] = -1;
+  for(size_t i = 0; i < snap->status_count; i++) snap->index[snap->statuses[i].id] = (int32_t)i;
+
+  return 1;
+}
+
+/* Everything below the header's size stays as it is while mapped */
+static snapshot * map_snapshot(int fd, snapshot_header const * header, int64_t appended) {
+  snapshot * result = calloc(1, sizeof * result);
+  if(!result) abort();
+  result->header = *header;
+  result->appended = appended;
+
+  void * data = mmap(NULL, header->size, PROT_READ, MAP_SHARED, fd, 0);
+  if(data == MAP_FAILED) {
+    free(result), result = NULL;
+    return NULL;
+  }
+  result->data = data;
+
+  if(!load_statuses(result)) {
+    snapshot_close(result), result = NULL;
+  }
+
+  return result;
+}
+
+/* The context's feel count, shards included; -1 on failure */
+static int64_t count_context_feels(sqlite3 * db) {
+  sqlite3_stmt * stmt = NULL;
+  int64_t feels = -1;
+  if(sqlite3_prepare_v2(db, "select value from hif_counters where name = 'feels';", -1, &stmt, NULL) == SQLITE_OK
+    && sqlite3_step(stmt) == SQLITE_ROW) {
+    feels = sqlite3_column_int64(stmt, 0);
+  }
+  sqlite3_finalize(stmt);
+
+  return feels;
+}
+
+snapshot * snapshot_update(sqlite3 * db, char const * context_name, export_cursor const * cursor) {
+  snapshot * result = NULL;
+  char * path = alloc_snapshot_path(context_name, "");
+  char * temp_path = NULL;
+
+  snapshot_writer * writer = calloc(1, sizeof * writer);
+  if(!writer) abort();
+
+  int64_t feels = count_context_feels(db);
+  if(feels < 0) goto err0;
+
+  int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if(fd < 0) goto err0;
+  if(flock(fd, LOCK_EX) != 0) goto err1;
+
+  /* Appends pick up where the last update stopped; a delete since, or a
+   * file from another context, means starting over in a new file */
+  snapshot_header current;
+  int rebuild = !read_header(fd, &current)
+    || current.last_tombstone_id != cursor->tombstone_id
+    || current.last_feel_id > cursor->feel_id;
+
+  int ok = 0;
+  if(!rebuild) {
+    writer->fd = fd;
+    writer->header = current;
+    if(ftruncate(fd, (off_t)current.size) != 0) goto err1;
+
+    ok = current.last_feel_id >= cursor->feel_id
+      || append_feels(writer, db, context_name, current.last_feel_id + 1, cursor->feel_id);
+
+    /* A feel given an id below last_feel_id, as import-json restores them,
+     * moves the count by more than the rows appended. The appended records
+     * lie past the header's size, so starting over leaves nothing behind. */
+    if(ok && feels - current.feels != (int64_t)(writer->header.rows - current.rows)) {
+      rebuild = 1;
+      memset(writer, 0, sizeof * writer);
+    }
+  }
+
+  if(rebuild) {
+    temp_path = alloc_snapshot_path(context_name, HIF_SNAPSHOT_TEMP_SUFFIX);
+    writer->fd = open(temp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if(writer->fd < 0) goto err1;
+
+    memcpy(writer->header.magic, HIF_SNAPSHOT_MAGIC, sizeof writer->header.magic);
+    writer->header.version = HIF_SNAPSHOT_VERSION;
+    writer->header.size = sizeof writer->header;
+    ok = append_feels(writer, db, context_name, INT64_MIN, cursor->feel_id);
+  }
+  ok = ok && append_statuses(writer, db);
+
+  writer->header.last_feel_id = cursor->feel_id;
+  writer->header.last_tombstone_id = cursor->tombstone_id;
+  writer->header.feels = feels;
+  if(ok && (rebuild || memcmp(&writer->header, &current, sizeof current) != 0)) {
+    ok = fdatasync(writer->fd) == 0 && pwrite_all(writer->fd, &writer->header, sizeof writer->header, 0);
+  }
+  if(ok && rebuild) ok = rename(temp_path, path) == 0;
+
+  if(ok) {
+    result = map_snapshot(writer->fd, &writer->header, (int64_t)(writer->header.rows - (rebuild ? 0 : current.rows)));
+  } else {
+    fprintf(stderr, "Unable to write the snapshot %s.\n", path);
+  }
+
+  if(rebuild) {
+    if(!ok) remove(temp_path);
+    close(writer->fd);
+  }
+err1:
+  close(fd);
+err0:
+  free(writer), writer = NULL;
+  free(temp_path), temp_path = NULL;
+  free(path), path = NULL;
+
+  return result;
+}
+
+void snapshot_close(snapshot * snap) {
+  if(!snap) return;
+
+  if(snap->data) munmap((void *)snap->data, snap->header.size), snap->data = NULL;
+  for(size_t i = 0; i < snap->status_count; i++) free(snap->statuses[i].name), snap->statuses[i].name = NULL;
+  free(snap->statuses), snap->statuses = NULL;
+  free(snap->index), snap->index = NULL;
+  free(snap);
+}
+
+int64_t snapshot_rows(snapshot const * snap) {
+  return (int64_t)snap->header.rows;
+}
+
+int64_t snapshot_appended(snapshot const * snap) {
+  return snap->appended;
+}
+
+static int next_rows(snapshot const * snap, uint64_t * offset, snapshot_rows_view * rows) {
+  snapshot_record record;
+  while(next_record(snap, offset, &record)) {
+    uint64_t payload = *offset;
+    *offset += record.payload_size;
+
+    if(record.kind != HIF_SNAPSHOT_ROWS) continue;
+    if((uint64_t)record.count * (sizeof * rows->dtm + sizeof * rows->status) > record.payload_size) return 0;
+
+    rows->dtm = (int64_t const *)(void const *)(snap->data + payload);
+    rows->status = (uint16_t const *)(void const *)(rows->dtm + record.count);
+    rows->count = record.count;
+    return 1;
+  }
+
+  return 0;
+}
+
+static int32_t index_of(snapshot const * snap, uint16_t status) {
+  return status < snap->index_len ? snap->index[status] : -1;
+}
+
+/* The inner loops are branch-free so the compiler can vectorize them */
+int64_t snapshot_count_feels(snapshot const * snap, char const * feel, time_range const * range) {
+  int64_t status = -1;
+  for(size_t i = 0; feel && i < snap->status_count; i++) {
+    if(strcmp(snap->statuses[i].name, feel) == 0) status = snap->statuses[i].id;
+  }
+  if(feel && status < 0) return -1;
+  if(!feel && !range) return snapshot_rows(snap);
+
+  int64_t since = range ? range->since : HIF_TIME_MIN;
+  int64_t until = range ? range->until : HIF_TIME_MAX;
+
+  int64_t count = 0;
+  uint64_t offset = sizeof snap->header;
+  snapshot_rows_view rows;
+  while(next_rows(snap, &offset, &rows)) {
+    if(feel) {
+      for(uint32_t i = 0; i < rows.count; i++) {
+        count += (rows.dtm[i] >= since) & (rows.dtm[i] < until) & (rows.status[i] == status);
+      }
+    } else {
+      for(uint32_t i = 0; i < rows.count; i++) {
+        count += (rows.dtm[i] >= since) & (rows.dtm[i] < until);
+      }
+    }
+  }
+
+  return count;
+}
+
+typedef struct day_count {
+  int64_t day;
+  int32_t status; /* index into statuses, or -1 for every status */
+  int64_t feels;
+} day_count;
+
+static int compare_keys(void const * a, void const * b) {
+  int64_t left = *(int64_t const *)a, right = *(int64_t const *)b;
+  return (left > right) - (left < right);
+}
+
+/* Days since first_day, per status or in total, in day and then status id
+ * order. Spans too wide to count in a table are sorted instead. */
+static int count_days(snapshot const * snap, int64_t first_day, int per_status, rollup_handler handler, void * context) {
+  int64_t width = per_status ? (int64_t)snap->status_count : 1;
+  int64_t min_day = INT64_MAX, max_day = INT64_MIN, matching = 0;
+
+  uint64_t offset = sizeof snap->header;
+  snapshot_rows_view rows;
+  while(next_rows(snap, &offset, &rows)) {
+    for(uint32_t i = 0; i < rows.count; i++) {
+      int64_t day = floor_div(rows.dtm[i], HIF_MICROSECONDS_PER_DAY);
+      if(day < first_day || index_of(snap, rows.status[i]) < 0) continue;
+      if(day < min_day) min_day = day;
+      if(day > max_day) max_day = day;
+      matching++;
+    }
+  }
+  if(!matching || !width) return 1;
+
+  int dense = (uint64_t)(max_day - min_day) < (uint64_t)(HIF_SNAPSHOT_DENSE_CELLS / width);
+  size_t cells = dense ? (size_t)((max_day - min_day + 1) * width) : (size_t)matching;
+  int64_t * counts = calloc(cells, sizeof * counts);
+  if(!counts) abort();
+
+  /* Dense tables count per cell; otherwise each row's cell is noted and
+   * the notes are sorted into runs */
+  size_t noted = 0;
+  offset = sizeof snap->header;
+  while(next_rows(snap, &offset, &rows)) {
+    for(uint32_t i = 0; i < rows.count; i++) {
+      int64_t day = floor_div(rows.dtm[i], HIF_MICROSECONDS_PER_DAY);
+      int32_t status = index_of(snap, rows.status[i]);
+      if(day < first_day || status < 0) continue;
+
+      int64_t cell = (day - min_day) * width + (per_status ? status : 0);
+      if(dense) {
+        counts[cell]++;
+      } else {
+        counts[noted++] = cell;
+      }
+    }
+  }
+  if(!dense) qsort(counts, noted, sizeof * counts, &compare_keys);
+
+  int ok = 1;
+  for(size_t i = 0; ok && i < cells;) {
+    int64_t cell = dense ? (int64_t)i : counts[i];
+    int64_t feels = 0;
+    if(dense) {
+      feels = counts[i++];
+    } else {
+      while(i < cells && counts[i] == cell) feels++, i++;
+    }
+    if(!feels) continue;
+
+    int64_t day = min_day + cell / width;
+    ok = handler(context, day, per_status ? snap->statuses[cell % width].name : NULL, feels);
+  }
+
+  free(counts), counts = NULL;
+
+  return ok;
+}
+
+/* Rows are tallied as the rollup triggers would: feels without a status
+ * are left out. */
+int snapshot_query_rollup(snapshot const * snap, storage_rollup rollup, int64_t first_day, rollup_handler handler, void * context) {
+  if(rollup == STORAGE_ROLLUP_DAY || rollup == STORAGE_ROLLUP_ACTIVE_DAY) {
+    return count_days(snap, first_day, rollup == STORAGE_ROLLUP_DAY, handler, context);
+  }
+
+  size_t buckets = rollup == STORAGE_ROLLUP_HOUR ? 24 : 1;
+  int64_t * counts = calloc(buckets * (snap->status_count ? snap->status_count : 1), sizeof * counts);
+  if(!counts) abort();
+
+  uint64_t offset = sizeof snap->header;
+  snapshot_rows_view rows;
+  while(next_rows(snap, &offset, &rows)) {
+    for(uint32_t i = 0; i < rows.count; i++) {
+      int32_t status = index_of(snap, rows.status[i]);
+      if(status < 0) continue;
+
+      int64_t hour = buckets > 1 ? floor_div(rows.dtm[i], HIF_MICROSECONDS_PER_HOUR) % 24 : 0;
+      if(hour < 0) hour += 24;
+      counts[(size_t)hour * snap->status_count + (size_t)status]++;
+    }
+  }
+
+  int ok = 1;
+  for(size_t bucket = 0; ok && bucket < buckets; bucket++) {
+    for(size_t status = 0; ok && status < snap->status_count; status++) {
+      int64_t feels = counts[bucket * snap->status_count + status];
+      if(feels) ok = handler(context, (int64_t)bucket, snap->statuses[status].name, feels);
+    }
+  }
+
+  free(counts), counts = NULL;
+
+  return ok;
+}
@@ -0,0 +1,87 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "status_cache.h"
+
+#define HIF_STATUS_CACHE_MIN_CAPACITY 16
+
+/* FNV-1a */
+static uint32_t hash_name(char const * name) {
+  uint32_t hash = 2166136261u;
+  for(unsigned char const * p = (unsigned char const *)name; *p; ++p) {
+    hash ^= *p;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static status_entry * find_slot(status_entry * entries, size_t capacity, char const * name, uint32_t hash) {
+  size_t mask = capacity - 1;
+  for(size_t i = hash & mask;; i = (i + 1) & mask) {
+    status_entry * entry = &entries[i];
+    if(!entry->name || (entry->hash == hash && strcmp(entry->name, name) == 0)) return entry;
+  }
+}
+
+static void grow(status_cache * cache) {
+  size_t capacity = cache->capacity ? cache->capacity * 2 : HIF_STATUS_CACHE_MIN_CAPACITY;
+  status_entry * entries = calloc(capacity, sizeof * entries);
+  if(!entries) abort();
+
+  for(size_t i = 0; i < cache->capacity; i++) {
+    status_entry * entry = &cache->entries[i];
+    if(entry->name) *find_slot(entries, capacity, entry->name, entry->hash) = *entry;
+  }
+
+  free(cache->entries);
+  cache->entries = entries;
+  cache->capacity = capacity;
+}
+
+void status_cache_init(status_cache * cache) {
+  memset(cache, 0, sizeof * cache);
+}
+
+void status_cache_clear(status_cache * cache) {
+  for(size_t i = 0; i < cache->capacity; i++) {
+    status_entry * entry = &cache->entries[i];
+    free(entry->name), entry->name = NULL;
+    free(entry->description), entry->description = NULL;
+  }
+
+  cache->len = 0;
+  cache->is_loaded = 0;
+}
+
+void status_cache_free(status_cache * cache) {
+  status_cache_clear(cache);
+  free(cache->entries), cache->entries = NULL;
+  cache->capacity = 0;
+}
+
+void status_cache_put(status_cache * cache, int id, char const * name, char const * description) {
+  /* Stay at most half full so probes stay short */
+  if((cache->len + 1) * 2 > cache->capacity) grow(cache);
+
+  uint32_t hash = hash_name(name);
+  status_entry * entry = find_slot(cache->entries, cache->capacity, name, hash);
+
+  if(entry->name) {
+    free(entry->description), entry->description = NULL;
+  } else {
+    entry->name = strdup(name);
+    entry->hash = hash;
+    if(!entry->name) abort();
+    cache->len++;
+  }
+
+  entry->id = id;
+  entry->description = description ? strdup(description) : NULL;
+}
+
+status_entry const * status_cache_get(status_cache const * cache, char const * name) {
+  if(!cache->len || !name) return NULL;
+
+  status_entry const * entry = find_slot(cache->entries, cache->capacity, name, hash_name(name));
+  return entry->name ? entry : NULL;
+}
@@ -1,12 +1,21 @@
 #include <stdbool.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <sqlite3.h>
 
 #include "hif.h"
 #include "environment.h"
 #include "storage_adapter.h"
+#include "status_cache.h"
+#include "exporter.h"
+#include "trace.h"
+#include "metrics.h"
+#include "contexts.h"
+#include "shards.h"
+#include "snapshot.h"
 
 struct storage_adapter_data;
 
@@ -18,6 +27,7 @@ typedef struct storage_adapter {
 
 static int create_storage(storage_interface const * adapter, char const * path);
 static int open_storage(storage_interface const * adapter, char const * context_name);
+static int open_storage_read_only(storage_interface const * adapter, char const * context_name);
 static int close(storage_interface const * adapter);
 
 static int create_feel(storage_interface const * adapter, char const * feel, char const * description);
@@ -25,20 +35,487 @@ static int get_feel_description(storage_interface const * adapter,  char const *
 
 static int insert_feel(storage_interface const * adapter, char const * feel, char **description);
 static int delete_feel(storage_interface const * adapter, int id, int * affected_rows);
-static int count_feels(storage_interface const * adapter);
+static int64_t count_feels(storage_interface const * adapter, char const * feel, time_range const * range);
 
-static int export(storage_interface const * adapter, kvp_handler kvp);
+static int export(storage_interface const * adapter, export_options const * options);
+static snapshot * open_snapshot(storage_interface const * adapter);
 
 static int insert_memo(storage_interface const * adapter, char const * memo, int * affected_rows);
+static int64_t count_memos(storage_interface const * adapter, time_range const * range);
+static int search_memos(storage_interface const * adapter, char const * query, time_range const * range, int limit, memo_handler handler, void * context);
+static int maintain_search(storage_interface const * adapter, storage_search_task task);
 
-static int get_escape_character_count(unsigned char const * source, size_t source_len);
+static int begin_transaction(storage_interface const * adapter);
+static int commit_transaction(storage_interface const * adapter);
+static int rollback_transaction(storage_interface const * adapter);
+
+static int get_feel_id(storage_interface const * adapter, char const * feel, int * id);
+static int import_feel(storage_interface const * adapter, int feel_id, char const * dtm, char const * memo);
+static int restore_feel(storage_interface const * adapter, int64_t id, int feel_id, char const * dtm);
+static int flush_imports(storage_interface const * adapter, long * existing);
 
 static int delete_by_id(storage_interface const * adapter, char const * table_name,  int id, int * affected_rows);
 
+static int query_rollup(storage_interface const * adapter, storage_rollup rollup, int64_t first_day, rollup_handler handler, void * context);
+static int resolve_time(storage_interface const * adapter, char const * expression, int64_t * microseconds);
+
+static int set_durability(storage_interface const * adapter, storage_durability durability, int persist);
+static storage_durability get_durability(storage_interface const * adapter);
+
+static int set_partitioning(storage_interface const * adapter, storage_partitioning partitioning);
+static storage_partitioning get_partitioning(storage_interface const * adapter);
+static int query_shards(storage_interface const * adapter, shard_handler handler, void * context);
+static int maintain_shard(storage_interface const * adapter, int month, storage_shard_task task);
+
+static storage_durability get_saved_durability(storage_interface const * adapter);
+static storage_partitioning get_saved_partitioning(storage_interface const * adapter);
+static int attach_current_shard(storage_interface const * adapter, int64_t now);
+static int sync_shard_statuses(storage_interface const * adapter);
+static int64_t count_shard_feels(storage_interface const * adapter, char const * feel, time_range const * range);
+static int delete_shard_feel(storage_interface const * adapter, int id, int * affected_rows);
+static void detach_deferred_shards(storage_interface const * adapter);
+static int exec_sql(storage_interface const * adapter, char const * sql);
+
+static int delete_feels(storage_interface const * adapter, feel_filter const * filter, int limit);
+static int reclaim_space(storage_interface const * adapter, int pages);
+static int vacuum(storage_interface const * adapter);
+
+typedef enum storage_statement {
+  STORAGE_STATEMENT_LOAD_STATUSES,
+  STORAGE_STATEMENT_DATA_VERSION,
+  STORAGE_STATEMENT_INSERT_FEEL,
+  STORAGE_STATEMENT_INSERT_SHARD_FEEL,
+  STORAGE_STATEMENT_CREATE_FEEL,
+  STORAGE_STATEMENT_INSERT_MEMO,
+
+  STORAGE_STATEMENT_IMPORT_FEEL,
+  STORAGE_STATEMENT_IMPORT_MEMO,
+  STORAGE_STATEMENT_RESTORE_FEEL,
+  STORAGE_STATEMENT_COUNT_STAGED_FEELS,
+  STORAGE_STATEMENT_STAGED_CONFLICTS,
+
+  STORAGE_STATEMENT_DELETE_FEEL,
+  STORAGE_STATEMENT_DELETE_MEMO,
+
+  STORAGE_STATEMENT_COUNT_FEELS,
+  STORAGE_STATEMENT_COUNT_FEELS_BETWEEN,
+  STORAGE_STATEMENT_COUNT_STATUS_FEELS,
+  STORAGE_STATEMENT_COUNT_STATUS_FEELS_BETWEEN,
+  STORAGE_STATEMENT_COUNT_SHARD_FEELS_BETWEEN,
+  STORAGE_STATEMENT_COUNT_SHARD_STATUS_FEELS_BETWEEN,
+  STORAGE_STATEMENT_COUNT_MEMOS,
+  STORAGE_STATEMENT_COUNT_MEMOS_BETWEEN,
+
+  STORAGE_STATEMENT_SEARCH_MEMOS,
+
+  STORAGE_STATEMENT_ROLLUP_STATUS,
+  STORAGE_STATEMENT_ROLLUP_HOUR,
+  STORAGE_STATEMENT_ROLLUP_DAY,
+  STORAGE_STATEMENT_ROLLUP_ACTIVE_DAY,
+
+  STORAGE_STATEMENT_RESOLVE_TIME,
+
+  STORAGE_STATEMENT_GET_SETTING,
+  STORAGE_STATEMENT_SET_SETTING,
+
+  STORAGE_STATEMENT_LIST_SHARDS,
+  STORAGE_STATEMENT_SHARDS_BETWEEN,
+  STORAGE_STATEMENT_FEEL_SHARDS,
+  STORAGE_STATEMENT_SHARD_SEALED,
+  STORAGE_STATEMENT_SHARDS_MATCHING,
+
+  STORAGE_STATEMENT_EXPORT_CURSOR,
+
+  STORAGE_STATEMENT_EOF /* must be last */
+} storage_statement;
+
+/* Anything sqlite's strftime() understands, to microseconds; NULL otherwise */
+#define HIF_TEXT_TO_MICROSECONDS(p) \
+  "(cast(strftime('%s', " p ") as integer) * 1000000 + cast(substr(strftime('%f', " p "), 4) as integer) * 1000)"
+
+/* Integer division rounding down, so days and hours before 1970 bucket correctly */
+#define HIF_FLOOR_DIV(p, d) "((" p ") - (((" p ") % " d ") + " d ") % " d ") / " d
+#define HIF_DAY_OF(p) "(" HIF_FLOOR_DIV(p, "86400000000") ")"
+#define HIF_HOUR_OF(p) "((" HIF_FLOOR_DIV(p, "3600000000") ") % 24 + 24) % 24"
+
+/* Shards are attached under these names; sqlite attaches ten databases at
+ * most, so ranges spanning more months are counted a batch at a time. */
+#define HIF_CURRENT_SHARD "hif_current_shard"
+#define HIF_SHARD_SCHEMA_SIZE sizeof(HIF_CURRENT_SHARD)
+#define HIF_SHARD_ATTACH_BATCH 8
+
+/* A writer waiting on others backs off exponentially, with jitter so that
+ * waiters do not retry in lockstep, and gives up after the timeout. */
+#define HIF_BUSY_TIMEOUT_MS 10000
+#define HIF_BUSY_FIRST_DELAY_US 100
+#define HIF_BUSY_MAX_DELAY_US 20000
+
+/* Feel ids stay unique across a context and its shards, and are never
+ * reused once a shard has handed them out */
+#define HIF_NEXT_FEEL_ID \
+  "(select max(coalesce((select max(feel_id) from main.hif_feels), 0), " \
+    "coalesce((select max(last_feel_id) from main.hif_shards), 0)) + 1)"
+/* The current shard's own ids count too, in case hif_shards lost the
+ * newest of them; see SHARD_RECONCILE_SQL */
+#define HIF_NEXT_SHARD_FEEL_ID \
+  "(select max(coalesce((select max(feel_id) from main.hif_feels), 0), " \
+    "coalesce((select max(last_feel_id) from main.hif_shards), 0), " \
+    "coalesce((select max(feel_id) from " HIF_CURRENT_SHARD ".hif_feels), 0)) + 1)"
+
+/* A full text index over memos, kept current by triggers. sqlite may be
+ * built without FTS5; the index is then left out, and search-index rebuild
+ * creates it once a build that has FTS5 opens the context. */
+#define HIF_SEARCH_MIGRATION 4 /* index of migration 5 in MIGRATIONS */
+#define HIF_SEARCH_INDEX_SQL \
+  "create virtual table if not exists hif_memos_search using fts5(" \
+    "memo, content='hif_memos', content_rowid='memo_id', tokenize='unicode61 remove_diacritics 2'" \
+  ");" \
+  "insert into hif_memos_search (hif_memos_search) values ('rebuild');" \
+  \
+  "create trigger if not exists hif_memos_search_insert after insert on hif_memos begin " \
+    "insert into hif_memos_search (rowid, memo) values (new.memo_id, new.memo);" \
+  "end;" \
+  "create trigger if not exists hif_memos_search_delete after delete on hif_memos begin " \
+    "insert into hif_memos_search (hif_memos_search, rowid, memo) values ('delete', old.memo_id, old.memo);" \
+  "end;" \
+  "create trigger if not exists hif_memos_search_update after update of memo on hif_memos begin " \
+    "insert into hif_memos_search (hif_memos_search, rowid, memo) values ('delete', old.memo_id, old.memo);" \
+    "insert into hif_memos_search (rowid, memo) values (new.memo_id, new.memo);" \
+  "end;"
+
+/* Conflicting restored ids named per batch before the rest are only counted */
+#define HIF_IMPORT_REPORTED_CONFLICTS 10
+
+#define HIF_IMPORT_DTM(p) \
+  "case when typeof(" p ") = 'text' then " HIF_TEXT_TO_MICROSECONDS(p) " else " p " end"
+
+static char const * const STATEMENT_SQL[] = {
+  "select status_id, status, description from hif_statuses;", /* STORAGE_STATEMENT_LOAD_STATUSES */
+  "pragma data_version;", /* STORAGE_STATEMENT_DATA_VERSION */
+  "insert into hif_feels (feel_id, feel, dtm) values (" HIF_NEXT_FEEL_ID ", ?1, ?2);", /* STORAGE_STATEMENT_INSERT_FEEL */
+  "insert into " HIF_CURRENT_SHARD ".hif_feels (feel_id, feel, dtm) values (" HIF_NEXT_SHARD_FEEL_ID ", ?1, ?2);", /* STORAGE_STATEMENT_INSERT_SHARD_FEEL */
+  "insert into hif_statuses (status, description) values (?, ?);", /* STORAGE_STATEMENT_CREATE_FEEL */
+  "insert into hif_memos (memo, dtm) values (?1, ?2);", /* STORAGE_STATEMENT_INSERT_MEMO */
+
+  "insert into temp.hif_staged_feels (feel, dtm) values (?1, " HIF_IMPORT_DTM("?2") ");", /* STORAGE_STATEMENT_IMPORT_FEEL */
+  "insert into hif_memos (memo, dtm) values (?1, " HIF_IMPORT_DTM("?2") ");", /* STORAGE_STATEMENT_IMPORT_MEMO */
+  "insert into temp.hif_staged_feels (feel_id, feel, dtm) values (?1, ?2, " HIF_IMPORT_DTM("?3") ");", /* STORAGE_STATEMENT_RESTORE_FEEL */
+  "select count(*) from temp.hif_staged_feels;", /* STORAGE_STATEMENT_COUNT_STAGED_FEELS */
+  /* Restored ids a shard owns, or a different feel holds, with 1 for a shard's.
+   * Dumps carry whole seconds, so times are compared to the second. */
+  "select s.feel_id, exists (select 1 from hif_shards where s.feel_id between first_feel_id and last_feel_id) " \
+    "from temp.hif_staged_feels s where s.feel_id is not null and (" \
+      "exists (select 1 from hif_shards where s.feel_id between first_feel_id and last_feel_id) " \
+      "or exists (select 1 from main.hif_feels f where f.feel_id = s.feel_id " \
+        "and (f.feel is not s.feel or f.dtm / 1000000 is not s.dtm / 1000000))" \
+    ") order by s.rowid;", /* STORAGE_STATEMENT_STAGED_CONFLICTS */
+
+  "delete from hif_feels where rowid = ?;", /* STORAGE_STATEMENT_DELETE_FEEL */
+  "delete from hif_memos where rowid = ?;", /* STORAGE_STATEMENT_DELETE_MEMO */
+
+  /* Counts take the status as ?1 and a time range as ?2 and ?3. Unbounded
+   * counts read the trigger-maintained counters, bounded ones the dtm index. */
+  "select value from hif_counters where name = 'feels';", /* STORAGE_STATEMENT_COUNT_FEELS */
+  "select count(*) from hif_feels where dtm >= ?2 and dtm < ?3;", /* STORAGE_STATEMENT_COUNT_FEELS_BETWEEN */
+  "select coalesce(c.feels, 0) from hif_statuses s " \
+    "left join hif_status_counters c on c.status_id = s.status_id where s.status = ?1;", /* STORAGE_STATEMENT_COUNT_STATUS_FEELS */
+  "select count(*) from hif_feels where dtm >= ?2 and dtm < ?3 " \
+    "and feel = (select status_id from hif_statuses where status = ?1);", /* STORAGE_STATEMENT_COUNT_STATUS_FEELS_BETWEEN */
+  /* Over the union of whichever shards are attached at the time */
+  "select count(*) from temp.hif_shard_feels where dtm >= ?2 and dtm < ?3;", /* STORAGE_STATEMENT_COUNT_SHARD_FEELS_BETWEEN */
+  "select count(*) from temp.hif_shard_feels where dtm >= ?2 and dtm < ?3 " \
+    "and feel = (select status_id from main.hif_statuses where status = ?1);", /* STORAGE_STATEMENT_COUNT_SHARD_STATUS_FEELS_BETWEEN */
+  "select value from hif_counters where name = 'memos';", /* STORAGE_STATEMENT_COUNT_MEMOS */
+  "select count(*) from hif_memos where dtm >= ?2 and dtm < ?3;", /* STORAGE_STATEMENT_COUNT_MEMOS_BETWEEN */
+
+  /* Best bm25 match first; the time range ?2 and ?3 filters the ranked matches */
+  "select m.memo_id, datetime(m.dtm / 1000000, 'unixepoch'), m.memo from hif_memos_search s " \
+    "inner join hif_memos m on m.memo_id = s.rowid " \
+    "where hif_memos_search match ?1 and m.dtm >= ?2 and m.dtm < ?3 order by s.rank limit ?4;", /* STORAGE_STATEMENT_SEARCH_MEMOS */
+
+  "select 0, s.status, c.feels from hif_status_counters c " \
+    "inner join hif_statuses s on s.status_id = c.status_id where c.feels > 0 order by c.status_id;", /* STORAGE_STATEMENT_ROLLUP_STATUS */
+  "select r.hour, s.status, r.feels from hif_hourly_rollup r " \
+    "inner join hif_statuses s on s.status_id = r.status_id where r.feels > 0 order by r.hour, r.status_id;", /* STORAGE_STATEMENT_ROLLUP_HOUR */
+  "select r.day, s.status, r.feels from hif_daily_rollup r " \
+    "inner join hif_statuses s on s.status_id = r.status_id where r.day >= ?1 and r.feels > 0 " \
+    "order by r.day, r.status_id;", /* STORAGE_STATEMENT_ROLLUP_DAY */
+  "select day, null, sum(feels) from hif_daily_rollup where day >= ?1 and feels > 0 " \
+    "group by day order by day;", /* STORAGE_STATEMENT_ROLLUP_ACTIVE_DAY */
+
+  /* A point in time, or a modifier such as '-7 days' applied to now */
+  "select coalesce(" HIF_TEXT_TO_MICROSECONDS("?1") ", " HIF_TEXT_TO_MICROSECONDS("'now', ?1") ");", /* STORAGE_STATEMENT_RESOLVE_TIME */
+
+  "select value from hif_settings where name = ?;", /* STORAGE_STATEMENT_GET_SETTING */
+  "insert or replace into hif_settings (name, value) values (?, ?);", /* STORAGE_STATEMENT_SET_SETTING */
+
+  "select month, feels, sealed from hif_shards order by month;", /* STORAGE_STATEMENT_LIST_SHARDS */
+  "select month from hif_shards where since < ?2 and until > ?1 and feels > 0 order by month;", /* STORAGE_STATEMENT_SHARDS_BETWEEN */
+  "select month, sealed from hif_shards where ?1 between first_feel_id and last_feel_id order by month desc;", /* STORAGE_STATEMENT_FEEL_SHARDS */
+  "select sealed from hif_shards where month = ?1;", /* STORAGE_STATEMENT_SHARD_SEALED */
+  "select month, sealed from hif_shards where since < ?2 and until > ?1 and feels > 0 " \
+    "and last_feel_id >= ?3 and first_feel_id <= ?4 order by month;", /* STORAGE_STATEMENT_SHARDS_MATCHING */
+
+  /* The newest feel id handed out, memo and tombstone; see export_cursor */
+  "select " HIF_NEXT_FEEL_ID " - 1, coalesce((select max(memo_id) from hif_memos), 0), " \
+    "coalesce((select max(tombstone_id) from hif_tombstones), 0);" /* STORAGE_STATEMENT_EXPORT_CURSOR */
+};
+
+_Static_assert(sizeof(STATEMENT_SQL) / sizeof(*STATEMENT_SQL) == STORAGE_STATEMENT_EOF, "STATEMENT_SQL must match storage_statement");
+
+/* Schema changes for contexts created by older versions; a context's
+ * user_version is the number of these already applied. Append only. */
+static char const * const MIGRATIONS[] = {
+  /* 1: per-context settings */
+  "create table if not exists hif_settings (" \
+    "name text primary key, value text not null" \
+  ") without rowid;",
+
+  /* 2: datetime text to epoch microseconds, indexed for time ranges */
+  "update hif_feels set dtm = " HIF_TEXT_TO_MICROSECONDS("dtm") \
+    " where typeof(dtm) = 'text' and strftime('%s', dtm) is not null;" \
+  "update hif_memos set dtm = " HIF_TEXT_TO_MICROSECONDS("dtm") \
+    " where typeof(dtm) = 'text' and strftime('%s', dtm) is not null;" \
+  "create index if not exists hif_feels_dtm_inx on hif_feels(dtm, feel);" \
+  "create index if not exists hif_memos_dtm_inx on hif_memos(dtm);",
+
+  /* 3: row counts, in total and per status, kept current by triggers */
+  "create table if not exists hif_counters (" \
+    "name text primary key, value integer not null" \
+  ") without rowid;" \
+  "create table if not exists hif_status_counters (" \
+    "status_id integer primary key, feels integer not null default 0" \
+  ");" \
+  "insert or replace into hif_counters (name, value) values " \
+    "('feels', (select count(*) from hif_feels)), ('memos', (select count(*) from hif_memos));" \
+  "insert or replace into hif_status_counters (status_id, feels) " \
+    "select s.status_id, count(f.feel_id) from hif_statuses s left join hif_feels f on f.feel = s.status_id " \
+    "group by s.status_id;" \
+  \
+  "create trigger if not exists hif_statuses_count_insert after insert on hif_statuses begin " \
+    "insert or ignore into hif_status_counters (status_id) values (new.status_id);" \
+  "end;" \
+  "create trigger if not exists hif_feels_count_insert after insert on hif_feels begin " \
+    "update hif_counters set value = value + 1 where name = 'feels';" \
+    "update hif_status_counters set feels = feels + 1 where status_id = new.feel;" \
+  "end;" \
+  "create trigger if not exists hif_feels_count_delete after delete on hif_feels begin " \
+    "update hif_counters set value = value - 1 where name = 'feels';" \
+    "update hif_status_counters set feels = feels - 1 where status_id = old.feel;" \
+  "end;" \
+  "create trigger if not exists hif_feels_count_update after update of feel on hif_feels " \
+    "when new.feel is not old.feel begin " \
+    "update hif_status_counters set feels = feels - 1 where status_id = old.feel;" \
+    "update hif_status_counters set feels = feels + 1 where status_id = new.feel;" \
+  "end;" \
+  "create trigger if not exists hif_memos_count_insert after insert on hif_memos begin " \
+    "update hif_counters set value = value + 1 where name = 'memos';" \
+  "end;" \
+  "create trigger if not exists hif_memos_count_delete after delete on hif_memos begin " \
+    "update hif_counters set value = value - 1 where name = 'memos';" \
+  "end;",
+
+  /* 4: feels per UTC day and per UTC hour of day and status, kept current by triggers */
+  "create table if not exists hif_daily_rollup (" \
+    "day integer not null, status_id integer not null, feels integer not null, primary key (day, status_id)" \
+  ") without rowid;" \
+  "create table if not exists hif_hourly_rollup (" \
+    "hour integer not null, status_id integer not null, feels integer not null, primary key (hour, status_id)" \
+  ") without rowid;" \
+  "insert or replace into hif_daily_rollup (day, status_id, feels) " \
+    "select " HIF_DAY_OF("dtm") ", feel, count(*) from hif_feels " \
+    "where feel is not null and typeof(dtm) = 'integer' group by 1, 2;" \
+  "insert or replace into hif_hourly_rollup (hour, status_id, feels) " \
+    "select " HIF_HOUR_OF("dtm") ", feel, count(*) from hif_feels " \
+    "where feel is not null and typeof(dtm) = 'integer' group by 1, 2;" \
+  \
+  "create trigger if not exists hif_feels_rollup_insert after insert on hif_feels " \
+    "when new.feel is not null and typeof(new.dtm) = 'integer' begin " \
+    "insert into hif_daily_rollup (day, status_id, feels) values (" HIF_DAY_OF("new.dtm") ", new.feel, 1) " \
+      "on conflict(day, status_id) do update set feels = feels + 1;" \
+    "insert into hif_hourly_rollup (hour, status_id, feels) values (" HIF_HOUR_OF("new.dtm") ", new.feel, 1) " \
+      "on conflict(hour, status_id) do update set feels = feels + 1;" \
+  "end;" \
+  "create trigger if not exists hif_feels_rollup_delete after delete on hif_feels " \
+    "when old.feel is not null and typeof(old.dtm) = 'integer' begin " \
+    "update hif_daily_rollup set feels = feels - 1 where day = " HIF_DAY_OF("old.dtm") " and status_id = old.feel;" \
+    "update hif_hourly_rollup set feels = feels - 1 where hour = " HIF_HOUR_OF("old.dtm") " and status_id = old.feel;" \
+  "end;" \
+  "create trigger if not exists hif_feels_rollup_update_old after update of feel, dtm on hif_feels " \
+    "when old.feel is not null and typeof(old.dtm) = 'integer' begin " \
+    "update hif_daily_rollup set feels = feels - 1 where day = " HIF_DAY_OF("old.dtm") " and status_id = old.feel;" \
+    "update hif_hourly_rollup set feels = feels - 1 where hour = " HIF_HOUR_OF("old.dtm") " and status_id = old.feel;" \
+  "end;" \
+  "create trigger if not exists hif_feels_rollup_update_new after update of feel, dtm on hif_feels " \
+    "when new.feel is not null and typeof(new.dtm) = 'integer' begin " \
+    "insert into hif_daily_rollup (day, status_id, feels) values (" HIF_DAY_OF("new.dtm") ", new.feel, 1) " \
+      "on conflict(day, status_id) do update set feels = feels + 1;" \
+    "insert into hif_hourly_rollup (hour, status_id, feels) values (" HIF_HOUR_OF("new.dtm") ", new.feel, 1) " \
+      "on conflict(hour, status_id) do update set feels = feels + 1;" \
+  "end;",
+
+  /* 5: full text index over memos, left out without FTS5 */
+  HIF_SEARCH_INDEX_SQL,
+
+  /* 6: monthly shards and the feel ids each has handed out, see shards.h */
+  "create table if not exists hif_shards (" \
+    "month integer primary key, since integer not null, until integer not null, " \
+    "feels integer not null default 0, first_feel_id integer, last_feel_id integer, " \
+    "sealed integer not null default 0" \
+  ");",
+
+  /* 7: feels and memos deleted, in order, for exports of changes since a cursor */
+  "create table if not exists hif_tombstones (" \
+    "tombstone_id integer primary key, kind text not null, row_id integer not null" \
+  ");" \
+  "create trigger if not exists hif_feels_tombstone after delete on hif_feels begin " \
+    "insert into hif_tombstones (kind, row_id) values ('feels', old.feel_id);" \
+  "end;" \
+  "create trigger if not exists hif_memos_tombstone after delete on hif_memos begin " \
+    "insert into hif_tombstones (kind, row_id) values ('memos', old.memo_id);" \
+  "end;"
+};
+
+static char const * const DURABILITY_NAMES[] = {
+  "default", /* STORAGE_DURABILITY_DEFAULT */
+  "strict", /* STORAGE_DURABILITY_STRICT */
+  "fast", /* STORAGE_DURABILITY_FAST */
+  "batched" /* STORAGE_DURABILITY_BATCHED */
+};
+
+_Static_assert(sizeof(DURABILITY_NAMES) / sizeof(*DURABILITY_NAMES) == STORAGE_DURABILITY_EOF, "DURABILITY_NAMES must match storage_durability");
+
+static char const * const DURABILITY_SQL[] = {
+  NULL, /* STORAGE_DURABILITY_DEFAULT */
+  "pragma journal_mode = delete; pragma synchronous = full;", /* STORAGE_DURABILITY_STRICT */
+  "pragma journal_mode = wal; pragma synchronous = normal;", /* STORAGE_DURABILITY_FAST */
+  "pragma journal_mode = wal; pragma synchronous = full;" /* STORAGE_DURABILITY_BATCHED */
+};
+
+_Static_assert(sizeof(DURABILITY_SQL) / sizeof(*DURABILITY_SQL) == STORAGE_DURABILITY_EOF, "DURABILITY_SQL must match storage_durability");
+
+/* A writable shard follows its context's durability; synchronous is set per
+ * attached database and connection, the journal mode once per file */
+static char const * const SHARD_JOURNAL_MODES[] = {
+  NULL, /* STORAGE_DURABILITY_DEFAULT */
+  "delete", /* STORAGE_DURABILITY_STRICT */
+  "wal", /* STORAGE_DURABILITY_FAST */
+  "wal" /* STORAGE_DURABILITY_BATCHED */
+};
+
+_Static_assert(sizeof(SHARD_JOURNAL_MODES) / sizeof(*SHARD_JOURNAL_MODES) == STORAGE_DURABILITY_EOF, "SHARD_JOURNAL_MODES must match storage_durability");
+
+static char const * const SHARD_SYNCHRONOUS[] = {
+  NULL, /* STORAGE_DURABILITY_DEFAULT */
+  "full", /* STORAGE_DURABILITY_STRICT */
+  "normal", /* STORAGE_DURABILITY_FAST */
+  "full" /* STORAGE_DURABILITY_BATCHED */
+};
+
+_Static_assert(sizeof(SHARD_SYNCHRONOUS) / sizeof(*SHARD_SYNCHRONOUS) == STORAGE_DURABILITY_EOF, "SHARD_SYNCHRONOUS must match storage_durability");
+
+static char const * const PARTITIONING_NAMES[] = {
+  "none", /* STORAGE_PARTITIONING_NONE */
+  "monthly" /* STORAGE_PARTITIONING_MONTHLY */
+};
+
+_Static_assert(sizeof(PARTITIONING_NAMES) / sizeof(*PARTITIONING_NAMES) == STORAGE_PARTITIONING_EOF, "PARTITIONING_NAMES must match storage_partitioning");
+
+/* Shard statements name the attached shard {shard} and its month {month}.
+ * A shard holds its month's feels and a copy of the statuses, so it can be
+ * exported on its own. */
+static char const * const SHARD_SCHEMA_SQL =
+  "create table if not exists {shard}.hif_statuses (" \
+    "status_id integer primary key, status text unique not null, description text" \
+  ");" \
+  "create table if not exists {shard}.hif_feels (" \
+    "feel_id integer primary key, feel int, dtm int not null" \
+  ");" \
+  "create index if not exists {shard}.hif_feels_dtm_inx on hif_feels(dtm, feel);";
+
+/* Writes nothing when the copy is current. */
+static char const * const SHARD_STATUSES_SQL =
+  "insert or replace into {shard}.hif_statuses (status_id, status, description) " \
+    "select status_id, status, description from main.hif_statuses m where not exists (" \
+      "select 1 from {shard}.hif_statuses s " \
+      "where s.status_id = m.status_id and s.status = m.status and s.description is m.description" \
+    ");";
+
+/* The context's counter and rollup triggers, for one attached shard; they
+ * live in temp, so unqualified tables resolve to the context. */
+static char const * const SHARD_TRIGGERS_SQL =
+  "create temp trigger if not exists {shard}_feels_insert after insert on {shard}.hif_feels begin " \
+    "update hif_counters set value = value + 1 where name = 'feels';" \
+    "update hif_status_counters set feels = feels + 1 where status_id = new.feel;" \
+    "insert into hif_daily_rollup (day, status_id, feels) values (" HIF_DAY_OF("new.dtm") ", new.feel, 1) " \
+      "on conflict(day, status_id) do update set feels = feels + 1;" \
+    "insert into hif_hourly_rollup (hour, status_id, feels) values (" HIF_HOUR_OF("new.dtm") ", new.feel, 1) " \
+      "on conflict(hour, status_id) do update set feels = feels + 1;" \
+    "update hif_shards set feels = feels + 1, " \
+      "first_feel_id = min(coalesce(first_feel_id, new.feel_id), new.feel_id), " \
+      "last_feel_id = max(coalesce(last_feel_id, new.feel_id), new.feel_id) where month = {month};" \
+  "end;" \
+  "create temp trigger if not exists {shard}_feels_delete after delete on {shard}.hif_feels begin " \
+    "update hif_counters set value = value - 1 where name = 'feels';" \
+    "update hif_status_counters set feels = feels - 1 where status_id = old.feel;" \
+    "update hif_daily_rollup set feels = feels - 1 where day = " HIF_DAY_OF("old.dtm") " and status_id = old.feel;" \
+    "update hif_hourly_rollup set feels = feels - 1 where hour = " HIF_HOUR_OF("old.dtm") " and status_id = old.feel;" \
+    "update hif_shards set feels = feels - 1 where month = {month};" \
+    "insert into hif_tombstones (kind, row_id) values ('feels', old.feel_id);" \
+  "end;";
+
+/* Feels past the shard's last_feel_id are ones whose commit reached the
+ * shard but not the context: in WAL, as the fast and batched levels use, a
+ * transaction across attached files is atomic per file only. Their counter, rollup and hif_shards updates are
+ * made again; each statement finds nothing in the usual case. */
+#define HIF_UNRECORDED_SHARD_FEELS \
+  "with unrecorded as (select feel_id, feel, dtm from {shard}.hif_feels " \
+    "where feel_id > (select coalesce(last_feel_id, 0) from main.hif_shards where month = {month})) "
+
+static char const * const SHARD_RECONCILE_SQL =
+  HIF_UNRECORDED_SHARD_FEELS "update main.hif_counters set value = value + (select count(*) from unrecorded) " \
+    "where name = 'feels' and exists (select 1 from unrecorded);" \
+  HIF_UNRECORDED_SHARD_FEELS "update main.hif_status_counters set feels = feels + " \
+    "(select count(*) from unrecorded u where u.feel = hif_status_counters.status_id) " \
+    "where status_id in (select feel from unrecorded);" \
+  HIF_UNRECORDED_SHARD_FEELS "insert into main.hif_daily_rollup (day, status_id, feels) " \
+    "select " HIF_DAY_OF("dtm") ", feel, count(*) from unrecorded where feel is not null group by 1, 2 " \
+    "on conflict(day, status_id) do update set feels = feels + excluded.feels;" \
+  HIF_UNRECORDED_SHARD_FEELS "insert into main.hif_hourly_rollup (hour, status_id, feels) " \
+    "select " HIF_HOUR_OF("dtm") ", feel, count(*) from unrecorded where feel is not null group by 1, 2 " \
+    "on conflict(hour, status_id) do update set feels = feels + excluded.feels;" \
+  HIF_UNRECORDED_SHARD_FEELS "update main.hif_shards set feels = feels + (select count(*) from unrecorded), " \
+    "first_feel_id = coalesce(first_feel_id, (select min(feel_id) from unrecorded)), " \
+    "last_feel_id = (select max(feel_id) from unrecorded) " \
+    "where month = {month} and exists (select 1 from unrecorded);";
+
 typedef struct storage_adapter_data {
   sqlite3 *db;
-
+  char * path;
+  char * name; /* relative to the config directory */
+
+  /* Prepared on first use, reset between uses and finalized by close */
+  sqlite3_stmt * statements[STORAGE_STATEMENT_EOF];
+
+  /* Loaded on first use; data_version tells whether another connection
+   * may have created statuses since. */
+  status_cache statuses;
+  sqlite3_int64 statuses_data_version;
+
+  int has_import_staging;
+  storage_durability durability;
+  storage_partitioning partitioning;
+  int current_month; /* attached as HIF_CURRENT_SHARD; 0 for none */
+  /* Past months' shards attached inside a transaction stay attached until
+   * it ends, since sqlite cannot detach them before */
+  int deferred_months[HIF_SHARD_ATTACH_BATCH];
+  int deferred_writable[HIF_SHARD_ATTACH_BATCH];
+  size_t deferred_count;
   int is_open;
+
+  struct timespec busy_since;
+  unsigned busy_seed;
+  int busy_gave_up; /* the last wait for a lock ran out of time */
 } storage_adapter_data;
 
 storage_interface const * storage_adapter_alloc() {
@@ -49,10 +526,13 @@ storage_interface const * storage_adapter_alloc() {
 
 storage_interface const * storage_adapter_init(storage_interface * adapter) {
   storage_adapter_data * data = malloc(sizeof * data);
+  memset(data, 0, sizeof * data);
+  status_cache_init(&data->statuses);
   ((storage_adapter *)adapter)->data = data;
 
   adapter->create_storage = &create_storage;
   adapter->open_storage = &open_storage;
+  adapter->open_storage_read_only = &open_storage_read_only;
   adapter->close = &close;
   adapter->free = &storage_adapter_free;
 
@@ -64,11 +544,39 @@ storage_interface const * storage_adapter_init(storage_interface * adapter) {
   adapter->count_feels = &count_feels;
 
   adapter->insert_memo = &insert_memo;
+  adapter->count_memos = &count_memos;
+  adapter->search_memos = &search_memos;
+  adapter->maintain_search = &maintain_search;
+
+  adapter->begin_transaction = &begin_transaction;
+  adapter->commit_transaction = &commit_transaction;
+  adapter->rollback_transaction = &rollback_transaction;
+
+  adapter->get_feel_id = &get_feel_id;
+  adapter->import_feel = &import_feel;
+  adapter->restore_feel = &restore_feel;
+  adapter->flush_imports = &flush_imports;
 
   adapter->export = &export;
+  adapter->open_snapshot = &open_snapshot;
 
   adapter->delete_by_id = &delete_by_id;
 
+  adapter->query_rollup = &query_rollup;
+  adapter->resolve_time = &resolve_time;
+
+  adapter->set_durability = &set_durability;
+  adapter->get_durability = &get_durability;
+
+  adapter->set_partitioning = &set_partitioning;
+  adapter->get_partitioning = &get_partitioning;
+  adapter->query_shards = &query_shards;
+  adapter->maintain_shard = &maintain_shard;
+
+  adapter->delete_feels = &delete_feels;
+  adapter->reclaim_space = &reclaim_space;
+  adapter->vacuum = &vacuum;
+
   return adapter;
 }
 
@@ -77,16 +585,61 @@ void storage_adapter_free(storage_interface const * adapter) {
   
   adapter->close(adapter);
   if(((storage_adapter *)adapter)->data) {
+    status_cache_free(&((storage_adapter *)adapter)->data->statuses);
     free(((storage_adapter *)adapter)->data), ((storage_adapter *)adapter)->data = NULL;
   }
   free((storage_adapter *)adapter), adapter = NULL;
 }
 
+static int on_busy(void * context, int attempts) {
+  storage_adapter_data * data = context;
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if(attempts == 0) data->busy_since = now, data->busy_gave_up = 0;
+
+  int64_t waited_us = (int64_t)(now.tv_sec - data->busy_since.tv_sec) * 1000000 + (now.tv_nsec - data->busy_since.tv_nsec) / 1000;
+  if(waited_us >= (int64_t)HIF_BUSY_TIMEOUT_MS * 1000) {
+    data->busy_gave_up = 1;
+    return 0;
+  }
+
+  int64_t delay_us = HIF_BUSY_MAX_DELAY_US;
+  if(attempts < 16 && ((int64_t)HIF_BUSY_FIRST_DELAY_US << attempts) < delay_us) delay_us = (int64_t)HIF_BUSY_FIRST_DELAY_US << attempts;
+  delay_us = delay_us / 2 + rand_r(&data->busy_seed) % (delay_us + 1);
+
+  struct timespec delay = { (time_t)(delay_us / 1000000), (long)(delay_us % 1000000) * 1000 };
+  nanosleep(&delay, NULL);
+
+  return 1;
+}
+
+static void set_busy_handler(storage_interface const * adapter, sqlite3 * db) {
+  storage_adapter_data * data = ((storage_adapter *)adapter)->data;
+
+  /* Processes started together still differ in the nanoseconds */
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  data->busy_seed = (unsigned)now.tv_nsec ^ (unsigned)now.tv_sec;
+  sqlite3_busy_handler(db, &on_busy, data);
+}
+
+/* Failures to write say whether other writers held the lock too long */
+static void report_write_failure(storage_interface const * adapter, char const * what) {
+  storage_adapter_data * data = ((storage_adapter *)adapter)->data;
+
+  if((sqlite3_errcode(data->db) & 0xff) == SQLITE_BUSY && data->busy_gave_up) {
+    fprintf(stderr, "Other writers held the context for over %i seconds; %s was not saved.\n", HIF_BUSY_TIMEOUT_MS / 1000, what);
+  } else {
+    fprintf(stderr, "Failed to save %s: %s\n", what, sqlite3_errmsg(data->db));
+  }
+}
+
+/* Several processes may create the same context at once; the first one
+ * in fills it and the others find it done. */
 static int create_storage(storage_interface const * adapter, char const * context_name) {
   char * err_msg = NULL;
 
-  (void)adapter;
-
   if(!context_name) context_name = "hif.db";
 
   char const * config_path = get_config_path();
@@ -99,9 +652,12 @@ static int create_storage(storage_interface const * adapter, char const * contex
     (void)db;
     goto err0;
   }
+  set_busy_handler(adapter, db);
 
   asprintf(&sql, 
     "pragma encoding = utf8;" \
+    "pragma auto_vacuum = incremental;" \
+    "begin immediate;" \
     "create table if not exists hif_statuses ("\
       "status_id integer primary key, status text unique not null, description text"\
     "); " \
@@ -112,26 +668,30 @@ static int create_storage(storage_interface const * adapter, char const * contex
     "); " \
     "create index if not exists hif_feels_feel_inx on hif_feels(feel); " \
     \
-    "insert into hif_statuses (status, description) values ('sad', ':(');" \
-    "insert into hif_statuses (status, description) values ('meh', ':|');" \
-    "insert into hif_statuses (status, description) values ('tired', '😫');" \
-    "insert into hif_statuses (status, description) values ('anxious', '😰');" \
-    "insert into hif_statuses (status, description) values ('woo', ':)');" \
-    "insert into hif_statuses (status, description) values ('shrug', '🤷 ¯\\_(ツ)_/¯');" \
+    "insert or ignore into hif_statuses (status, description) values ('sad', ':(');" \
+    "insert or ignore into hif_statuses (status, description) values ('meh', ':|');" \
+    "insert or ignore into hif_statuses (status, description) values ('tired', '😫');" \
+    "insert or ignore into hif_statuses (status, description) values ('anxious', '😰');" \
+    "insert or ignore into hif_statuses (status, description) values ('woo', ':)');" \
+    "insert or ignore into hif_statuses (status, description) values ('shrug', '🤷 ¯\\_(ツ)_/¯');" \
     \
     "create table if not exists hif_contexts (" \
       "context_id integer primary key, name text not null, path text not null" \
     ");" \
     "create index if not exists hif_contexts_name_inx on hif_contexts(name);" \
-    "insert into hif_contexts (name, path) values ('%s', '%s');" \
+    "insert into hif_contexts (name, path) select '%s', '%s' where not exists (select 1 from hif_contexts);" \
     \
     "create table if not exists hif_memos (" \
       "memo_id integer primary key, memo text not null, dtm int not null" \
-    ");"
+    ");" \
+    "commit;"
     , context_name, path);
 
   rc = sqlite3_exec(db, sql, NULL, 0, &err_msg);  
-  if(rc != SQLITE_OK) goto err1;
+  if(rc != SQLITE_OK) {
+    sqlite3_exec(db, "rollback;", NULL, 0, NULL);
+    goto err1;
+  }
 
   goto err0;
 
@@ -148,28 +708,153 @@ err0:
   return rc;
 }
 
-static int open_storage(storage_interface const * adapter, char const * context_name) {
+static int get_user_version(sqlite3 * db, int * version) {
+  sqlite3_stmt * stmt = NULL;
+  int rc = sqlite3_prepare_v2(db, "pragma user_version;", -1, &stmt, NULL);
+  if(rc != SQLITE_OK) return rc;
+
+  rc = sqlite3_step(stmt);
+  if(rc == SQLITE_ROW) {
+    *version = sqlite3_column_int(stmt, 0);
+    rc = SQLITE_OK;
+  }
+  sqlite3_finalize(stmt);
+
+  return rc;
+}
+
+/* Each step re-reads the version under a write lock, so two processes
+ * opening an old context at once apply every migration exactly once. */
+static int has_fts5() {
+  return sqlite3_compileoption_used("ENABLE_FTS5");
+}
+
+static int migrate_storage(sqlite3 * db) {
+  static const int MIGRATIONS_LEN = (int)(sizeof(MIGRATIONS) / sizeof(*MIGRATIONS));
+
+  int version = 0;
+  int rc = get_user_version(db, &version);
+  if(rc != SQLITE_OK || version >= MIGRATIONS_LEN) return rc;
+
+  char * err_msg = NULL;
+  char * sql = NULL;
+  while(rc == SQLITE_OK && version < MIGRATIONS_LEN) {
+    rc = sqlite3_exec(db, "begin immediate;", NULL, 0, &err_msg);
+    if(rc != SQLITE_OK) goto err0;
+
+    rc = get_user_version(db, &version);
+    if(rc != SQLITE_OK || version >= MIGRATIONS_LEN) goto err1;
+
+    char const * migration = version == HIF_SEARCH_MIGRATION && !has_fts5() ? "" : MIGRATIONS[version];
+    asprintf(&sql, "%s pragma user_version = %i;", migration, version + 1);
+    rc = sqlite3_exec(db, sql, NULL, 0, &err_msg);
+    free(sql), sql = NULL;
+    if(rc != SQLITE_OK) goto err1;
+
+    rc = sqlite3_exec(db, "commit;", NULL, 0, &err_msg);
+    if(rc != SQLITE_OK) goto err1;
+
+    version++;
+  }
+
+  return rc;
+
+err1:
+  sqlite3_exec(db, rc == SQLITE_OK ? "commit;" : "rollback;", NULL, 0, NULL);
+err0:
+  if(err_msg) {
+    fprintf(stderr, "Failed to migrate context to version %i: %s\n", version + 1, err_msg);
+    sqlite3_free(err_msg), err_msg = NULL;
+  }
+  return rc;
+}
+
+/* SQLITE_SCHEMA while migrations are pending */
+static int check_migrated(sqlite3 * db) {
+  int version = 0;
+  int rc = get_user_version(db, &version);
+  if(rc == SQLITE_OK && version < (int)(sizeof(MIGRATIONS) / sizeof(*MIGRATIONS))) rc = SQLITE_SCHEMA;
+
+  return rc;
+}
+
+/* A read-only context is neither migrated nor moved to its durability's
+ * journal mode, so reading it never writes to it. */
+static int open_context(storage_interface const * adapter, char const * context_name, int read_only) {
   if(!context_name) context_name = "hif.db";
 
+  storage_adapter_data * data = ((storage_adapter *)adapter)->data;
   char * path = alloc_concat_path(get_config_path(), context_name);
 
-  int rc = sqlite3_open(path, &((storage_adapter *)adapter)->data->db);
+  TRACE_START(started);
+  /* URI filenames let shards be attached read-only */
+  int flags = read_only ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+  int rc = sqlite3_open_v2(path, &data->db, flags | SQLITE_OPEN_URI, NULL);
   if(rc != SQLITE_OK) goto err0;
+  set_busy_handler(adapter, data->db);
+  TRACE_PHASE("sqlite_open", started);
+
+  data->is_open = 1;
+  data->path = path;
+  data->name = strdup(context_name);
+  if(!data->name) abort();
+
+  TRACE_START(migrate_started);
+  rc = read_only ? check_migrated(data->db) : migrate_storage(data->db);
+  if(rc != SQLITE_OK) goto err1;
+  TRACE_PHASE("migrate", migrate_started);
+
+  TRACE_START(durability_started);
+  if(read_only) {
+    data->durability = get_saved_durability(adapter);
+  } else if(!set_durability(adapter, STORAGE_DURABILITY_DEFAULT, 0)) {
+    rc = SQLITE_ERROR;
+    goto err1;
+  }
+  TRACE_PHASE("durability", durability_started);
+
+  data->partitioning = get_saved_partitioning(adapter);
+
+  return rc;
 
+err1:
+  close(adapter);
+  return rc;
 err0:
+  sqlite3_close(data->db), data->db = NULL;
   free(path), path = NULL;
   return rc;
 }
 
+static int open_storage(storage_interface const * adapter, char const * context_name) {
+  return open_context(adapter, context_name, 0);
+}
+
+static int open_storage_read_only(storage_interface const * adapter, char const * context_name) {
+  return open_context(adapter, context_name, 1);
+}
+
 static int close(storage_interface const * adapter) {
   int ret = -1;
   if(adapter && ((storage_adapter *)adapter)->data) {
     storage_adapter_data * data = ((storage_adapter *)adapter)->data;
     if(data->is_open) {
+      for(size_t i = 0; i < STORAGE_STATEMENT_EOF; i++) {
+        sqlite3_finalize(data->statements[i]), data->statements[i] = NULL;
+      }
+
       sqlite3 *db = data->db;
       if(db) {
+        if(trace_enabled) trace_db(db);
+        metrics_count_rows_written(sqlite3_total_changes64(db));
         ret = sqlite3_close(db);
       }
+      free(data->path), data->path = NULL;
+      free(data->name), data->name = NULL;
+      data->current_month = 0;
+      data->deferred_count = 0;
+      data->has_import_staging = 0;
+      status_cache_clear(&data->statuses);
       data->is_open = 0;
     }
   }  
@@ -177,79 +862,160 @@ static int close(storage_interface const * adapter) {
   return ret == SQLITE_OK;;
 }
 
-static int get_feel_description(storage_interface const * adapter,  char const * feel, char **description) {
-  char const * sql = "select description from hif_statuses where status = ?;";
+static sqlite3_stmt * get_statement(storage_interface const * adapter, storage_statement which) {
+  storage_adapter_data * data = ((storage_adapter *)adapter)->data;
 
-  sqlite3_stmt * stmt = NULL;
-  int rc = sqlite3_prepare_v2(((storage_adapter *)adapter)->data->db, sql, -1, &stmt, NULL);
-  if(rc != SQLITE_OK) goto err0;
+  sqlite3_stmt * stmt = data->statements[which];
+  if(!stmt) {
+    TRACE_START(started);
+    int rc = sqlite3_prepare_v3(data->db, STATEMENT_SQL[which], -1, SQLITE_PREPARE_PERSISTENT, &stmt, NULL);
+    if(rc != SQLITE_OK) return NULL;
+    data->statements[which] = stmt;
+    TRACE_PHASE("prepare", started);
+  }
 
-  rc = sqlite3_bind_text(stmt, 1, feel, -1, SQLITE_STATIC);
-  if(rc != SQLITE_OK) goto err1;
+  if(trace_enabled) trace_statement_begin(stmt);
 
-  rc = sqlite3_step(stmt);
-  if(rc == SQLITE_ROW) {
-    char const * desc = (char const *)sqlite3_column_text(stmt, 0);
-    if(desc) *description = strdup(desc);
-    rc = SQLITE_OK;
+  return stmt;
+}
+
+/* Resetting also releases any read transaction a select left open */
+static void release_statement(sqlite3_stmt * stmt) {
+  if(!stmt) return;
+
+  if(trace_enabled) trace_statement_end(stmt);
+
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+}
+
+static int get_data_version(storage_interface const * adapter, sqlite3_int64 * version) {
+  sqlite3_stmt * stmt = get_statement(adapter, STORAGE_STATEMENT_DATA_VERSION);
+  if(!stmt) return 0;
+
+  int found = sqlite3_step(stmt) == SQLITE_ROW;
+  if(found) *version = sqlite3_column_int64(stmt, 0);
+
+  release_statement(stmt);
+
+  return found;
+}
+
+static int load_statuses(storage_interface const * adapter) {
+  storage_adapter_data * data = ((storage_adapter *)adapter)->data;
+
+  status_cache_clear(&data->statuses);
+  if(!get_data_version(adapter, &data->statuses_data_version)) return 0;
+
+  sqlite3_stmt * stmt = get_statement(adapter, STORAGE_STATEMENT_LOAD_STATUSES);
+  if(!stmt) return 0;
+
+  int rc;
+  while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    status_cache_put(&data->statuses, sqlite3_column_int(stmt, 0),
+      (char const *)sqlite3_column_text(stmt, 1), (char const *)sqlite3_column_text(stmt, 2));
   }
 
-err1:
-  sqlite3_finalize(stmt);
+  release_statement(stmt);
 
-err0:
-  return rc;
+  data->statuses.is_loaded = rc == SQLITE_DONE;
+  return data->statuses.is_loaded;
+}
+
+/* A miss reloads at most once, and only when another connection has
+ * committed since the cache was loaded. */
+static status_entry const * lookup_status(storage_interface const * adapter, char const * feel) {
+  storage_adapter_data * data = ((storage_adapter *)adapter)->data;
+  if(!feel) return NULL;
+
+  if(!data->statuses.is_loaded && !load_statuses(adapter)) return NULL;
+
+  status_entry const * status = status_cache_get(&data->statuses, feel);
+  if(status) return status;
+
+  sqlite3_int64 version = 0;
+  if(!get_data_version(adapter, &version) || version == data->statuses_data_version) return NULL;
+  if(!load_statuses(adapter)) return NULL;
+
+  return status_cache_get(&data->statuses, feel);
 }
 
+static int get_feel_description(storage_interface const * adapter,  char const * feel, char **description) {
+  status_entry const * status = lookup_status(adapter, feel);
+  if(!status) return SQLITE_NOTFOUND;
+
+  if(status->description) *description = strdup(status->description);
+
+  return SQLITE_OK;
+}
+
+static sqlite3_int64 now_microseconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (sqlite3_int64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Unknown emotions fail before anything is written. A partitioned context
+ * whose shard cannot be attached keeps the feel itself, where every query
+ * still finds it. */
 static int insert_feel(storage_interface const * adapter, char const * feel, char **description) {
-  char const * sql = "insert into hif_feels (feel, dtm) values (" \
-    "(select status_id from hif_statuses where status = ?), datetime('now')" \
-    ");";
-  
   if(!feel) return -1;
-  
-  sqlite3_stmt * stmt = NULL;
-  int rc = sqlite3_prepare_v2(((storage_adapter *)adapter)->data->db, sql, -1, &stmt, NULL);
+
+  status_entry const * status = lookup_status(adapter, feel);
+  if(!status) return 0;
+
+  sqlite3_int64 now = now_microseconds();
+  int sharded = ((storage_adapter *)adapter)->data->partitioning == STORAGE_PARTITIONING_MONTHLY
+    && attach_current_shard(adapter, now);
+
+  sqlite3_stmt * stmt = get_statement(adapter, sharded ? STORAGE_STATEMENT_INSERT_SHARD_FEEL : STORAGE_STATEMENT_INSERT_FEEL);
+  if(!stmt) return 0;
+
+  int rc = sqlite3_bind_int(stmt, 1, status->id);
   if(rc != SQLITE_OK) goto err0;
 
-  rc = sqlite3_bind_text(stmt, 1, feel, -1, SQLITE_STATIC);
-  if(rc != SQLITE_OK) goto err1;
+  rc = sqlite3_bind_int64(stmt, 2, now);
+  if(rc != SQLITE_OK) goto err0;
 
   rc = sqlite3_step(stmt);
-  if(rc != SQLITE_DONE) goto err1;
+  if(rc != SQLITE_DONE) {
+    report_write_failure(adapter, "the feel");
+    goto err0;
+  }
 
-  rc = adapter->get_feel_description(adapter, feel, description);
+  rc = SQLITE_OK;
+  if(status->description) *description = strdup(status->description);
 
-err1:  
-  sqlite3_finalize(stmt), stmt = NULL;
 err0:
+  release_statement(stmt);
 
   return rc == SQLITE_OK;
 }
 
 static int create_feel(storage_interface const * adapter, char const * feel, char const * description) {
-  char const * sql = "insert into hif_statuses (status, description) values (?, ?);";
-  
   if(!feel) return -1;
-  
-  sqlite3_stmt * stmt = NULL;
-  int rc = sqlite3_prepare_v2(((storage_adapter *)adapter)->data->db, sql, -1, &stmt, NULL);
-  if(rc != SQLITE_OK) goto err0;
 
-  rc = sqlite3_bind_text(stmt, 1, feel, -1, SQLITE_STATIC);
-  if(rc != SQLITE_OK) goto err1;
+  sqlite3_stmt * stmt = get_statement(adapter, STORAGE_STATEMENT_CREATE_FEEL);
+  if(!stmt) return 0;
+
+  int rc = sqlite3_bind_text(stmt, 1, feel, -1, SQLITE_STATIC);
+  if(rc != SQLITE_OK) goto err0;
 
   rc = sqlite3_bind_text(stmt, 2, description, -1, SQLITE_STATIC);
-  if(rc != SQLITE_OK) goto err1;
+  if(rc != SQLITE_OK) goto err0;
 
+  /* A duplicate is the caller's to report */
   rc = sqlite3_step(stmt);
-  if(rc != SQLITE_DONE) goto err1;
+  if(rc != SQLITE_DONE) {
+    if((rc & 0xff) != SQLITE_CONSTRAINT) report_write_failure(adapter, "the emotion");
+    goto err0;
+  }
 
-  rc = SQLITE_OK;
+  status_cache_clear(&((storage_adapter *)adapter)->data->statuses);
+  rc = sync_shard_statuses(adapter) ? SQLITE_OK : SQLITE_ERROR;
 
-err1:
-  sqlite3_finalize(stmt), stmt = NULL;
 err0:
+  release_statement(stmt);
 
   return rc == SQLITE_OK;
 }
@@ -258,245 +1024,1220 @@ static int delete_feel(storage_interface const * adapter, int id, int * affected
   return delete_by_id(adapter, "hif_feels", id, affected_rows);
 }
 
-static int query_table_row_count(sqlite3 * db, const char * table_name) {
-  int count = -1;
-  char * sql = NULL;
-  sqlite3_stmt * stmt = NULL;
+/* Returns -1 on failure, or when a named status does not exist */
+static int64_t query_count(storage_interface const * adapter, storage_statement which, char const * feel, time_range const * range) {
+  int64_t count = -1;
 
-  asprintf(&sql, "select count(*) from %s;", table_name);
+  sqlite3_stmt * stmt = get_statement(adapter, which);
+  if(!stmt) return count;
 
-  int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+  int rc = SQLITE_OK;
+  if(feel) rc = sqlite3_bind_text(stmt, 1, feel, -1, SQLITE_STATIC);
+  if(range && rc == SQLITE_OK) rc = sqlite3_bind_int64(stmt, 2, range->since);
+  if(range && rc == SQLITE_OK) rc = sqlite3_bind_int64(stmt, 3, range->until);
 
-  if(rc != SQLITE_OK) goto err0;
-  
-  while(sqlite3_step(stmt) == SQLITE_ROW) {
-    count = sqlite3_column_int(stmt, 0);
+  if(rc == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+    count = sqlite3_column_int64(stmt, 0);
   }
 
-  sqlite3_finalize(stmt);
-
-err0:
-  free(sql), sql = NULL;
+  release_statement(stmt);
 
   return count;
 }
 
-static int count_feels(storage_interface const * adapter) {
-  int count = query_table_row_count(((storage_adapter *)adapter)->data->db, "hif_feels");
-  return count;
-}
+static int64_t count_feels(storage_interface const * adapter, char const * feel, time_range const * range) {
+  storage_statement which = feel
+    ? (range ? STORAGE_STATEMENT_COUNT_STATUS_FEELS_BETWEEN : STORAGE_STATEMENT_COUNT_STATUS_FEELS)
+    : (range ? STORAGE_STATEMENT_COUNT_FEELS_BETWEEN : STORAGE_STATEMENT_COUNT_FEELS);
 
-static int to_kvp(char const * key, char const * value, int is_numeric) {
-  fprintf(stdout, "\"%s\": ", key);
-  if(is_numeric) {
-    fprintf(stdout, "%s", value);
-  } else {
-    fprintf(stdout, "\"%s\"", value);
-  }
+  int64_t count = query_count(adapter, which, feel, range);
+  if(!range || count < 0) return count;
 
-  return 0;
+  int64_t sharded = count_shard_feels(adapter, feel, range);
+  return sharded < 0 ? -1 : count + sharded;
 }
 
-static int get_escape_character_count(unsigned char const * source, size_t source_len) {
-  size_t len = source_len;
-
-  unsigned char const * c = source;
-  do {
-    switch(*c) {
-      case '\\':
-      case '"':
-      case '\b':
-      case '\t':
-      case '\n':
-      case '\f':
-      case '\r':
-        len += 1;
-        break;
-      default:
-        if(*c <= 32) {
-          len += sizeof("\\u0000") - 1;
-        }
-        break;
-    }
-  } while(++c && *c);
-
-  return len;
+static int64_t count_memos(storage_interface const * adapter, time_range const * range) {
+  return query_count(adapter, range ? STORAGE_STATEMENT_COUNT_MEMOS_BETWEEN : STORAGE_STATEMENT_COUNT_MEMOS, NULL, range);
 }
 
-static char * alloc_json_escape_string(unsigned char const * source) {
-  if(!source) return NULL;
+static int search_memos(storage_interface const * adapter, char const * query, time_range const * range, int limit, memo_handler handler, void * context) {
+  if(!query || !*query) return 0;
+  if(!has_fts5()) {
+    fprintf(stderr, "Memo search is unavailable; sqlite was built without FTS5.\n");
+    return 0;
+  }
 
-  size_t source_len = strlen((char const *)source) + 1;
-  size_t len = get_escape_character_count(source, source_len);
-  
-  char * dest = malloc(len);
-  if(!dest) return NULL;
-
-  if(len == source_len) {
-    memcpy(dest, source, source_len);
-    dest[source_len - 1] = 0;
-    return dest;
-  }
-
-  char * d = dest;
-  unsigned char const * c = source;
-  do {
-    switch(*c) {
-      case '\\':
-      case '"':
-      case '\b':
-      case '\t':
-      case '\n':
-      case '\f':
-      case '\r':
-        *d = '\\'; ++d;
-        *d = *c;
-        break;
-      default:
-        if((*c <= 31) || (*c == '\"') || (*c == '\\')) {
-          *d = '\\'; ++d; *d = 'u'; ++d;
-          sprintf(d, "%04x", *c);
-                          d += 4;
-        } else {
-          *d = *c;
-        }
-        break;
+  sqlite3_stmt * stmt = get_statement(adapter, STORAGE_STATEMENT_SEARCH_MEMOS);
+  if(!stmt) {
+    fprintf(stderr, "The context has no memo index yet; run hif search-index rebuild.\n");
+    return 0;
+  }
+
+  int rc = sqlite3_bind_text(stmt, 1, query, -1, SQLITE_STATIC);
+  if(rc == SQLITE_OK) rc = sqlite3_bind_int64(stmt, 2, range ? range->since : HIF_TIME_MIN);
+  if(rc == SQLITE_OK) rc = sqlite3_bind_int64(stmt, 3, range ? range->until : HIF_TIME_MAX);
+  if(rc == SQLITE_OK) rc = sqlite3_bind_int(stmt, 4, limit > 0 ? limit : -1);
+  if(rc != SQLITE_OK) goto err0;
+
+  while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    if(!handler(context, sqlite3_column_int64(stmt, 0), (char const *)sqlite3_column_text(stmt, 1), (char const *)sqlite3_column_text(stmt, 2))) {
+      rc = SQLITE_DONE;
+      break;
     }
-  } while(++d, ++c && *c);
-  *d = 0;
+  }
+
+  if(rc == SQLITE_DONE) rc = SQLITE_OK;
+
+err0:
+  release_statement(stmt);
 
-  return dest;
+  return rc == SQLITE_OK;
 }
 
-static int export(storage_interface const * adapter, kvp_handler kvp) {
-  int count = count_feels(adapter);
-  if(count < 0) { exit(-1); }
+/* A cursor never moves back, even once the newest memo is deleted and its
+ * id is free again; a tombstone past the newest one is from elsewhere. */
+static int read_export_cursor(storage_interface const * adapter, export_cursor const * since, export_cursor * until) {
+  sqlite3_stmt * stmt = get_statement(adapter, STORAGE_STATEMENT_EXPORT_CURSOR);
+  if(!stmt) return 0;
+
+  int ok = sqlite3_step(stmt) == SQLITE_ROW;
+  if(ok) {
+    until->feel_id = sqlite3_column_int64(stmt, 0);
+    until->memo_id = sqlite3_column_int64(stmt, 1);
+    until->tombstone_id = sqlite3_column_int64(stmt, 2);
+  }
+  release_statement(stmt);
 
-  sqlite3_stmt * stmt = NULL;
-  sqlite3 *db = ((storage_adapter *)adapter)->data->db;
+  if(ok && since->tombstone_id > until->tombstone_id) {
+    fprintf(stderr, "The cursor is ahead of this context; was it taken from another one?\n");
+    return 0;
+  }
+  if(since->feel_id > until->feel_id) until->feel_id = since->feel_id;
+  if(since->memo_id > until->memo_id) until->memo_id = since->memo_id;
 
-  if(!kvp) kvp = &to_kvp;
+  return ok;
+}
 
-  char * sql = "select f.feel_id 'id', s.status 'feel', s.description 'description', f.dtm 'datetime' "\
-          "from hif_feels f inner join hif_statuses s on f.feel = s.status_id;";
+/* Shards overlapping the range are exported after their context as
+ * contexts of their own, each on its own thread. Changes since a cursor are
+ * read from the context in one transaction, so the new cursor matches what
+ * was exported; see export_changes for the shards. */
+static int export(storage_interface const * adapter, export_options const * options) {
+  storage_adapter_data * data = ((storage_adapter *)adapter)->data;
+
+  export_options partitioned = { NULL, 1, NULL, EXPORT_FORMAT_JSON, NULL, 0, NULL, NULL, EXPORT_COMPRESSION_NONE };
+  if(options) partitioned = *options;
+  if(partitioned.kvp) return export_feels(data->db, data->path, &partitioned);
+
+  int in_transaction = !sqlite3_get_autocommit(data->db);
+  export_cursor until;
+  if(partitioned.since) {
+    if(!in_transaction && !exec_sql(adapter, "begin;")) return SQLITE_ERROR;
+    if(!read_export_cursor(adapter, partitioned.since, &until)) {
+      if(!in_transaction) exec_sql(adapter, "rollback;");
+      return SQLITE_ERROR;
+    }
+    partitioned.until = &until;
+  }
 
-  fprintf(stdout, "{\n");
-  fprintf(stdout, "\t\"feels\": [");
-  if(count > 0) fprintf(stdout, "\n");
-  int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-  if(rc != SQLITE_OK) goto err2;
+  char * const * contexts = partitioned.contexts ? partitioned.contexts : &data->name;
+  size_t count = partitioned.contexts ? partitioned.context_count : 1;
 
-  int i = 0;
-  int col_count = sqlite3_column_count(stmt);
+  size_t partition_count = 0;
+  char ** partitions = alloc_partition_names(contexts, count, partitioned.range,
+    partitioned.since ? partitioned.since->feel_id + 1 : INT64_MIN, &partition_count);
+  if(partition_count > count) {
+    partitioned.contexts = partitions;
+    partitioned.context_count = partition_count;
+  }
 
-  while(sqlite3_step(stmt) == SQLITE_ROW) {
-    int col = 0;
+  int rc = export_feels(data->db, data->path, &partitioned);
+  free_context_names(partitions, partition_count);
 
-    fprintf(stdout, "\t\t{ ");
-    while(col < col_count) {
-      unsigned char const * key = (unsigned char const *)sqlite3_column_name(stmt, col);
-      unsigned char const * value = (unsigned char const *)sqlite3_column_text(stmt, col);
+  if(partitioned.since && !in_transaction) exec_sql(adapter, "commit;");
 
-      char * escaped_key = alloc_json_escape_string(key);
-      char * escaped_value = alloc_json_escape_string(value);
-      int type = sqlite3_column_type(stmt, col);
+  return rc;
+}
 
-      kvp(escaped_key, escaped_value, (type == SQLITE_INTEGER || type == SQLITE_FLOAT));
-    
-      free(escaped_key), escaped_key = NULL;
-      free(escaped_value), escaped_value = NULL;
-      if(col < col_count - 1) fprintf(stdout, ", ");
-      col++;
-    }
-    i++;
-    if(i < count - 1) fprintf(stdout, " },\n");
-    else fprintf(stdout, " }\n");
+/* The cursor and the rows the snapshot copies come from one read
+ * transaction, so the snapshot matches its stamp. */
+static snapshot * open_snapshot(storage_interface const * adapter) {
+  storage_adapter_data * data = ((storage_adapter *)adapter)->data;
 
-  }
+  int in_transaction = !sqlite3_get_autocommit(data->db);
+  if(!in_transaction && !exec_sql(adapter, "begin;")) return NULL;
 
-  sqlite3_finalize(stmt);
-  if(count > 0) fprintf(stdout, "\t");
-  fprintf(stdout, "]\n");
-  fprintf(stdout, "}\n");
+  export_cursor const since = { 0, 0, 0 };
+  export_cursor until;
+  snapshot * result = NULL;
+  if(read_export_cursor(adapter, &since, &until)) result = snapshot_update(data->db, data->name, &until);
 
-err2:
-  return rc;
+  if(!in_transaction) exec_sql(adapter, "commit;");
+
+  return result;
 }
 
 static int insert_memo(storage_interface const * adapter, char const * memo, int * affected_rows) {
-  char const * sql = "insert into hif_memos (memo, dtm) values (?, datetime('now'));";
-
-  sqlite3_stmt * stmt = NULL;
+  sqlite3_stmt * stmt = get_statement(adapter, STORAGE_STATEMENT_INSERT_MEMO);
+  if(!stmt) return 0;
 
-  int rc = sqlite3_prepare_v2(((storage_adapter *)adapter)->data->db, sql, -1, &stmt, NULL);
+  int rc = sqlite3_bind_text(stmt, 1, memo, -1, SQLITE_STATIC);
   if(rc != SQLITE_OK) goto err0;
 
-  rc = sqlite3_bind_text(stmt, 1, memo, -1, SQLITE_STATIC);
-  if(rc != SQLITE_OK) goto err1;
+  rc = sqlite3_bind_int64(stmt, 2, now_microseconds());
+  if(rc != SQLITE_OK) goto err0;
 
   rc = sqlite3_step(stmt);
-  if(rc != SQLITE_DONE) goto err1;
+  if(rc != SQLITE_DONE) {
+    report_write_failure(adapter, "the memo");
+    goto err0;
+  }
 
   *affected_rows = sqlite3_changes(((storage_adapter *)adapter)->data->db);
 
   rc = SQLITE_OK;
-err1:
-  sqlite3_finalize(stmt);
 
 err0:
+  release_statement(stmt);
+
   return rc == SQLITE_OK;
 }
 
-static int is_table_name_valid(char const * table_name) {
-  /* Assumes *ACCEPTABLE_TABLES is max strlen() of ACCEPTABLE_TABLES[] */
-  const char * ACCEPTABLE_TABLES[] = {"hif_feels", "hif_memos" };
+static storage_statement get_delete_statement(char const * table_name) {
+  static const struct {
+    char const * table_name;
+    storage_statement statement;
+  } ACCEPTABLE_TABLES[] = {
+    { "hif_feels", STORAGE_STATEMENT_DELETE_FEEL },
+    { "hif_memos", STORAGE_STATEMENT_DELETE_MEMO }
+  };
   const size_t ACCEPTABLE_TABLES_LEN = sizeof(ACCEPTABLE_TABLES) / sizeof(*ACCEPTABLE_TABLES);
-  const size_t MAX_TABLE_NAME_LEN = sizeof(*ACCEPTABLE_TABLES) - 1;
 
-  if(!table_name) return false;
+  if(!table_name) return STORAGE_STATEMENT_EOF;
 
-  bool found = false;
   for(size_t i = 0; i < ACCEPTABLE_TABLES_LEN; i++) {
-    if(strncmp(table_name, ACCEPTABLE_TABLES[i], MAX_TABLE_NAME_LEN) == 0) {
-      found = true;
-      break;
+    if(strcmp(table_name, ACCEPTABLE_TABLES[i].table_name) == 0) {
+      return ACCEPTABLE_TABLES[i].statement;
     }
   }
 
-  return found;
+  return STORAGE_STATEMENT_EOF;
 }
 
 static int delete_by_id(storage_interface const * adapter, char const * table_name,  int id, int * affected_rows) {
-  int found = is_table_name_valid(table_name);
-  if(!found) abort();
-
-  int rc = -1;
+  storage_statement which = get_delete_statement(table_name);
+  if(which == STORAGE_STATEMENT_EOF) abort();
 
-  char * sql = NULL;
-  asprintf(&sql, "delete from %s where rowid = ?;", table_name);
-  if(!sql) goto err0;
-
-  sqlite3_stmt * stmt = NULL;
-  rc = sqlite3_prepare_v2(((storage_adapter *)adapter)->data->db, sql, -1, &stmt, NULL);
-  if(rc != SQLITE_OK) goto err1;
+  sqlite3_stmt * stmt = get_statement(adapter, which);
+  if(!stmt) return 0;
 
-  rc = sqlite3_bind_int(stmt, 1, id);
-  if(rc != SQLITE_OK) goto err2;
+  int rc = sqlite3_bind_int(stmt, 1, id);
+  if(rc != SQLITE_OK) goto err0;
 
   rc = sqlite3_step(stmt);
-  if(rc != SQLITE_DONE) goto err2;
+  if(rc != SQLITE_DONE) {
+    report_write_failure(adapter, "the delete");
+    goto err0;
+  }
 
   *affected_rows = sqlite3_changes(((storage_adapter *)adapter)->data->db);
 
   rc = SQLITE_OK;
 
-err2:
-  sqlite3_finalize(stmt);
+err0:
+  release_statement(stmt);
 
-err1:
-  free(sql), sql = NULL;
+  if(rc == SQLITE_OK && *affected_rows == 0 && which == STORAGE_STATEMENT_DELETE_FEEL) return delete_shard_feel(adapter, id, affected_rows);
+
+  return rc == SQLITE_OK;
+}
+
+static int exec_sql(storage_interface const * adapter, char const * sql) {
+  char * err_msg = NULL;
+
+  int rc = sqlite3_exec(((storage_adapter *)adapter)->data->db, sql, NULL, 0, &err_msg);
+  if(rc == SQLITE_BUSY && ((storage_adapter *)adapter)->data->busy_gave_up) {
+    fprintf(stderr, "Other writers held the context for over %i seconds; gave up on '%s'.\n", HIF_BUSY_TIMEOUT_MS / 1000, sql);
+    sqlite3_free(err_msg), err_msg = NULL;
+  } else if(rc != SQLITE_OK) {
+    fprintf(stderr, "Failed to execute '%s': %s\n", sql, err_msg);
+    sqlite3_free(err_msg), err_msg = NULL;
+  }
 
-err0:
   return rc == SQLITE_OK;
 }
 
+/* The shard is swapped only outside of transactions, so it is attached
+ * beforehand for the writes to come */
+static int begin_transaction(storage_interface const * adapter) {
+  if(((storage_adapter *)adapter)->data->partitioning == STORAGE_PARTITIONING_MONTHLY) attach_current_shard(adapter, now_microseconds());
+
+  return exec_sql(adapter, "begin immediate;");
+}
+
+static int commit_transaction(storage_interface const * adapter) {
+  int ok = exec_sql(adapter, "commit;");
+  detach_deferred_shards(adapter);
+
+  return ok;
+}
+
+/* Statuses created inside the transaction are gone again */
+static int rollback_transaction(storage_interface const * adapter) {
+  status_cache_clear(&((storage_adapter *)adapter)->data->statuses);
+
+  int ok = exec_sql(adapter, "rollback;");
+  detach_deferred_shards(adapter);
+
+  return ok;
+}
+
+static int maintain_search(storage_interface const * adapter, storage_search_task task) {
+  static char const * const TASK_SQL[] = {
+    HIF_SEARCH_INDEX_SQL, /* STORAGE_SEARCH_REBUILD, creating the index if need be */
+    "insert into hif_memos_search (hif_memos_search) values ('optimize');" /* STORAGE_SEARCH_OPTIMIZE */
+  };
+  _Static_assert(sizeof(TASK_SQL) / sizeof(*TASK_SQL) == STORAGE_SEARCH_EOF, "TASK_SQL must match storage_search_task");
+
+  if(task < STORAGE_SEARCH_REBUILD || task >= STORAGE_SEARCH_EOF) return 0;
+  if(!has_fts5()) {
+    fprintf(stderr, "Memo search is unavailable; sqlite was built without FTS5.\n");
+    return 0;
+  }
+
+  return exec_sql(adapter, TASK_SQL[task]);
+}
+
+static int get_feel_id(storage_interface const * adapter, char const * feel, int * id) {
+  status_entry const * status = lookup_status(adapter, feel);
+  if(!status) return 0;
+
+  *id = status->id;
+
+  return 1;
+}
+
+static int is_epoch_timestamp(char const * dtm) {
+  char * end = NULL;
+  strtod(dtm, &end);
+  return end != dtm && *end == '\0';
+}
+
+static sqlite3_int64 epoch_seconds_to_microseconds(char const * dtm) {
+  double seconds = strtod(dtm, NULL);
+  return (sqlite3_int64)(seconds * 1000000 + (seconds < 0 ? -0.5 : 0.5));
+}
+
+/* Timestamps are either epoch seconds or anything sqlite's strftime() accepts;
+ * a missing timestamp means now. Text is converted by HIF_IMPORT_DTM. */
+static int bind_timestamp(sqlite3_stmt * stmt, int index, char const * dtm) {
+  if(!dtm || !*dtm) return sqlite3_bind_int64(stmt, index, now_microseconds());
+  if(is_epoch_timestamp(dtm)) return sqlite3_bind_int64(stmt, index, epoch_seconds_to_microseconds(dtm));
+
+  return sqlite3_bind_text(stmt, index, dtm, -1, SQLITE_STATIC);
+}
+
+static int query_rollup(storage_interface const * adapter, storage_rollup rollup, int64_t first_day, rollup_handler handler, void * context) {
+  static const storage_statement ROLLUP_STATEMENTS[] = {
+    STORAGE_STATEMENT_ROLLUP_STATUS, /* STORAGE_ROLLUP_STATUS */
+    STORAGE_STATEMENT_ROLLUP_HOUR, /* STORAGE_ROLLUP_HOUR */
+    STORAGE_STATEMENT_ROLLUP_DAY, /* STORAGE_ROLLUP_DAY */
+    STORAGE_STATEMENT_ROLLUP_ACTIVE_DAY /* STORAGE_ROLLUP_ACTIVE_DAY */
+  };
+  _Static_assert(sizeof(ROLLUP_STATEMENTS) / sizeof(*ROLLUP_STATEMENTS) == STORAGE_ROLLUP_EOF, "ROLLUP_STATEMENTS must match storage_rollup");
+
+  if(rollup < STORAGE_ROLLUP_STATUS || rollup >= STORAGE_ROLLUP_EOF) return 0;
+
+  sqlite3_stmt * stmt = get_statement(adapter, ROLLUP_STATEMENTS[rollup]);
+  if(!stmt) return 0;
+
+  int rc = SQLITE_OK;
+  if(rollup == STORAGE_ROLLUP_DAY || rollup == STORAGE_ROLLUP_ACTIVE_DAY) rc = sqlite3_bind_int64(stmt, 1, first_day);
+  if(rc != SQLITE_OK) goto err0;
+
+  while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    if(!handler(context, sqlite3_column_int64(stmt, 0), (char const *)sqlite3_column_text(stmt, 1), sqlite3_column_int64(stmt, 2))) {
+      rc = SQLITE_DONE;
+      break;
+    }
+  }
+
+  if(rc == SQLITE_DONE) rc = SQLITE_OK;
+
+err0:
+  release_statement(stmt);
+
+  return rc == SQLITE_OK;
+}
+
+static int resolve_time(storage_interface const * adapter, char const * expression, int64_t * microseconds) {
+  if(!expression || !*expression) return 0;
+
+  if(is_epoch_timestamp(expression)) {
+    *microseconds = epoch_seconds_to_microseconds(expression);
+    return 1;
+  }
+
+  sqlite3_stmt * stmt = get_statement(adapter, STORAGE_STATEMENT_RESOLVE_TIME);
+  if(!stmt) return 0;
+
+  int resolved = 0;
+  if(sqlite3_bind_text(stmt, 1, expression, -1, SQLITE_STATIC) == SQLITE_OK
+      && sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL) {
+    *microseconds = sqlite3_column_int64(stmt, 0);
+    resolved = 1;
+  }
+
+  release_statement(stmt);
+
+  return resolved;
+}
+
+/* Every statement that fires the counter and rollup triggers pays to set
+ * them up, so bulk imports stage feels in a temp table and move them over
+ * with one statement per batch. */
+static int ensure_import_staging(storage_interface const * adapter) {
+  storage_adapter_data * data = ((storage_adapter *)adapter)->data;
+  if(data->has_import_staging) return 1;
+
+  data->has_import_staging = exec_sql(adapter, "create temp table if not exists hif_staged_feels (" \
+      "feel_id integer, feel integer not null, dtm integer not null" \
+    ");");
+
+  return data->has_import_staging;
+}
+
+static long count_staged_feels(storage_interface const * adapter) {
+  sqlite3_stmt * stmt = get_statement(adapter, STORAGE_STATEMENT_COUNT_STAGED_FEELS);
+  if(!stmt) return -1;
+
+  long count = sqlite3_step(stmt) == SQLITE_ROW ? (long)sqlite3_column_int64(stmt, 0) : -1;
+  release_statement(stmt);
+
+  return count;
+}
+
+/* Identical feels restored again are only counted; a restored id that a
+ * different feel or a shard holds is named, the first few per batch */
+static int report_staged_conflicts(storage_interface const * adapter) {
+  sqlite3_stmt * stmt = get_statement(adapter, STORAGE_STATEMENT_STAGED_CONFLICTS);
+  if(!stmt) return 0;
+
+  long conflicts = 0;
+  int rc;
+  while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    if(conflicts++ >= HIF_IMPORT_REPORTED_CONFLICTS) continue;
+
+    long long id = sqlite3_column_int64(stmt, 0);
+    if(sqlite3_column_int(stmt, 1)) {
+      fprintf(stderr, "Feel %lli: the id belongs to a shard; left out.\n", id);
+    } else {
+      fprintf(stderr, "Feel %lli: a different feel already has the id; left out.\n", id);
+    }
+  }
+  if(conflicts > HIF_IMPORT_REPORTED_CONFLICTS) {
+    fprintf(stderr, "...and %li more feels whose ids were taken.\n", conflicts - HIF_IMPORT_REPORTED_CONFLICTS);
+  }
+  release_statement(stmt);
+
+  return rc == SQLITE_DONE;
+}
+
+static int flush_imports(storage_interface const * adapter, long * existing) {
+  storage_adapter_data * data = ((storage_adapter *)adapter)->data;
+  if(!data->has_import_staging) return 1;
+
+  long staged = count_staged_feels(adapter);
+  if(staged < 0 || !report_staged_conflicts(adapter)) return 0;
+
+  /* Restored feels keep their ids; ones already present are left alone,
+   * including any a shard has handed out. New feels are numbered past the
+   * shards' ids. A restore below the newest id is logged in hif_tombstones
+   * as a 'restored feels' row, so exports since a later cursor find it. */
+  if(!exec_sql(adapter, "delete from temp.hif_staged_feels where exists (" \
+        "select 1 from hif_shards where feel_id between first_feel_id and last_feel_id" \
+      ");" \
+      "update temp.hif_staged_feels set feel_id = (select max(last_feel_id) from hif_shards) + rowid " \
+        "where feel_id is null and (select max(last_feel_id) from hif_shards) > coalesce((select max(feel_id) from main.hif_feels), 0);" \
+      "insert into hif_tombstones (kind, row_id) select distinct 'restored feels', s.feel_id from temp.hif_staged_feels s " \
+        "where s.feel_id < " HIF_NEXT_FEEL_ID " and not exists (select 1 from main.hif_feels f where f.feel_id = s.feel_id);" \
+      "insert or ignore into hif_feels (feel_id, feel, dtm) select feel_id, feel, dtm from temp.hif_staged_feels order by rowid;")) {
+    return 0;
+  }
+  if(existing) *existing += staged - sqlite3_changes(data->db);
+
+  return exec_sql(adapter, "delete from temp.hif_staged_feels;");
+}
+
+/* The memo goes in before the feel is staged, so a memo that fails leaves
+ * nothing of its record behind to be flushed */
+static int import_feel(storage_interface const * adapter, int feel_id, char const * dtm, char const * memo) {
+  if(!ensure_import_staging(adapter)) return 0;
+
+  sqlite3_stmt * stmt = get_statement(adapter, STORAGE_STATEMENT_IMPORT_FEEL);
+  if(!stmt) return 0;
+
+  sqlite3_stmt * memo_stmt = NULL;
+
+  int rc = sqlite3_bind_int(stmt, 1, feel_id);
+  if(rc != SQLITE_OK) goto err0;
+
+  rc = bind_timestamp(stmt, 2, dtm);
+  if(rc != SQLITE_OK) goto err0;
+
+  if(memo && *memo) {
+    memo_stmt = get_statement(adapter, STORAGE_STATEMENT_IMPORT_MEMO);
+    if(!memo_stmt) {
+      rc = SQLITE_ERROR;
+      goto err0;
+    }
+
+    rc = sqlite3_bind_text(memo_stmt, 1, memo, -1, SQLITE_STATIC);
+    if(rc != SQLITE_OK) goto err1;
+
+    rc = bind_timestamp(memo_stmt, 2, dtm);
+    if(rc != SQLITE_OK) goto err1;
+
+    rc = sqlite3_step(memo_stmt);
+    if(rc != SQLITE_DONE) goto err1;
+  }
+
+  rc = sqlite3_step(stmt);
+  if(rc == SQLITE_DONE) rc = SQLITE_OK;
+
+err1:
+  release_statement(memo_stmt);
+err0:
+  release_statement(stmt);
+
+  return rc == SQLITE_OK;
+}
+
+static int restore_feel(storage_interface const * adapter, int64_t id, int feel_id, char const * dtm) {
+  if(!ensure_import_staging(adapter)) return 0;
+
+  sqlite3_stmt * stmt = get_statement(adapter, STORAGE_STATEMENT_RESTORE_FEEL);
+  if(!stmt) return 0;
+
+  int rc = sqlite3_bind_int64(stmt, 1, id);
+  if(rc != SQLITE_OK) goto err0;
+
+  rc = sqlite3_bind_int(stmt, 2, feel_id);
+  if(rc != SQLITE_OK) goto err0;
+
+  rc = bind_timestamp(stmt, 3, dtm);
+  if(rc != SQLITE_OK) goto err0;
+
+  rc = sqlite3_step(stmt);
+  if(rc != SQLITE_DONE) goto err0;
+
+  rc = SQLITE_OK;
+
+err0:
+  release_statement(stmt);
+
+  return rc == SQLITE_OK;
+}
+
+storage_durability storage_durability_from_name(char const * name) {
+  if(!name) return STORAGE_DURABILITY_EOF;
+
+  for(storage_durability durability = STORAGE_DURABILITY_STRICT; durability < STORAGE_DURABILITY_EOF; durability++) {
+    if(strcmp(name, DURABILITY_NAMES[durability]) == 0) return durability;
+  }
+
+  return STORAGE_DURABILITY_EOF;
+}
+
+char const * storage_durability_name(storage_durability durability) {
+  if(durability < STORAGE_DURABILITY_DEFAULT || durability >= STORAGE_DURABILITY_EOF) return NULL;
+
+  return DURABILITY_NAMES[durability];
+}
+
+/* NULL when the setting has never been saved */
+static char * alloc_setting(storage_interface const * adapter, char const * name) {
+  sqlite3_stmt * stmt = get_statement(adapter, STORAGE_STATEMENT_GET_SETTING);
+  if(!stmt) return NULL;
+
+  char * value = NULL;
+  if(sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+    value = strdup((char const *)sqlite3_column_text(stmt, 0));
+  }
+
+  release_statement(stmt);
+
+  return value;
+}
+
+static int save_setting(storage_interface const * adapter, char const * name, char const * value) {
+  sqlite3_stmt * stmt = get_statement(adapter, STORAGE_STATEMENT_SET_SETTING);
+  if(!stmt) return 0;
+
+  int rc = sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+  if(rc != SQLITE_OK) goto err0;
+
+  rc = sqlite3_bind_text(stmt, 2, value, -1, SQLITE_STATIC);
+  if(rc != SQLITE_OK) goto err0;
+
+  rc = sqlite3_step(stmt);
+  if(rc != SQLITE_DONE) goto err0;
+
+  rc = SQLITE_OK;
+
+err0:
+  release_statement(stmt);
+
+  return rc == SQLITE_OK;
+}
+
+static storage_durability get_saved_durability(storage_interface const * adapter) {
+  char * name = alloc_setting(adapter, "durability");
+  storage_durability durability = storage_durability_from_name(name);
+  free(name), name = NULL;
+
+  return durability == STORAGE_DURABILITY_EOF ? STORAGE_DURABILITY_STRICT : durability;
+}
+
+/* The journal mode is a property of the file, the synchronous level is per
+ * connection. Leaving WAL needs every other connection to let go of the
+ * file, so a one-off strict override of a WAL context only syncs fully;
+ * opening a strict context, or setting it strict, moves it back. */
+static int set_durability(storage_interface const * adapter, storage_durability durability, int persist) {
+  storage_adapter_data * data = ((storage_adapter *)adapter)->data;
+
+  int overridden = durability != STORAGE_DURABILITY_DEFAULT && !persist;
+  if(durability == STORAGE_DURABILITY_DEFAULT) durability = get_saved_durability(adapter);
+  if(durability <= STORAGE_DURABILITY_DEFAULT || durability >= STORAGE_DURABILITY_EOF) return 0;
+
+  char const * sql = overridden && durability == STORAGE_DURABILITY_STRICT ? "pragma synchronous = full;" : DURABILITY_SQL[durability];
+  if(!exec_sql(adapter, sql)) return 0;
+
+  data->durability = durability;
+
+  return persist ? save_setting(adapter, "durability", DURABILITY_NAMES[durability]) : 1;
+}
+
+static storage_durability get_durability(storage_interface const * adapter) {
+  return ((storage_adapter *)adapter)->data->durability;
+}
+
+storage_partitioning storage_partitioning_from_name(char const * name) {
+  if(!name) return STORAGE_PARTITIONING_EOF;
+
+  for(storage_partitioning partitioning = STORAGE_PARTITIONING_NONE; partitioning < STORAGE_PARTITIONING_EOF; partitioning++) {
+    if(strcmp(name, PARTITIONING_NAMES[partitioning]) == 0) return partitioning;
+  }
+
+  return STORAGE_PARTITIONING_EOF;
+}
+
+char const * storage_partitioning_name(storage_partitioning partitioning) {
+  if(partitioning < STORAGE_PARTITIONING_NONE || partitioning >= STORAGE_PARTITIONING_EOF) return NULL;
+
+  return PARTITIONING_NAMES[partitioning];
+}
+
+static storage_partitioning get_saved_partitioning(storage_interface const * adapter) {
+  char * name = alloc_setting(adapter, "partitioning");
+  storage_partitioning partitioning = storage_partitioning_from_name(name);
+  free(name), name = NULL;
+
+  return partitioning == STORAGE_PARTITIONING_EOF ? STORAGE_PARTITIONING_NONE : partitioning;
+}
+
+/* Shards already written stay where they are, and are still read, when
+ * partitioning is switched off again */
+static int set_partitioning(storage_interface const * adapter, storage_partitioning partitioning) {
+  if(partitioning < STORAGE_PARTITIONING_NONE || partitioning >= STORAGE_PARTITIONING_EOF) return 0;
+  if(!save_setting(adapter, "partitioning", PARTITIONING_NAMES[partitioning])) return 0;
+
+  ((storage_adapter *)adapter)->data->partitioning = partitioning;
+
+  return 1;
+}
+
+static storage_partitioning get_partitioning(storage_interface const * adapter) {
+  return ((storage_adapter *)adapter)->data->partitioning;
+}
+
+static char * alloc_shard_sql(char const * template, char const * schema, int month) {
+  sqlite3_str * sql = sqlite3_str_new(NULL);
+
+  for(char const * p = template; *p; ) {
+    if(strncmp(p, "{shard}", sizeof("{shard}") - 1) == 0) {
+      sqlite3_str_appendall(sql, schema);
+      p += sizeof("{shard}") - 1;
+    } else if(strncmp(p, "{month}", sizeof("{month}") - 1) == 0) {
+      sqlite3_str_appendf(sql, "%d", month);
+      p += sizeof("{month}") - 1;
+    } else {
+      sqlite3_str_appendchar(sql, 1, *p++);
+    }
+  }
+
+  char * result = sqlite3_str_finish(sql);
+  if(!result) abort();
+  return result;
+}
+
+static int exec_shard_sql(storage_interface const * adapter, char const * template, char const * schema, int month) {
+  char * sql = alloc_shard_sql(template, schema, month);
+  int ok = exec_sql(adapter, sql);
+  sqlite3_free(sql), sql = NULL;
+
+  return ok;
+}
+
+static int exec_format(storage_interface const * adapter, char const * format, ...) {
+  va_list ap;
+  va_start(ap, format);
+  char * sql = sqlite3_vmprintf(format, ap);
+  va_end(ap);
+  if(!sql) abort();
+
+  int ok = exec_sql(adapter, sql);
+  sqlite3_free(sql), sql = NULL;
+
+  return ok;
+}
+
+static void shard_schema_name(int month, char schema[HIF_SHARD_SCHEMA_SIZE]) {
+  snprintf(schema, HIF_SHARD_SCHEMA_SIZE, "hif_shard_%06i", month);
+}
+
+/* Triggers on a detached shard would linger in temp, never firing again */
+static int detach_shard(storage_interface const * adapter, char const * schema) {
+  return exec_format(adapter, "drop trigger if exists temp.%s_feels_insert; drop trigger if exists temp.%s_feels_delete; detach database %s;",
+    schema, schema, schema);
+}
+
+/* Writable shards are created as needed, registered in hif_shards,
+ * reconciled with it and get the triggers that keep the context's counters
+ * and rollups current. */
+static int attach_shard(storage_interface const * adapter, int month, char const * schema, int writable) {
+  storage_adapter_data * data = ((storage_adapter *)adapter)->data;
+
+  char * uri = alloc_shard_uri(data->name, month, writable ? "rwc" : "ro");
+  int ok = exec_format(adapter, "attach database %Q as %s;", uri, schema);
+  free(uri), uri = NULL;
+  if(!ok || !writable) return ok;
+
+  time_range range = shard_month_range(month);
+  /* None of the pragmas may run inside a transaction; a shard keeps the
+   * journal it was given as the current month's and syncs fully meanwhile.
+   * auto_vacuum only takes on a shard that has no tables yet. */
+  int in_transaction = !sqlite3_get_autocommit(data->db);
+  ok = (in_transaction || exec_format(adapter, "pragma %s.auto_vacuum = incremental;", schema))
+    && (in_transaction || exec_format(adapter, "pragma %s.journal_mode = %s;", schema, SHARD_JOURNAL_MODES[data->durability]))
+    && (in_transaction || exec_format(adapter, "pragma %s.synchronous = %s;", schema, SHARD_SYNCHRONOUS[data->durability]))
+    && (in_transaction || exec_sql(adapter, "begin immediate;"))
+    && exec_shard_sql(adapter, SHARD_SCHEMA_SQL, schema, month)
+    && exec_shard_sql(adapter, SHARD_STATUSES_SQL, schema, month)
+    && exec_format(adapter, "insert or ignore into main.hif_shards (month, since, until) values (%d, %lld, %lld);",
+      month, (long long)range.since, (long long)range.until)
+    && exec_shard_sql(adapter, SHARD_RECONCILE_SQL, schema, month)
+    && exec_shard_sql(adapter, SHARD_TRIGGERS_SQL, schema, month)
+    && (in_transaction || exec_sql(adapter, "commit;"));
+
+  if(!ok && !in_transaction && !sqlite3_get_autocommit(data->db)) exec_sql(adapter, "rollback;");
+  if(!ok) detach_shard(adapter, schema);
+
+  return ok;
+}
+
+/* Attaching inside a transaction would lose the triggers to a rollback, so
+ * the shard only moves on to a new month between transactions. */
+static int attach_current_shard(storage_interface const * adapter, int64_t now) {
+  storage_adapter_data * data = ((storage_adapter *)adapter)->data;
+
+  int month = shard_month_of(now);
+  if(month == data->current_month) return 1;
+  if(!sqlite3_get_autocommit(data->db)) return 0;
+
+  if(data->current_month && !detach_shard(adapter, HIF_CURRENT_SHARD)) return 0;
+  data->current_month = 0;
+
+  if(!attach_shard(adapter, month, HIF_CURRENT_SHARD, 1)) return 0;
+  data->current_month = month;
+
+  return 1;
+}
+
+/* Past months' shards are attached for the length of one operation, or of
+ * the transaction it runs in */
+static int attach_past_shard(storage_interface const * adapter, int month, int writable, char schema[HIF_SHARD_SCHEMA_SIZE]) {
+  storage_adapter_data * data = ((storage_adapter *)adapter)->data;
+  shard_schema_name(month, schema);
+
+  for(size_t i = 0; i < data->deferred_count; i++) {
+    if(data->deferred_months[i] == month) return data->deferred_writable[i] || !writable;
+  }
+
+  int deferred = !sqlite3_get_autocommit(data->db);
+  if(deferred && data->deferred_count == HIF_SHARD_ATTACH_BATCH) return 0;
+  if(!attach_shard(adapter, month, schema, writable)) return 0;
+
+  if(deferred) {
+    data->deferred_months[data->deferred_count] = month;
+    data->deferred_writable[data->deferred_count++] = writable;
+  }
+
+  return 1;
+}
+
+static int release_past_shard(storage_interface const * adapter, int month, char const * schema) {
+  storage_adapter_data * data = ((storage_adapter *)adapter)->data;
+  if(!sqlite3_get_autocommit(data->db)) return 1;
+
+  for(size_t i = 0; i < data->deferred_count; i++) {
+    if(data->deferred_months[i] != month) continue;
+    data->deferred_months[i] = data->deferred_months[--data->deferred_count];
+    data->deferred_writable[i] = data->deferred_writable[data->deferred_count];
+    break;
+  }
+
+  return detach_shard(adapter, schema);
+}
+
+static void detach_deferred_shards(storage_interface const * adapter) {
+  storage_adapter_data * data = ((storage_adapter *)adapter)->data;
+
+  for(size_t i = 0; i < data->deferred_count; i++) {
+    char schema[HIF_SHARD_SCHEMA_SIZE];
+    shard_schema_name(data->deferred_months[i], schema);
+    detach_shard(adapter, schema);
+  }
+  data->deferred_count = 0;
+}
+
+static int sync_shard_statuses(storage_interface const * adapter) {
+  storage_adapter_data * data = ((storage_adapter *)adapter)->data;
+  if(!data->current_month) return 1;
+
+  return exec_shard_sql(adapter, SHARD_STATUSES_SQL, HIF_CURRENT_SHARD, data->current_month);
+}
+
+/* Months whose shards hold feels in range, oldest first */
+static int * alloc_shard_months(storage_interface const * adapter, time_range const * range, size_t * count) {
+  *count = 0;
+
+  sqlite3_stmt * stmt = get_statement(adapter, STORAGE_STATEMENT_SHARDS_BETWEEN);
+  if(!stmt) return NULL;
+
+  size_t capacity = 16;
+  int * months = malloc(capacity * sizeof * months);
+  if(!months) abort();
+
+  int rc = sqlite3_bind_int64(stmt, 1, range->since);
+  if(rc == SQLITE_OK) rc = sqlite3_bind_int64(stmt, 2, range->until);
+  while(rc == SQLITE_OK && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    if(*count == capacity) {
+      capacity *= 2;
+      months = realloc(months, capacity * sizeof * months);
+      if(!months) abort();
+    }
+    months[(*count)++] = sqlite3_column_int(stmt, 0);
+    rc = SQLITE_OK;
+  }
+
+  release_statement(stmt);
+
+  if(rc != SQLITE_DONE) free(months), months = NULL;
+
+  return months;
+}
+
+/* Each batch of shards is attached read-only and counted through one view
+ * over all of them; returns -1 on failure */
+static int64_t count_shard_feels(storage_interface const * adapter, char const * feel, time_range const * range) {
+  storage_adapter_data * data = ((storage_adapter *)adapter)->data;
+
+  size_t month_count = 0;
+  int * months = alloc_shard_months(adapter, range, &month_count);
+  if(!months) return -1;
+
+  int64_t count = 0;
+  for(size_t first = 0; first < month_count && count >= 0; first += HIF_SHARD_ATTACH_BATCH) {
+    size_t last = first + HIF_SHARD_ATTACH_BATCH < month_count ? first + HIF_SHARD_ATTACH_BATCH : month_count;
+
+    char schemas[HIF_SHARD_ATTACH_BATCH][HIF_SHARD_SCHEMA_SIZE];
+    sqlite3_str * view = sqlite3_str_new(NULL);
+    sqlite3_str_appendall(view, "create temp view hif_shard_feels as ");
+
+    size_t attached = first;
+    for(; attached < last; attached++) {
+      char * schema = schemas[attached - first];
+      if(months[attached] == data->current_month) {
+        snprintf(schema, HIF_SHARD_SCHEMA_SIZE, "%s", HIF_CURRENT_SHARD);
+      } else {
+        if(!attach_past_shard(adapter, months[attached], 0, schema)) break;
+      }
+      sqlite3_str_appendf(view, "%sselect feel, dtm from %s.hif_feels", attached > first ? " union all " : "", schema);
+    }
+
+    char * sql = sqlite3_str_finish(view);
+    if(!sql) abort();
+
+    int64_t batch = -1;
+    if(attached == last && exec_sql(adapter, sql)) {
+      batch = query_count(adapter, feel ? STORAGE_STATEMENT_COUNT_SHARD_STATUS_FEELS_BETWEEN : STORAGE_STATEMENT_COUNT_SHARD_FEELS_BETWEEN, feel, range);
+      exec_sql(adapter, "drop view if exists temp.hif_shard_feels;");
+    }
+    sqlite3_free(sql), sql = NULL;
+
+    for(size_t i = first; i < attached; i++) {
+      if(months[i] != data->current_month) release_past_shard(adapter, months[i], schemas[i - first]);
+    }
+
+    count = batch < 0 ? -1 : count + batch;
+  }
+
+  free(months), months = NULL;
+
+  return count;
+}
+
+/* Feels missing from the context are looked for in the shards whose ids
+ * cover them; sealed shards are read-only. */
+static int delete_shard_feel(storage_interface const * adapter, int id, int * affected_rows) {
+  storage_adapter_data * data = ((storage_adapter *)adapter)->data;
+
+  int months[HIF_SHARD_ATTACH_BATCH], sealed[HIF_SHARD_ATTACH_BATCH];
+  size_t count = 0;
+
+  sqlite3_stmt * stmt = get_statement(adapter, STORAGE_STATEMENT_FEEL_SHARDS);
+  if(!stmt) return 0;
+
+  int rc = sqlite3_bind_int(stmt, 1, id);
+  while(rc == SQLITE_OK && count < HIF_SHARD_ATTACH_BATCH && sqlite3_step(stmt) == SQLITE_ROW) {
+    months[count] = sqlite3_column_int(stmt, 0);
+    sealed[count++] = sqlite3_column_int(stmt, 1);
+  }
+
+  release_statement(stmt);
+  if(rc != SQLITE_OK) return 0;
+
+  int ok = 1;
+  for(size_t i = 0; ok && i < count && *affected_rows == 0; i++) {
+    char name[HIF_SHARD_NAME_SIZE];
+    shard_month_name(months[i], name);
+
+    char schema[HIF_SHARD_SCHEMA_SIZE];
+    int is_current = months[i] == data->current_month;
+    if(is_current) {
+      snprintf(schema, sizeof schema, "%s", HIF_CURRENT_SHARD);
+    } else if(sealed[i]) {
+      fprintf(stderr, "Feel %i may be in the %s shard, which is sealed.\n", id, name);
+      continue;
+    } else if(!attach_past_shard(adapter, months[i], 1, schema)) {
+      ok = 0;
+      break;
+    }
+
+    ok = exec_format(adapter, "delete from %s.hif_feels where feel_id = %d;", schema, id);
+    if(ok) *affected_rows = sqlite3_changes(data->db);
+
+    if(!is_current) ok = release_past_shard(adapter, months[i], schema) && ok;
+  }
+
+  return ok;
+}
+
+static int query_shards(storage_interface const * adapter, shard_handler handler, void * context) {
+  sqlite3_stmt * stmt = get_statement(adapter, STORAGE_STATEMENT_LIST_SHARDS);
+  if(!stmt) return 0;
+
+  int rc;
+  while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    if(!handler(context, sqlite3_column_int(stmt, 0), sqlite3_column_int64(stmt, 1), sqlite3_column_int(stmt, 2))) {
+      rc = SQLITE_DONE;
+      break;
+    }
+  }
+
+  release_statement(stmt);
+
+  return rc == SQLITE_DONE;
+}
+
+/* -1 when the month has no shard */
+static int get_shard_sealed(storage_interface const * adapter, int month) {
+  sqlite3_stmt * stmt = get_statement(adapter, STORAGE_STATEMENT_SHARD_SEALED);
+  if(!stmt) return -1;
+
+  int sealed = -1;
+  if(sqlite3_bind_int(stmt, 1, month) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) sealed = sqlite3_column_int(stmt, 0);
+
+  release_statement(stmt);
+
+  return sealed;
+}
+
+/* Only months that are over can be sealed; sealing marks the shard before
+ * its file turns read-only, so no delete starts on it in between. */
+static int maintain_shard(storage_interface const * adapter, int month, storage_shard_task task) {
+  storage_adapter_data * data = ((storage_adapter *)adapter)->data;
+  if(task < STORAGE_SHARD_SEAL || task >= STORAGE_SHARD_EOF) return 0;
+
+  char name[HIF_SHARD_NAME_SIZE];
+  shard_month_name(month, name);
+
+  int sealed = get_shard_sealed(adapter, month);
+  if(sealed < 0) {
+    fprintf(stderr, "There is no shard for %s.\n", name);
+    return 0;
+  }
+
+  if(task == STORAGE_SHARD_COMPACT) {
+    if(!sealed) fprintf(stderr, "Only sealed shards are compacted; seal %s first.\n", name);
+    return sealed && compact_shard_file(data->name, month);
+  }
+
+  if(sealed) return 1;
+  if(month >= shard_month_of(now_microseconds())) {
+    fprintf(stderr, "The %s shard is still being written; seal it once the month is over.\n", name);
+    return 0;
+  }
+
+  if(month == data->current_month) {
+    if(!detach_shard(adapter, HIF_CURRENT_SHARD)) return 0;
+    data->current_month = 0;
+  }
+
+  return exec_format(adapter, "update hif_shards set sealed = 1 where month = %d;", month)
+    && seal_shard_file(data->name, month);
+}
+
+/* Conditions are only written out when the filter has them, so a status or
+ * time filter can use its index. The shards' statuses keep the context's ids. */
+static char * alloc_delete_sql(char const * schema, feel_filter const * filter) {
+  sqlite3_str * sql = sqlite3_str_new(NULL);
+
+  sqlite3_str_appendf(sql, "delete from %s.hif_feels where feel_id in (select feel_id from %s.hif_feels where feel_id between ?1 and ?2", schema, schema);
+  if(filter->range) sqlite3_str_appendall(sql, " and dtm >= ?3 and dtm < ?4");
+  if(filter->feel) sqlite3_str_appendall(sql, " and feel = (select status_id from main.hif_statuses where status = ?5)");
+  sqlite3_str_appendall(sql, " limit ?6);");
+
+  char * result = sqlite3_str_finish(sql);
+  if(!result) abort();
+  return result;
+}
+
+static int delete_matching(storage_interface const * adapter, char const * schema, feel_filter const * filter, int limit) {
+  storage_adapter_data * data = ((storage_adapter *)adapter)->data;
+
+  char * sql = alloc_delete_sql(schema, filter);
+  sqlite3_stmt * stmt = NULL;
+  int rc = sqlite3_prepare_v2(data->db, sql, -1, &stmt, NULL);
+  sqlite3_free(sql), sql = NULL;
+  if(rc != SQLITE_OK) goto err0;
+
+  if(trace_enabled) trace_statement_begin(stmt);
+
+  rc = sqlite3_bind_int64(stmt, 1, filter->first_id);
+  if(rc == SQLITE_OK) rc = sqlite3_bind_int64(stmt, 2, filter->last_id);
+  if(rc == SQLITE_OK) rc = sqlite3_bind_int64(stmt, 3, filter->range ? filter->range->since : HIF_TIME_MIN);
+  if(rc == SQLITE_OK) rc = sqlite3_bind_int64(stmt, 4, filter->range ? filter->range->until : HIF_TIME_MAX);
+  if(rc == SQLITE_OK) rc = sqlite3_bind_text(stmt, 5, filter->feel, -1, SQLITE_STATIC);
+  if(rc == SQLITE_OK) rc = sqlite3_bind_int(stmt, 6, limit);
+  if(rc == SQLITE_OK) rc = sqlite3_step(stmt);
+
+  if(trace_enabled) trace_statement_end(stmt);
+
+err0:
+  if(rc != SQLITE_DONE) fprintf(stderr, "Failed to delete feels: %s\n", sqlite3_errmsg(data->db));
+  sqlite3_finalize(stmt);
+
+  return rc == SQLITE_DONE ? sqlite3_changes(data->db) : -1;
+}
+
+/* The context is emptied of matches first, then each unsealed shard in
+ * turn; sealed shards are reported once nothing else is left. */
+static int delete_feels(storage_interface const * adapter, feel_filter const * filter, int limit) {
+  storage_adapter_data * data = ((storage_adapter *)adapter)->data;
+  if(limit <= 0) return -1;
+
+  int deleted = delete_matching(adapter, "main", filter, limit);
+  if(deleted != 0) return deleted;
+
+  sqlite3_stmt * stmt = get_statement(adapter, STORAGE_STATEMENT_SHARDS_MATCHING);
+  if(!stmt) return 0;
+
+  size_t count = 0, capacity = 16;
+  int * months = malloc(capacity * sizeof * months), * sealed = malloc(capacity * sizeof * sealed);
+  if(!months || !sealed) abort();
+
+  int rc = sqlite3_bind_int64(stmt, 1, filter->range ? filter->range->since : HIF_TIME_MIN);
+  if(rc == SQLITE_OK) rc = sqlite3_bind_int64(stmt, 2, filter->range ? filter->range->until : HIF_TIME_MAX);
+  if(rc == SQLITE_OK) rc = sqlite3_bind_int64(stmt, 3, filter->first_id);
+  if(rc == SQLITE_OK) rc = sqlite3_bind_int64(stmt, 4, filter->last_id);
+  while(rc == SQLITE_OK && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    if(count == capacity) {
+      capacity *= 2;
+      months = realloc(months, capacity * sizeof * months);
+      sealed = realloc(sealed, capacity * sizeof * sealed);
+      if(!months || !sealed) abort();
+    }
+    months[count] = sqlite3_column_int(stmt, 0);
+    sealed[count++] = sqlite3_column_int(stmt, 1);
+    rc = SQLITE_OK;
+  }
+
+  release_statement(stmt);
+  if(rc != SQLITE_DONE) deleted = -1;
+
+  for(size_t i = 0; deleted == 0 && i < count; i++) {
+    if(sealed[i]) continue;
+
+    char schema[HIF_SHARD_SCHEMA_SIZE];
+    int is_current = months[i] == data->current_month;
+    if(is_current) {
+      snprintf(schema, sizeof schema, "%s", HIF_CURRENT_SHARD);
+    } else if(!attach_past_shard(adapter, months[i], 1, schema)) {
+      deleted = -1;
+      break;
+    }
+
+    deleted = delete_matching(adapter, schema, filter, limit);
+
+    if(!is_current && !release_past_shard(adapter, months[i], schema)) deleted = -1;
+  }
+
+  for(size_t i = 0; deleted == 0 && i < count; i++) {
+    if(!sealed[i]) continue;
+
+    char name[HIF_SHARD_NAME_SIZE];
+    shard_month_name(months[i], name);
+    fprintf(stderr, "Feels in the %s shard were left alone, it is sealed.\n", name);
+  }
+
+  free(sealed), sealed = NULL;
+  free(months), months = NULL;
+
+  return deleted;
+}
+
+static int query_pragma(storage_interface const * adapter, char const * schema, char const * pragma, int64_t * value) {
+  char * sql = sqlite3_mprintf("pragma %s.%s;", schema, pragma);
+  if(!sql) abort();
+
+  sqlite3_stmt * stmt = NULL;
+  int rc = sqlite3_prepare_v2(((storage_adapter *)adapter)->data->db, sql, -1, &stmt, NULL);
+  sqlite3_free(sql), sql = NULL;
+
+  int found = rc == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW;
+  if(found) *value = sqlite3_column_int64(stmt, 0);
+  sqlite3_finalize(stmt);
+
+  return found;
+}
+
+/* Databases without incremental auto_vacuum (2) have nothing to give back
+ * short of a VACUUM */
+static int reclaim_schema(storage_interface const * adapter, char const * schema, int pages) {
+  int64_t auto_vacuum = 0, before = 0, after = 0;
+
+  if(!query_pragma(adapter, schema, "auto_vacuum", &auto_vacuum)) return -1;
+  if(auto_vacuum != 2) return 0;
+
+  if(!query_pragma(adapter, schema, "freelist_count", &before)) return -1;
+  if(before == 0) return 0;
+
+  if(!exec_format(adapter, "pragma %s.incremental_vacuum(%d);", schema, pages)) return -1;
+  if(!query_pragma(adapter, schema, "freelist_count", &after)) return -1;
+
+  return (int)(before - after);
+}
+
+/* Months of the shards that can still be written, oldest first */
+static int * alloc_unsealed_months(storage_interface const * adapter, size_t * count) {
+  *count = 0;
+
+  sqlite3_stmt * stmt = get_statement(adapter, STORAGE_STATEMENT_LIST_SHARDS);
+  if(!stmt) return NULL;
+
+  size_t capacity = 16;
+  int * months = malloc(capacity * sizeof * months);
+  if(!months) abort();
+
+  int rc;
+  while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    if(sqlite3_column_int(stmt, 2)) continue;
+    if(*count == capacity) {
+      capacity *= 2;
+      months = realloc(months, capacity * sizeof * months);
+      if(!months) abort();
+    }
+    months[(*count)++] = sqlite3_column_int(stmt, 0);
+  }
+
+  release_statement(stmt);
+
+  if(rc != SQLITE_DONE) free(months), months = NULL;
+
+  return months;
+}
+
+typedef int (*shard_step)(storage_interface const * adapter, char const * schema, int pages);
+
+/* Runs step on the context, then on each unsealed shard, until one of them
+ * has done something */
+static int step_unsealed(storage_interface const * adapter, shard_step step, int pages) {
+  storage_adapter_data * data = ((storage_adapter *)adapter)->data;
+
+  int result = step(adapter, "main", pages);
+  if(result != 0) return result;
+
+  size_t count = 0;
+  int * months = alloc_unsealed_months(adapter, &count);
+  if(!months) return -1;
+
+  for(size_t i = 0; result == 0 && i < count; i++) {
+    char schema[HIF_SHARD_SCHEMA_SIZE];
+    int is_current = months[i] == data->current_month;
+    if(is_current) {
+      snprintf(schema, sizeof schema, "%s", HIF_CURRENT_SHARD);
+    } else if(!attach_past_shard(adapter, months[i], 1, schema)) {
+      result = -1;
+      break;
+    }
+
+    result = step(adapter, schema, pages);
+
+    if(!is_current && !release_past_shard(adapter, months[i], schema)) result = -1;
+  }
+
+  free(months), months = NULL;
+
+  return result;
+}
+
+static int reclaim_space(storage_interface const * adapter, int pages) {
+  if(pages <= 0) return -1;
+
+  int freed = step_unsealed(adapter, &reclaim_schema, pages);
+  if(freed != 0) return freed;
+
+  int64_t auto_vacuum = 0, free_pages = 0;
+  if(query_pragma(adapter, "main", "auto_vacuum", &auto_vacuum) && auto_vacuum != 2
+    && query_pragma(adapter, "main", "freelist_count", &free_pages) && free_pages > 0) {
+    fprintf(stderr, "The context predates incremental compaction; 'hif compact --full' returns its %lld free pages once.\n", (long long)free_pages);
+  }
+
+  return 0;
+}
+
+/* Succeeds with 0, so step_unsealed goes on to every database */
+static int vacuum_schema(storage_interface const * adapter, char const * schema, int pages) {
+  (void)pages;
+
+  return exec_format(adapter, "pragma %s.auto_vacuum = incremental; vacuum %s;", schema, schema) ? 0 : -1;
+}
+
+static int vacuum(storage_interface const * adapter) {
+  if(!sqlite3_get_autocommit(((storage_adapter *)adapter)->data->db)) return 0;
+
+  return step_unsealed(adapter, &vacuum_schema, 0) == 0;
+}
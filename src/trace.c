@@ -0,0 +1,129 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sqlite3.h>
+
+#include "json_escape.h"
+#include "trace.h"
+
+/* Statements in use at once; the adapter seldom nests more than two */
+#define TRACE_OPEN_STATEMENTS 8
+
+typedef struct trace_open_statement {
+  sqlite3_stmt * stmt;
+  int64_t started;
+} trace_open_statement;
+
+int trace_enabled = 0;
+
+static FILE * trace_out = NULL;
+static int64_t trace_origin = 0;
+static _Thread_local trace_open_statement open_statements[TRACE_OPEN_STATEMENTS];
+
+int64_t trace_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int trace_open(char const * destination) {
+  if(trace_enabled) return 1;
+
+  if(!destination || !*destination || strcmp(destination, "stderr") == 0 || strcmp(destination, "1") == 0) {
+    trace_out = stderr;
+  } else {
+    trace_out = fopen(destination, "a");
+    if(!trace_out) return 0;
+  }
+
+  memset(open_statements, 0, sizeof open_statements);
+  trace_origin = trace_now();
+  trace_enabled = 1;
+
+  return 1;
+}
+
+void trace_close() {
+  if(!trace_enabled) return;
+
+  fflush(trace_out);
+  if(trace_out != stderr) fclose(trace_out);
+  trace_out = NULL;
+  trace_enabled = 0;
+}
+
+void trace_phase(char const * phase, int64_t started) {
+  int64_t now = trace_now();
+  fprintf(trace_out, "{\"trace\": \"phase\", \"at_us\": %lli, \"phase\": \"%s\", \"us\": %lli}\n",
+    (long long)(started - trace_origin), phase, (long long)(now - started));
+}
+
+void trace_statement_begin(sqlite3_stmt * stmt) {
+  for(size_t i = 0; i < TRACE_OPEN_STATEMENTS; i++) {
+    if(!open_statements[i].stmt || open_statements[i].stmt == stmt) {
+      open_statements[i].stmt = stmt;
+      open_statements[i].started = trace_now();
+      return;
+    }
+  }
+}
+
+/* Counters are reset as they are read, so each line covers one use */
+void trace_statement_end(sqlite3_stmt * stmt) {
+  int64_t now = trace_now();
+  int64_t started = now;
+  for(size_t i = 0; i < TRACE_OPEN_STATEMENTS; i++) {
+    if(open_statements[i].stmt == stmt) {
+      started = open_statements[i].started;
+      open_statements[i].stmt = NULL;
+      break;
+    }
+  }
+
+  char * sql = alloc_json_escape_string((unsigned char const *)sqlite3_sql(stmt));
+  fprintf(trace_out, "{\"trace\": \"statement\", \"at_us\": %lli, \"us\": %lli, \"sql\": \"%s\", "
+    "\"runs\": %i, \"vm_steps\": %i, \"fullscan_steps\": %i, \"sorts\": %i, \"autoindexes\": %i}\n",
+    (long long)(started - trace_origin), (long long)(now - started), sql ? sql : "",
+    sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_RUN, 1),
+    sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_VM_STEP, 1),
+    sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1),
+    sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_SORT, 1),
+    sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_AUTOINDEX, 1));
+  free(sql), sql = NULL;
+}
+
+void trace_db(sqlite3 * db) {
+  int hits = 0, misses = 0, writes = 0, cache_used = 0, schema_used = 0, statements_used = 0, ignored = 0;
+  sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_HIT, &hits, &ignored, 0);
+  sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_MISS, &misses, &ignored, 0);
+  sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_WRITE, &writes, &ignored, 0);
+  sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_USED, &cache_used, &ignored, 0);
+  sqlite3_db_status(db, SQLITE_DBSTATUS_SCHEMA_USED, &schema_used, &ignored, 0);
+  sqlite3_db_status(db, SQLITE_DBSTATUS_STMT_USED, &statements_used, &ignored, 0);
+
+  fprintf(trace_out, "{\"trace\": \"db\", \"at_us\": %lli, \"cache_hits\": %i, \"cache_misses\": %i, \"cache_writes\": %i, "
+    "\"cache_bytes\": %i, \"schema_bytes\": %i, \"statement_bytes\": %i}\n",
+    (long long)(trace_now() - trace_origin), hits, misses, writes, cache_used, schema_used, statements_used);
+}
+
+void trace_memory() {
+  sqlite3_int64 used = 0, peak = 0, allocations = 0, peak_allocations = 0;
+  sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &used, &peak, 0);
+  sqlite3_status64(SQLITE_STATUS_MALLOC_COUNT, &allocations, &peak_allocations, 0);
+
+  fprintf(trace_out, "{\"trace\": \"memory\", \"at_us\": %lli, \"sqlite_bytes\": %lli, \"sqlite_peak_bytes\": %lli, "
+    "\"sqlite_allocations\": %lli, \"sqlite_peak_allocations\": %lli}\n",
+    (long long)(trace_now() - trace_origin), (long long)used, (long long)peak,
+    (long long)allocations, (long long)peak_allocations);
+}
+
+/* Throughput is uncompressed bytes per microsecond, which is MB/s */
+void trace_compression(char const * codec, int64_t started, int64_t compress_us, uint64_t bytes_in, uint64_t bytes_out, long waits) {
+  int64_t us = trace_now() - started;
+  fprintf(trace_out, "{\"trace\": \"compression\", \"at_us\": %lli, \"codec\": \"%s\", \"us\": %lli, \"compress_us\": %lli, "
+    "\"bytes_in\": %llu, \"bytes_out\": %llu, \"ratio\": %.2f, \"mb_per_second\": %.1f, \"waits\": %li}\n",
+    (long long)(started - trace_origin), codec, (long long)us, (long long)compress_us,
+    (unsigned long long)bytes_in, (unsigned long long)bytes_out,
+    bytes_out ? (double)bytes_in / (double)bytes_out : 0.0, us > 0 ? (double)bytes_in / (double)us : 0.0, waits);
+}